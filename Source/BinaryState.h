@@ -0,0 +1,211 @@
+/*
+  ==============================================================================
+
+    BinaryState.h
+    Created: 16 Oct 2023 9:42:18am
+    Author:  Jeremy Bai
+
+  ==============================================================================
+*/
+
+#ifndef Binary_State_h
+#define Binary_State_h
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+/**
+ Compact versioned encoding of the processor's state
+
+ Replaces the XML that getStateInformation used to write, which a session
+ with hundreds of instances spent most of its load time parsing. The layout,
+ all little endian, is
+
+     uint32  magic "FHNS"
+     uint16  version
+     uint16  number of parameter records
+     int32   current program, -1 for none
+     uint32  bytes of the custom network text
+     records of uint32 parameter ID hash and float32 value in the parameter's own units
+     custom network text, UTF-8
+
+ Values are stored in plain units and matched to parameters by a hash of
+ their ID rather than their order, so parameters can be added, removed or
+ have their ranges changed without breaking saved states. A parameter the
+ state does not mention is set to its default. Later versions may only
+ append to this layout, so a reader ignores bytes after the text.
+
+ Applying a state only touches the parameters whose value differs, which is
+ also what makes switching between presets of a PresetBank cheap.
+ */
+class BinaryState
+{
+public:
+    static constexpr juce::uint32 magic = 0x534e4846;     // "FHNS"
+    static constexpr juce::uint16 version = 1;
+    static constexpr size_t headerSize = 16;
+    static constexpr size_t recordSize = 8;
+
+    /// what a state holds besides the parameter values
+    struct Extras
+    {
+        int program = -1;
+        juce::String customNetwork;
+    };
+
+    /// 32 bit FNV-1a of the UTF-8 text, the same on every platform and build
+    static juce::uint32 hash(const juce::String& text)
+    {
+        juce::uint32 h = 2166136261u;
+
+        for (auto* c = text.toRawUTF8(); *c != 0; c++)
+        {
+            h ^= static_cast<juce::uint8>(*c);
+            h *= 16777619u;
+        }
+
+        return h;
+    }
+
+    /// true if data starts like a state written by write(), anything else is taken to be the old XML
+    static bool isBinaryState(const void* data, size_t size)
+    {
+        return data != nullptr && size >= headerSize && juce::ByteOrder::littleEndianInt(data) == magic;
+    }
+
+    explicit BinaryState(juce::AudioProcessor& processor)
+    {
+        for (auto* parameter : processor.getParameters())
+            if (auto* ranged = dynamic_cast<juce::RangedAudioParameter*>(parameter))
+                parameters.push_back({ hash(ranged->paramID), ranged });
+
+        std::sort(parameters.begin(), parameters.end(), [](const Entry& x, const Entry& y) { return x.id < y.id; });
+
+        // two IDs with the same hash would make their values indistinguishable, rename one of them
+        jassert(std::adjacent_find(parameters.begin(), parameters.end(),
+                                   [](const Entry& x, const Entry& y) { return x.id == y.id; }) == parameters.end());
+    }
+
+    /// encode every parameter's current value and the extras
+    void write(juce::MemoryBlock& dest, const Extras& extras) const
+    {
+        const auto text = extras.customNetwork.toUTF8();
+        const auto textBytes = static_cast<juce::uint32>(text.sizeInBytes() - 1);
+
+        dest.setSize(headerSize + recordSize * parameters.size() + textBytes);
+        auto* out = static_cast<char*>(dest.getData());
+
+        writeInt(out, magic);
+        writeShort(out + 4, version);
+        writeShort(out + 6, static_cast<juce::uint16>(parameters.size()));
+        writeInt(out + 8, static_cast<juce::uint32>(extras.program));
+        writeInt(out + 12, textBytes);
+        out += headerSize;
+
+        for (const auto& entry : parameters)
+        {
+            const float value = entry.parameter->convertFrom0to1(entry.parameter->getValue());
+            juce::uint32 bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+
+            writeInt(out, entry.id);
+            writeInt(out + 4, bits);
+            out += recordSize;
+        }
+
+        std::memcpy(out, text.getAddress(), textBytes);
+    }
+
+    /**
+     Apply a state written by write(), changing only the parameters that differ
+
+     Checks the whole state before touching anything, so a truncated or
+     foreign block leaves the processor as it was.
+
+     @param extras receives the program and custom network stored with the state
+     @returns false if the data is not a valid state
+     */
+    bool apply(const void* data, size_t size, Extras& extras) const
+    {
+        if (!isBinaryState(data, size))
+            return false;
+
+        auto* in = static_cast<const char*>(data);
+        const size_t numRecords = juce::ByteOrder::littleEndianShort(in + 6);
+        const size_t textBytes = juce::ByteOrder::littleEndianInt(in + 12);
+
+        if (juce::ByteOrder::littleEndianShort(in + 4) < 1 || size < headerSize + recordSize * numRecords + textBytes)
+            return false;
+
+        extras.program = static_cast<int>(juce::ByteOrder::littleEndianInt(in + 8));
+        extras.customNetwork = juce::String::fromUTF8(in + headerSize + recordSize * numRecords, static_cast<int>(textBytes));
+
+        // records are written in hash order, but do not rely on it for states from elsewhere
+        std::vector<bool> seen(parameters.size(), false);
+
+        for (size_t i = 0; i < numRecords; i++)
+        {
+            auto* record = in + headerSize + recordSize * i;
+            const auto id = static_cast<juce::uint32>(juce::ByteOrder::littleEndianInt(record));
+            const auto found = std::lower_bound(parameters.begin(), parameters.end(), id,
+                                                [](const Entry& entry, juce::uint32 value) { return entry.id < value; });
+
+            // a parameter this build no longer has
+            if (found == parameters.end() || found->id != id)
+                continue;
+
+            const juce::uint32 bits = juce::ByteOrder::littleEndianInt(record + 4);
+            float value;
+            std::memcpy(&value, &bits, sizeof(value));
+
+            seen[static_cast<size_t>(found - parameters.begin())] = true;
+            setIfDifferent(*found->parameter, found->parameter->convertTo0to1(value), value);
+        }
+
+        // a parameter added after the state was saved
+        for (size_t i = 0; i < parameters.size(); i++)
+        {
+            if (!seen[i])
+            {
+                auto& parameter = *parameters[i].parameter;
+                const float normalised = parameter.getDefaultValue();
+                setIfDifferent(parameter, normalised, parameter.convertFrom0to1(normalised));
+            }
+        }
+
+        return true;
+    }
+
+private:
+    struct Entry
+    {
+        juce::uint32 id;
+        juce::RangedAudioParameter* parameter;
+    };
+
+    /// compared in plain units, which is what write() stored, so an unchanged value is never set again
+    static void setIfDifferent(juce::RangedAudioParameter& parameter, float normalised, float value)
+    {
+        if (parameter.convertFrom0to1(parameter.getValue()) != value)
+            parameter.setValueNotifyingHost(normalised);
+    }
+
+    static void writeInt(char* dest, juce::uint32 value)
+    {
+        value = juce::ByteOrder::swapIfBigEndian(value);
+        std::memcpy(dest, &value, sizeof(value));
+    }
+
+    static void writeShort(char* dest, juce::uint16 value)
+    {
+        value = juce::ByteOrder::swapIfBigEndian(value);
+        std::memcpy(dest, &value, sizeof(value));
+    }
+
+    // sorted by id
+    std::vector<Entry> parameters;
+};
+
+#endif /* BinaryState.h */
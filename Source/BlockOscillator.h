@@ -0,0 +1,176 @@
+/*
+  ==============================================================================
+
+    BlockOscillator.h
+    Created: 30 Sep 2023 4:52:37pm
+    Author:  Jeremy Bai
+
+  ==============================================================================
+*/
+
+#ifndef Block_Oscillator_h
+#define Block_Oscillator_h
+
+#include <JuceHeader.h>
+#include <cmath>
+#include "FastMath.h"
+
+/**
+ Band-limited oscillator that renders whole blocks
+
+ Unlike Phasor there is no virtual call per sample: the waveform is an enum
+ that is switched on once per block, and each case runs its own loop. The
+ sine loop only accumulates phases and then takes fastSin2Pi() of the whole
+ block in SIMD registers. Square and saw are corrected with PolyBLEP at
+ every discontinuity so they do not alias into the FHN solver.
+
+ Phase modulation is supported by passing a phase offset per sample. The
+ PolyBLEP correction then uses the effective phase increment, including the
+ change of the offset.
+ */
+class BlockOscillator
+{
+public:
+    enum class Waveform
+    {
+        sine = 0,
+        square,
+        saw
+    };
+
+    void setSampleRate(float sr)
+    {
+        inverseSampleRate = 1.0f / sr;
+    }
+
+    void setWaveform(Waveform newWaveform)
+    {
+        waveform = newWaveform;
+    }
+
+    Waveform getWaveform() const
+    {
+        return waveform;
+    }
+
+    /// fraction of the period spent high, square wave only
+    void setPulseWidth(float pw)
+    {
+        pulseWidth = juce::jlimit(0.01f, 0.99f, pw);
+    }
+
+    void resetPhase()
+    {
+        phase = 0.0f;
+        lastOffset = 0.0f;
+    }
+
+    /**
+     Render numSamples samples
+
+     @param frequency per sample frequency in Hz
+     @param frequencyScale every frequency is multiplied by this
+     @param phaseOffset per sample phase offset in periods, or nullptr for none
+     @param output destination, may alias neither input
+     */
+    void render(const float* frequency, float frequencyScale, const float* phaseOffset, float* output, int numSamples)
+    {
+        const float scale = frequencyScale * inverseSampleRate;
+
+        if (phaseOffset != nullptr)
+        {
+            switch (waveform)
+            {
+                case Waveform::sine:    renderWith<Waveform::sine, true>(frequency, scale, phaseOffset, output, numSamples); break;
+                case Waveform::square:  renderWith<Waveform::square, true>(frequency, scale, phaseOffset, output, numSamples); break;
+                case Waveform::saw:     renderWith<Waveform::saw, true>(frequency, scale, phaseOffset, output, numSamples); break;
+            }
+        }
+        else
+        {
+            switch (waveform)
+            {
+                case Waveform::sine:    renderWith<Waveform::sine, false>(frequency, scale, phaseOffset, output, numSamples); break;
+                case Waveform::square:  renderWith<Waveform::square, false>(frequency, scale, phaseOffset, output, numSamples); break;
+                case Waveform::saw:     renderWith<Waveform::saw, false>(frequency, scale, phaseOffset, output, numSamples); break;
+            }
+        }
+    }
+
+private:
+    /// PolyBLEP residual for a unit step at phase 0, t in [0, 1) and dt the phase increment
+    static inline float polyBlep(float t, float dt)
+    {
+        if (t < dt)
+        {
+            t /= dt;
+            return t + t - t * t - 1.0f;
+        }
+        if (t > 1.0f - dt)
+        {
+            t = (t - 1.0f) / dt;
+            return t * t + t + t + 1.0f;
+        }
+        return 0.0f;
+    }
+
+    template <Waveform shape, bool modulated>
+    void renderWith(const float* frequency, float scale, const float* phaseOffset, float* output, int numSamples)
+    {
+        float ph = phase;
+        float previousOffset = lastOffset;
+
+        for (int i = 0; i < numSamples; i++)
+        {
+            const float delta = frequency[i] * scale;
+            ph += delta;
+            ph -= ph >= 1.0f ? 1.0f : 0.0f;
+
+            float p = ph;
+            float dt = delta;
+
+            if (modulated)
+            {
+                p += phaseOffset[i];
+                p -= std::floor(p);
+                dt = std::abs(delta + phaseOffset[i] - previousOffset);
+                previousOffset = phaseOffset[i];
+            }
+
+            if (shape == Waveform::sine)
+            {
+                // phases only, the sine is taken over the whole block below
+                output[i] = p;
+            }
+            else
+            {
+                dt = juce::jlimit(1.0e-6f, 0.5f, dt);
+
+                if (shape == Waveform::square)
+                {
+                    float q = p + 1.0f - pulseWidth;
+                    q -= q >= 1.0f ? 1.0f : 0.0f;
+                    output[i] = (p <= pulseWidth ? 1.0f : -1.0f) + polyBlep(p, dt) - polyBlep(q, dt);
+                }
+                else
+                {
+                    output[i] = p * 2.0f - 1.0f - polyBlep(p, dt);
+                }
+            }
+        }
+
+        if (shape == Waveform::sine)
+            fastSin2PiBlock(output, output, numSamples);
+
+        phase = ph;
+        lastOffset = previousOffset;
+    }
+
+    Waveform waveform = Waveform::sine;
+    float inverseSampleRate = 1.0f / 44100.0f;
+    float phase = 0.0f;
+    float lastOffset = 0.0f;
+    float pulseWidth = 0.5f;
+};
+
+#endif /* BlockOscillator.h */
@@ -0,0 +1,219 @@
+/*
+  ==============================================================================
+
+    FHNIntegrators.h
+    Created: 9 Sep 2023 2:31:50pm
+    Author:  Jeremy Bai
+
+  ==============================================================================
+*/
+
+#ifndef FHN_Integrators_h
+#define FHN_Integrators_h
+
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#include "SimdFloat.h"
+
+/**
+ Per-lane constants of the FHN system with dt * k already folded in, so the
+ stepping kernels below only have to multiply. Instantiated with float for a
+ single solver and with SimdFloat for a batch of solvers.
+ */
+template <typename T>
+struct FhnCoefficients
+{
+    T a, b, c;
+    T h;    // dt * k
+    T ch;   // c * dt * k
+
+    /// same parameters with the step size multiplied by s
+    FhnCoefficients scaled(float s) const
+    {
+        return { a, b, c, h * T(s), ch * T(s) };
+    }
+};
+
+/// FHN right hand side for one state, scaled by the step size (same maths as FhnSolver::dy)
+template <typename T>
+inline void fhnDerivative(T v, T w, T input, const FhnCoefficients<T>& p, T& dv, T& dw)
+{
+    dv = (v - T(25.0f/12.0f) * v * v * v - T(0.4f) * w + T(0.4f) * input) * p.h;
+    dw = (T(2.5f) * v + p.a - p.b * w) * p.ch;
+}
+
+/**
+ One RK4 step of the FHN system, generic over float and SimdFloat.
+
+ The stage weights match FhnSolver::processSystem exactly, since the 0.01615
+ note frequency to time scale constant in FHNSynthVoice is tuned against them.
+ */
+template <typename T>
+inline void fhnRk4Step(T& v, T& w, T input, const FhnCoefficients<T>& p)
+{
+    const T half(0.5f);
+    T dv1, dw1, dv2, dw2, dv3, dw3, dv4, dw4;
+    fhnDerivative(v, w, input, p, dv1, dw1);
+    fhnDerivative(v + dv1 * half, w + dw1 * half, input, p, dv2, dw2);
+    fhnDerivative(v + dv2 * half, w + dw2 * half, input, p, dv3, dw3);
+    fhnDerivative(v + dv3, w + dw3, input, p, dv4, dw4);
+    v = v + (dv1 + dv2 * half + dv3 * half + dv4) * T(1.0f/6.0f);
+    w = w + (dw1 + dw2 * half + dw3 * half + dw4) * T(1.0f/6.0f);
+}
+
+//==============================================================================
+/**
+ Integration schemes for the FHN core, selected per preset by the "integrator" parameter.
+
+ Each scheme is a policy struct with a templated step() so the same code runs
+ on float and SimdFloat. The RK4 weights above advance the system by roughly
+ h / 2 per sample, and the pitch tuning depends on that, so every other
+ scheme integrates with stepScale = 0.5 to play in tune with it.
+
+ A block is split into sub-steps when h = dt * k gets larger than a scheme's
+ maxStep, which only happens on high notes or large time scales.
+ */
+enum class FhnIntegrator
+{
+    rk4 = 0,
+    heun,
+    semiImplicit,
+    adaptive
+};
+
+/// the original scheme, and the default
+struct FhnRk4Policy
+{
+    static constexpr float stepScale = 1.0f;
+    static constexpr float maxStep = 1.0f;
+
+    template <typename T>
+    static void step(T& v, T& w, T input, const FhnCoefficients<T>& p, T& /*error*/)
+    {
+        fhnRk4Step(v, w, input, p);
+    }
+};
+
+/// explicit trapezoid (RK2), half the derivative evaluations of RK4
+struct FhnHeunPolicy
+{
+    static constexpr float stepScale = 0.5f;
+    static constexpr float maxStep = 0.5f;
+
+    template <typename T>
+    static void step(T& v, T& w, T input, const FhnCoefficients<T>& p, T& /*error*/)
+    {
+        T dv1, dw1, dv2, dw2;
+        fhnDerivative(v, w, input, p, dv1, dw1);
+        fhnDerivative(v + dv1, w + dw1, input, p, dv2, dw2);
+        v = v + (dv1 + dv2) * T(0.5f);
+        w = w + (dw1 + dw2) * T(0.5f);
+    }
+};
+
+/**
+ Semi-implicit Euler: the stiff cubic term of dv and the linear decay of dw
+ are taken at the new time step, everything else at the old one. Each step
+ is one division per variable and stays stable for any step size, but being
+ first order it goes flat above h = 0.25, hence the small maxStep.
+ */
+struct FhnSemiImplicitPolicy
+{
+    static constexpr float stepScale = 0.5f;
+    static constexpr float maxStep = 0.25f;
+
+    template <typename T>
+    static void step(T& v, T& w, T input, const FhnCoefficients<T>& p, T& /*error*/)
+    {
+        const T one(1.0f);
+        v = (v + (v - T(0.4f) * w + T(0.4f) * input) * p.h) / (one + T(25.0f/12.0f) * v * v * p.h);
+        w = (w + (T(2.5f) * v + p.a) * p.ch) / (one + p.b * p.ch);
+    }
+};
+
+/**
+ Bogacki-Shampine 3(2) embedded pair. step() also reports the local error
+ estimate, which FhnSolver uses to pick the number of sub-steps of the next
+ block.
+ */
+struct FhnAdaptivePolicy
+{
+    static constexpr float stepScale = 0.5f;
+    static constexpr float maxStep = 1.0f;
+    static constexpr float tolerance = 1.0e-4f;
+
+    template <typename T>
+    static void step(T& v, T& w, T input, const FhnCoefficients<T>& p, T& error)
+    {
+        T dv1, dw1, dv2, dw2, dv3, dw3, dv4, dw4;
+        fhnDerivative(v, w, input, p, dv1, dw1);
+        fhnDerivative(v + dv1 * T(0.5f), w + dw1 * T(0.5f), input, p, dv2, dw2);
+        fhnDerivative(v + dv2 * T(0.75f), w + dw2 * T(0.75f), input, p, dv3, dw3);
+
+        const T v3 = v + dv1 * T(2.0f/9.0f) + dv2 * T(1.0f/3.0f) + dv3 * T(4.0f/9.0f);
+        const T w3 = w + dw1 * T(2.0f/9.0f) + dw2 * T(1.0f/3.0f) + dw3 * T(4.0f/9.0f);
+        fhnDerivative(v3, w3, input, p, dv4, dw4);
+
+        // difference to the embedded second order solution
+        const T ev = dv1 * T(2.0f/9.0f - 7.0f/24.0f) + dv2 * T(1.0f/3.0f - 1.0f/4.0f)
+                   + dv3 * T(4.0f/9.0f - 1.0f/3.0f) - dv4 * T(1.0f/8.0f);
+        const T ew = dw1 * T(2.0f/9.0f - 7.0f/24.0f) + dw2 * T(1.0f/3.0f - 1.0f/4.0f)
+                   + dw3 * T(4.0f/9.0f - 1.0f/3.0f) - dw4 * T(1.0f/8.0f);
+        error = simdMax(error, simdMax(simdMax(ev, -ev), simdMax(ew, -ew)));
+
+        v = v3;
+        w = w3;
+    }
+};
+
+//==============================================================================
+/// upper limit on the number of sub-steps per sample
+static constexpr int fhnMaxSubsteps = 16;
+
+/// |v| and |w| bound, far outside any real trajectory, so a blow-up stays finite until the end of the block
+static constexpr float fhnStateLimit = 8.0f;
+
+/**
+ Sub-step count for the next block
+
+ @param h dt * k of the solver
+ @param previous sub-step count used for the last block
+ @param lastError largest error estimate of the last block (adaptive policy only)
+ */
+template <typename Policy>
+inline int fhnChooseSubsteps(float h, int previous, float lastError)
+{
+    int substeps = static_cast<int>(std::ceil(h / Policy::maxStep));
+
+    if (std::is_same<Policy, FhnAdaptivePolicy>::value)
+    {
+        if (lastError > FhnAdaptivePolicy::tolerance)
+            substeps = std::max(substeps, previous * 2);
+        else if (lastError < FhnAdaptivePolicy::tolerance * 0.125f)
+            substeps = std::max(substeps, previous / 2);
+        else
+            substeps = std::max(substeps, previous);
+    }
+
+    return std::min(std::max(substeps, 1), fhnMaxSubsteps);
+}
+
+/**
+ Advance one sample with the given policy, split into substeps
+
+ @param p coefficients already scaled by Policy::stepScale / substeps
+ @param error running maximum of the error estimate
+ */
+template <typename Policy, typename T>
+inline void fhnIntegrate(T& v, T& w, T input, const FhnCoefficients<T>& p, int substeps, T& error)
+{
+    for (int s = 0; s < substeps; s++)
+        Policy::step(v, w, input, p, error);
+
+    // branch free bound that lets NaN through, so the caller's once per block check still resets a blown up solver
+    v = simdClamp(v, T(-fhnStateLimit), T(fhnStateLimit));
+    w = simdClamp(w, T(-fhnStateLimit), T(fhnStateLimit));
+}
+
+#endif /* FHNIntegrators.h */
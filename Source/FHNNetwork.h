@@ -0,0 +1,436 @@
+/*
+  ==============================================================================
+
+    FHNNetwork.h
+    Created: 11 Oct 2023 4:02:37pm
+    Author:  Jeremy Bai
+
+  ==============================================================================
+*/
+
+#ifndef FHN_Network_h
+#define FHN_Network_h
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "SimdFloat.h"
+#include "FHNIntegrators.h"
+#include "FHNSolver.h"
+
+/// how the nodes of an FhnNetwork are connected, in the order of the "topology" parameter
+enum class FhnTopology
+{
+    ring,
+    chain,
+    allToAll,
+    custom
+};
+
+/**
+ A network of diffusively coupled FHN nodes, the N node generalisation of the solver pair in FHNSynthVoice
+
+ Node i receives its input plus coupling * sum_j weight_ij * (v_j - v_i),
+ using the states from before the step as the pair does, so a two node chain
+ is the same system as a coupled left/right pair. Ring and chain couple each
+ node to its neighbours, all-to-all couples every pair of nodes with weight
+ 1 / (N - 1), and custom uses the edges given to setCustomEdges().
+
+ The state is kept as structure-of-arrays and every sample steps
+ SimdFloat::width nodes per register with the same kernels as FhnSolverBank.
+ The coupling terms are computed without a matrix: ring and chain from
+ shifted loads of the state, all-to-all from the sum of the states and custom
+ from a compressed sparse row list, so the cost of a sample grows linearly
+ with the number of nodes (and edges).
+
+ Node i sits at position i / (N - 1) between the left and right channels.
+ Its input is interpolated between the left and right inputs, its time
+ scale between the values given to setTemporalScale() (per node detune), and
+ the output mix pans it to the same position.
+
+ All storage is allocated in prepare().
+ */
+class FhnNetwork
+{
+public:
+    static constexpr int maxNodes = 64;
+    static constexpr int maxCustomEdges = 256;
+
+    /// undirected connection for the custom topology
+    struct Edge
+    {
+        int first, second;
+        float weight;
+    };
+
+    /// allocate storage for maxNodes nodes, never call from the audio thread
+    void prepare()
+    {
+        // one register of room on either side for the neighbour loads of the ring and chain kernels
+        for (auto* array : { &v, &w })
+            array->assign(maxNodes + 2 * SimdFloat::width, 0.0f);
+
+        for (auto* array : { &drive, &position, &h, &ch, &scaledH, &scaledCH, &mixLeft, &mixRight })
+            array->assign(maxNodes, 0.0f);
+
+        edges.reserve(maxCustomEdges);
+        rowStart.assign(maxNodes + 1, 0);
+        columns.assign(2 * maxCustomEdges, 0);
+        weights.assign(2 * maxCustomEdges, 0.0f);
+
+        setSize(numNodes);
+    }
+
+    /**
+     Change the number of nodes, resetting every node to rest
+
+     @param newSize clamped to 2..maxNodes
+     */
+    void setSize(int newSize)
+    {
+        numNodes = juce::jlimit(2, maxNodes, newSize);
+        numRegisters = (numNodes + SimdFloat::width - 1) / SimdFloat::width;
+
+        for (int i = 0; i < maxNodes; i++)
+            position[i] = i < numNodes ? static_cast<float>(i) / (numNodes - 1) : 0.0f;
+
+        setTemporalScale(firstScale, lastScale);
+        setSpreadMix();
+        buildRows();
+        reset();
+    }
+
+    int getSize() const
+    {
+        return numNodes;
+    }
+
+    void setTopology(FhnTopology newTopology, float newCoupling)
+    {
+        topology = newTopology;
+        coupling = newCoupling;
+    }
+
+    /// coupling strength alone, for modulation; the topology stays as it is
+    void setCoupling(float newCoupling)
+    {
+        coupling = newCoupling;
+    }
+
+    /// system constants of every node, as FhnSolver::setParameter()
+    void setParameter(float newA, float newB, float newC)
+    {
+        if (newA == a && newB == b && newC == c)
+            return;
+
+        a = newA;
+        b = newB;
+        c = newC;
+        setTemporalScale(firstScale, lastScale);
+    }
+
+    /**
+     Edges of the custom topology; edges to nodes past the current size are ignored
+
+     Copies into the storage reserved in prepare(), at most maxCustomEdges are kept.
+     */
+    void setCustomEdges(const std::vector<Edge>& newEdges)
+    {
+        edges.clear();
+
+        for (const auto& edge : newEdges)
+            if (edges.size() < static_cast<size_t>(maxCustomEdges) && edge.first != edge.second)
+                edges.push_back(edge);
+
+        buildRows();
+    }
+
+    void setIntegrator(FhnIntegrator newIntegrator)
+    {
+        integrator = newIntegrator;
+    }
+
+    void setDt(float newDt)
+    {
+        dt = newDt;
+        setTemporalScale(firstScale, lastScale);
+    }
+
+    /// time scale k of the first and last node, the nodes in between are spread linearly
+    void setTemporalScale(float first, float last)
+    {
+        firstScale = first;
+        lastScale = last;
+
+        for (int i = 0; i < maxNodes; i++)
+        {
+            h[i] = i < numNodes ? dt * (first + (last - first) * position[i]) : 0.0f;
+            ch[i] = c * h[i];
+        }
+    }
+
+    /// pan every node to its position, normalised so each channel sums to one
+    void setSpreadMix()
+    {
+        float leftSum = 0.0f, rightSum = 0.0f;
+
+        for (int i = 0; i < numNodes; i++)
+        {
+            leftSum += 1.0f - position[i];
+            rightSum += position[i];
+        }
+
+        for (int i = 0; i < maxNodes; i++)
+        {
+            mixLeft[i] = i < numNodes ? (1.0f - position[i]) / leftSum : 0.0f;
+            mixRight[i] = i < numNodes ? position[i] / rightSum : 0.0f;
+        }
+    }
+
+    /// every node back to rest
+    void reset()
+    {
+        std::fill(v.begin(), v.end(), 0.0f);
+        std::fill(w.begin(), w.end(), 0.0f);
+        substeps = 1;
+        lastError = 0.0f;
+    }
+
+    /**
+     Step the network over a block and mix the nodes down to stereo
+
+     @param leftInput, rightInput inputs of the first and last node
+     @param leftOutput, rightOutput receive the mixed node outputs
+     */
+    void process(const float* leftInput, const float* rightInput, float* leftOutput, float* rightOutput, int numSamples)
+    {
+        switch (integrator)
+        {
+            case FhnIntegrator::heun:           processWith<FhnHeunPolicy>(leftInput, rightInput, leftOutput, rightOutput, numSamples); break;
+            case FhnIntegrator::semiImplicit:   processWith<FhnSemiImplicitPolicy>(leftInput, rightInput, leftOutput, rightOutput, numSamples); break;
+            case FhnIntegrator::adaptive:       processWith<FhnAdaptivePolicy>(leftInput, rightInput, leftOutput, rightOutput, numSamples); break;
+            default:                            processWith<FhnRk4Policy>(leftInput, rightInput, leftOutput, rightOutput, numSamples); break;
+        }
+    }
+
+private:
+    template <typename Policy>
+    void processWith(const float* leftInput, const float* rightInput, float* leftOutput, float* rightOutput, int numSamples)
+    {
+        if (numSamples <= 0)
+            return;
+
+        substeps = fhnChooseSubsteps<Policy>(*std::max_element(h.begin(), h.end()), substeps, lastError);
+        const float scale = Policy::stepScale / substeps;
+
+        for (int i = 0; i < maxNodes; i++)
+        {
+            scaledH[i] = h[i] * scale;
+            scaledCH[i] = ch[i] * scale;
+        }
+
+        float* const state = v.data() + stateOffset;
+        float* const recovery = w.data() + stateOffset;
+        const SimdFloat aLanes(a), bLanes(b);
+        SimdFloat error(0.0f);
+
+        // uncoupled nodes only see their input
+        const bool coupled = coupling != 0.0f;
+        if (!coupled)
+            std::fill(drive.begin(), drive.end(), 0.0f);
+
+        for (int s = 0; s < numSamples; s++)
+        {
+            if (coupled)
+                computeDrive(state);
+
+            const SimdFloat left(leftInput[s]), spread(rightInput[s] - leftInput[s]);
+            SimdFloat sumLeft(0.0f), sumRight(0.0f);
+
+            for (int n = 0; n < numRegisters * SimdFloat::width; n += SimdFloat::width)
+            {
+                const FhnCoefficients<SimdFloat> p { aLanes, bLanes, 0.0f, SimdFloat::load(&scaledH[n]), SimdFloat::load(&scaledCH[n]) };
+                auto nodeV = SimdFloat::load(state + n);
+                auto nodeW = SimdFloat::load(recovery + n);
+
+                fhnIntegrate<Policy>(nodeV, nodeW, left + SimdFloat::load(&position[n]) * spread + SimdFloat::load(&drive[n]),
+                                     p, substeps, error);
+
+                nodeV.store(state + n);
+                nodeW.store(recovery + n);
+                sumLeft += nodeV * SimdFloat::load(&mixLeft[n]);
+                sumRight += nodeV * SimdFloat::load(&mixRight[n]);
+            }
+
+            leftOutput[s] = horizontalSum(sumLeft);
+            rightOutput[s] = horizontalSum(sumRight);
+        }
+
+        lastError = horizontalMax(error);
+        finishBlock(leftOutput, rightOutput, numSamples);
+    }
+
+    /// drive[i] = coupling * sum_j weight_ij * (v_j - v_i), from the states before this sample's step
+    void computeDrive(const float* state)
+    {
+        const int last = numNodes - 1;
+        const SimdFloat g(coupling);
+
+        switch (topology)
+        {
+            case FhnTopology::ring:
+            case FhnTopology::chain:
+            {
+                // every node as if it had two neighbours, then the ends are fixed up
+                for (int n = 0; n < numRegisters * SimdFloat::width; n += SimdFloat::width)
+                {
+                    const auto centre = SimdFloat::load(state + n);
+                    (g * (SimdFloat::load(state + n - 1) + SimdFloat::load(state + n + 1) - SimdFloat(2.0f) * centre)).store(&drive[n]);
+                }
+
+                // a ring of two would count the same neighbour twice
+                if (topology == FhnTopology::ring && numNodes > 2)
+                {
+                    drive[0] = coupling * (state[last] + state[1] - 2.0f * state[0]);
+                    drive[last] = coupling * (state[last - 1] + state[0] - 2.0f * state[last]);
+                }
+                else
+                {
+                    drive[0] = coupling * (state[1] - state[0]);
+                    drive[last] = coupling * (state[last - 1] - state[last]);
+                }
+                break;
+            }
+
+            case FhnTopology::allToAll:
+            {
+                // sum_j (v_j - v_i) = total - N * v_i, the unused lanes are at rest so they add nothing
+                SimdFloat sum(0.0f);
+                for (int n = 0; n < numRegisters * SimdFloat::width; n += SimdFloat::width)
+                    sum += SimdFloat::load(state + n);
+
+                const SimdFloat total(horizontalSum(sum)), size(static_cast<float>(numNodes));
+                const SimdFloat scaled(coupling / last);
+
+                for (int n = 0; n < numRegisters * SimdFloat::width; n += SimdFloat::width)
+                    (scaled * (total - size * SimdFloat::load(state + n))).store(&drive[n]);
+                break;
+            }
+
+            case FhnTopology::custom:
+            {
+                for (int i = 0; i < numNodes; i++)
+                {
+                    float sum = 0.0f;
+                    for (int e = rowStart[i]; e < rowStart[i + 1]; e++)
+                        sum += weights[e] * (state[columns[e]] - state[i]);
+                    drive[i] = coupling * sum;
+                }
+                break;
+            }
+        }
+    }
+
+    /// compressed sparse rows of the custom edges that fit the current size, both directions of each edge
+    void buildRows()
+    {
+        if (rowStart.empty())
+            return;
+
+        std::fill(rowStart.begin(), rowStart.end(), 0);
+
+        for (const auto& edge : edges)
+        {
+            if (fits(edge))
+            {
+                rowStart[edge.first + 1]++;
+                rowStart[edge.second + 1]++;
+            }
+        }
+
+        for (int i = 0; i < maxNodes; i++)
+            rowStart[i + 1] += rowStart[i];
+
+        // second pass: each edge goes into the rows of both its nodes
+        int cursor[maxNodes];
+        std::copy(rowStart.begin(), rowStart.begin() + maxNodes, cursor);
+
+        for (const auto& edge : edges)
+        {
+            if (fits(edge))
+            {
+                columns[cursor[edge.first]] = edge.second;
+                weights[cursor[edge.first]++] = edge.weight;
+                columns[cursor[edge.second]] = edge.first;
+                weights[cursor[edge.second]++] = edge.weight;
+            }
+        }
+    }
+
+    bool fits(const Edge& edge) const
+    {
+        return edge.first >= 0 && edge.second >= 0 && edge.first < numNodes && edge.second < numNodes;
+    }
+
+    /// same as FhnSolver::finishBlock(), for the whole network
+    void finishBlock(float* leftOutput, float* rightOutput, int numSamples)
+    {
+        for (int i = 0; i < numNodes; i++)
+        {
+            if (!std::isfinite(v[stateOffset + i]) || !std::isfinite(w[stateOffset + i]))
+            {
+                reset();
+                std::fill(leftOutput, leftOutput + numSamples, 0.0f);
+                std::fill(rightOutput, rightOutput + numSamples, 0.0f);
+                return;
+            }
+        }
+    }
+
+    static float horizontalSum(SimdFloat x)
+    {
+        float lanes[SimdFloat::width];
+        x.store(lanes);
+
+        float sum = 0.0f;
+        for (float lane : lanes)
+            sum += lane;
+        return sum;
+    }
+
+    static float horizontalMax(SimdFloat x)
+    {
+        float lanes[SimdFloat::width];
+        x.store(lanes);
+        return *std::max_element(lanes, lanes + SimdFloat::width);
+    }
+
+    static constexpr int stateOffset = SimdFloat::width;
+
+    int numNodes = 2, numRegisters = 1;
+    FhnTopology topology = FhnTopology::ring;
+    float coupling = 0.0f;
+    FhnIntegrator integrator = FhnIntegrator::rk4;
+
+    // same system constants as FhnSolver
+    float a = FhnSolver::defaultA, b = FhnSolver::defaultB, c = FhnSolver::defaultC;
+    float dt = 1.0f / 44100.0f;
+    float firstScale = 1.0f, lastScale = 1.0f;
+
+    int substeps = 1;
+    float lastError = 0.0f;
+
+    // node i at [stateOffset + i], the unused nodes of the last register stay at rest
+    std::vector<float> v, w;
+
+    // one entry per node, zero past numNodes
+    std::vector<float> drive, position, h, ch, scaledH, scaledCH, mixLeft, mixRight;
+
+    // custom topology
+    std::vector<Edge> edges;
+    std::vector<int> rowStart, columns;
+    std::vector<float> weights;
+};
+
+#endif /* FHNNetwork.h */
@@ -11,9 +11,14 @@
 #ifndef FHN_Solver_h
 #define FHN_Solver_h
 
+#include "FHNIntegrators.h"
+#include "FastMath.h"
+
 class FhnSolver
 {
 public:
+    /// system constants every solver starts with, see setParameter()
+    static constexpr float defaultA = 0.7f, defaultB = 0.8f, defaultC = 0.1f;
     
     FhnSolver(float sampleRate) : dt(1.0f/sampleRate) {}
     ~FhnSolver() {}
@@ -79,7 +84,7 @@ public:
     Delta dy(State state)
     {
         Delta newDelta;
-        newDelta.dv = (state.v - 25.0f/12.0f * std::pow(state.v, 3) - 0.4f * state.w + 0.4f * currentInput) * dt * k;
+        newDelta.dv = (state.v - 25.0f/12.0f * fastCube(state.v) - 0.4f * state.w + 0.4f * currentInput) * dt * k;
         newDelta.dw = (2.5f * state.v + a - b * state.w) * c * dt * k;
         return newDelta;
     }
@@ -95,17 +100,178 @@ public:
         return getCurrentState();
     }
     
+    /**
+     Run the solver over a block of input samples with the selected integrator
+     
+     State and RK stages are kept in locals for the whole block and only
+     written back to the member state once at the end.
+     
+     @param input n input samples
+     @param outV receives n samples of v
+     @param n number of samples
+     */
+    void processBlock(const float* input, float* outV, int n)
+    {
+        switch (integrator)
+        {
+            case FhnIntegrator::heun:           processBlockWith<FhnHeunPolicy>(input, outV, n); break;
+            case FhnIntegrator::semiImplicit:   processBlockWith<FhnSemiImplicitPolicy>(input, outV, n); break;
+            case FhnIntegrator::adaptive:       processBlockWith<FhnAdaptivePolicy>(input, outV, n); break;
+            default:                            processBlockWith<FhnRk4Policy>(input, outV, n); break;
+        }
+    }
+    
+    template <typename Policy>
+    void processBlockWith(const float* input, float* outV, int n)
+    {
+        if (n <= 0)
+            return;
+        
+        const int steps = prepareSubsteps<Policy>();
+        const auto p = getCoefficients().scaled(Policy::stepScale / steps);
+        float v = currentState.v;
+        float w = currentState.w;
+        float error = 0.0f;
+        
+        for (int i = 0; i < n; i++)
+        {
+            fhnIntegrate<Policy>(v, w, input[i], p, steps, error);
+            outV[i] = v;
+        }
+        
+        currentState.v = v;
+        currentState.w = w;
+        currentInput = input[n - 1];
+        finishBlock(error, outV, n);
+    }
+    
+    /**
+     Run a diffusively coupled pair of solvers over a block
+     
+     Per sample, left receives leftInput - coupling * (vLeft - vRight) and right
+     receives rightInput + coupling * (vLeft - vRight), using the states from
+     before the step, as in FHNSynthVoice. Both solvers use the left one's integrator.
+     */
+    static void processCoupledBlock(FhnSolver& left, FhnSolver& right, float coupling,
+                                    const float* leftInput, const float* rightInput,
+                                    float* leftOutV, float* rightOutV, int n)
+    {
+        switch (left.integrator)
+        {
+            case FhnIntegrator::heun:
+                processCoupledBlockWith<FhnHeunPolicy>(left, right, coupling, leftInput, rightInput, leftOutV, rightOutV, n);
+                break;
+            case FhnIntegrator::semiImplicit:
+                processCoupledBlockWith<FhnSemiImplicitPolicy>(left, right, coupling, leftInput, rightInput, leftOutV, rightOutV, n);
+                break;
+            case FhnIntegrator::adaptive:
+                processCoupledBlockWith<FhnAdaptivePolicy>(left, right, coupling, leftInput, rightInput, leftOutV, rightOutV, n);
+                break;
+            default:
+                processCoupledBlockWith<FhnRk4Policy>(left, right, coupling, leftInput, rightInput, leftOutV, rightOutV, n);
+                break;
+        }
+    }
+    
+    template <typename Policy>
+    static void processCoupledBlockWith(FhnSolver& left, FhnSolver& right, float coupling,
+                                        const float* leftInput, const float* rightInput,
+                                        float* leftOutV, float* rightOutV, int n)
+    {
+        if (n <= 0)
+            return;
+        
+        const int steps = std::max(left.prepareSubsteps<Policy>(), right.prepareSubsteps<Policy>());
+        const auto pl = left.getCoefficients().scaled(Policy::stepScale / steps);
+        const auto pr = right.getCoefficients().scaled(Policy::stepScale / steps);
+        float lv = left.currentState.v, lw = left.currentState.w;
+        float rv = right.currentState.v, rw = right.currentState.w;
+        float leftError = 0.0f, rightError = 0.0f;
+        
+        for (int i = 0; i < n; i++)
+        {
+            const float diff = coupling * (lv - rv);
+            fhnIntegrate<Policy>(lv, lw, leftInput[i] - diff, pl, steps, leftError);
+            fhnIntegrate<Policy>(rv, rw, rightInput[i] + diff, pr, steps, rightError);
+            leftOutV[i] = lv;
+            rightOutV[i] = rv;
+        }
+        
+        left.setCurrentState(lv, lw);
+        right.setCurrentState(rv, rw);
+        left.currentInput = leftInput[n - 1];
+        right.currentInput = rightInput[n - 1];
+        left.finishBlock(leftError, leftOutV, n);
+        right.finishBlock(rightError, rightOutV, n);
+    }
+    
+    void setIntegrator(FhnIntegrator newIntegrator)
+    {
+        integrator = newIntegrator;
+    }
+    
+    FhnIntegrator getIntegrator() const
+    {
+        return integrator;
+    }
+    
+    /**
+     Work out how many sub-steps per sample the next block needs with the given policy
+     
+     Called by the block functions and by FhnSolverBank before a block.
+     */
+    template <typename Policy>
+    int prepareSubsteps()
+    {
+        substeps = fhnChooseSubsteps<Policy>(dt * k, substeps, lastError);
+        return substeps;
+    }
+    
+    /**
+     End of block bookkeeping: keep the error estimate for the sub-step controller
+     and reset the solver if the state went non-finite, silencing that block.
+     
+     @return true if the state had to be reset
+     */
+    bool finishBlock(float blockError, float* outV, int n)
+    {
+        lastError = blockError;
+        
+        if (std::isfinite(currentState.v) && std::isfinite(currentState.w))
+            return false;
+        
+        setCurrentState(0.0f, 0.0f);
+        lastError = 0.0f;
+        std::fill(outV, outV + n, 0.0f);
+        return true;
+    }
+    
     float getCurrentState()
     {
         return currentState.v;
     }
+    
+    const State& getState() const
+    {
+        return currentState;
+    }
+    
+    /// current parameters with dt * k folded in, used by FhnSolverBank to gather lanes
+    FhnCoefficients<float> getCoefficients() const
+    {
+        return { a, b, c, dt * k, c * dt * k };
+    }
 
 private:
     State currentState;
     Delta k1, k2, k3, k4;
     float currentInput = 0.0f;
     float dt;
-    float a = 0.7f, b = 0.8f, c = 0.1f, k = 1.0f;
+    float a = defaultA, b = defaultB, c = defaultC, k = 1.0f;
+    
+    FhnIntegrator integrator = FhnIntegrator::rk4;
+    int substeps = 1;
+    float lastError = 0.0f;
     
 };
 
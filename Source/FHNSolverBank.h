@@ -0,0 +1,265 @@
+/*
+  ==============================================================================
+
+    FHNSolverBank.h
+    Created: 2 Sep 2023 4:40:21pm
+    Author:  Jeremy Bai
+
+  ==============================================================================
+*/
+
+#ifndef FHN_Solver_Bank_h
+#define FHN_Solver_Bank_h
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <vector>
+#include "SimdFloat.h"
+#include "FHNSolver.h"
+
+/**
+ Steps the coupled left/right FhnSolver pairs of every active voice together.
+
+ Voices register their pair once per block with addPair(), then process()
+ gathers the solver states and coefficients into structure-of-arrays lanes
+ (one lane per pair, left and right sides in separate arrays), runs the
+ selected integrator on SimdFloat::width pairs at a time with the state kept
+ in registers for the whole block, and scatters the new states back into the
+ solvers. Pairs are ordered by sub-step count first, and a register of pairs
+ uses the largest count of its lanes.
+
+ All storage is sized in prepare(), so addPair()/process() never allocate.
+ */
+class FhnSolverBank
+{
+public:
+
+    /**
+     Allocate lane storage
+
+     @param maxPairs maximum number of solver pairs per block
+     @param maxBlockSize maximum number of samples per process() call
+     */
+    void prepare(int maxPairs, int maxBlockSize)
+    {
+        capacity = (maxPairs + SimdFloat::width - 1) / SimdFloat::width * SimdFloat::width;
+        blockSize = maxBlockSize;
+
+        for (auto* lane : { &leftV, &leftW, &rightV, &rightW, &coupling,
+                            &leftA, &leftB, &leftH, &leftCH, &rightA, &rightB, &rightH, &rightCH,
+                            &leftError, &rightError })
+            lane->assign(capacity, 0.0f);
+        
+        substeps.assign(capacity, 1);
+
+        leftIn.assign(capacity * blockSize, 0.0f);
+        rightIn.assign(capacity * blockSize, 0.0f);
+        leftOut.assign(capacity * blockSize, 0.0f);
+        rightOut.assign(capacity * blockSize, 0.0f);
+
+        pairs.resize(maxPairs);
+        numPairs = 0;
+    }
+
+    /// forget the pairs registered for the previous block
+    void clear()
+    {
+        numPairs = 0;
+    }
+
+    /**
+     Register a coupled pair for the next process() call
+
+     @return false if the bank is full, in which case the caller must step the pair itself
+     */
+    bool addPair(FhnSolver& left, FhnSolver& right, float pairCoupling,
+                 const float* leftInput, const float* rightInput, float* leftOutput, float* rightOutput)
+    {
+        if (numPairs >= static_cast<int>(pairs.size()))
+            return false;
+
+        pairs[numPairs++] = { &left, &right, pairCoupling, leftInput, rightInput, leftOutput, rightOutput, 1 };
+        return true;
+    }
+
+    int getNumPairs() const
+    {
+        return numPairs;
+    }
+    
+    /// integration scheme used for every pair, set from the preset
+    void setIntegrator(FhnIntegrator newIntegrator)
+    {
+        integrator = newIntegrator;
+    }
+
+    /**
+     Step every registered pair by numSamples samples
+
+     @param numSamples must not exceed the block size passed to prepare()
+     */
+    void process(int numSamples)
+    {
+        if (numPairs == 0)
+            return;
+
+        jassert(numSamples <= blockSize);
+
+        switch (integrator)
+        {
+            case FhnIntegrator::heun:           processWith<FhnHeunPolicy>(numSamples); break;
+            case FhnIntegrator::semiImplicit:   processWith<FhnSemiImplicitPolicy>(numSamples); break;
+            case FhnIntegrator::adaptive:       processWith<FhnAdaptivePolicy>(numSamples); break;
+            default:                            processWith<FhnRk4Policy>(numSamples); break;
+        }
+    }
+
+private:
+    struct Pair
+    {
+        FhnSolver* left;
+        FhnSolver* right;
+        float coupling;
+        const float* leftInput;
+        const float* rightInput;
+        float* leftOutput;
+        float* rightOutput;
+        int substeps;
+    };
+
+    template <typename Policy>
+    void processWith(int numSamples)
+    {
+        gather<Policy>(numSamples);
+
+        const int usedLanes = (numPairs + SimdFloat::width - 1) / SimdFloat::width * SimdFloat::width;
+
+        for (int lane = 0; lane < usedLanes; lane += SimdFloat::width)
+            processLanes<Policy>(lane, numSamples);
+
+        scatter(numSamples);
+    }
+
+    template <typename Policy>
+    void gather(int numSamples)
+    {
+        for (int p = 0; p < numPairs; p++)
+            pairs[p].substeps = std::max(pairs[p].left->template prepareSubsteps<Policy>(),
+                                         pairs[p].right->template prepareSubsteps<Policy>());
+
+        // insertion sort by sub-step count so pairs sharing a register need the same work
+        for (int p = 1; p < numPairs; p++)
+            for (int q = p; q > 0 && pairs[q - 1].substeps > pairs[q].substeps; q--)
+                std::swap(pairs[q - 1], pairs[q]);
+
+        for (int p = 0; p < numPairs; p++)
+        {
+            const auto& pair = pairs[p];
+
+            substeps[p] = pair.substeps;
+
+            leftV[p] = pair.left->getState().v;
+            leftW[p] = pair.left->getState().w;
+            rightV[p] = pair.right->getState().v;
+            rightW[p] = pair.right->getState().w;
+            coupling[p] = pair.coupling;
+
+            auto l = pair.left->getCoefficients();
+            auto r = pair.right->getCoefficients();
+            leftA[p] = l.a;  leftB[p] = l.b;  leftH[p] = l.h;  leftCH[p] = l.ch;
+            rightA[p] = r.a; rightB[p] = r.b; rightH[p] = r.h; rightCH[p] = r.ch;
+
+            for (int i = 0; i < numSamples; i++)
+            {
+                leftIn[i * capacity + p] = pair.leftInput[i];
+                rightIn[i * capacity + p] = pair.rightInput[i];
+            }
+        }
+
+        // unused lanes of the last register get a zero step so they stay at rest
+        for (int p = numPairs; p < capacity; p++)
+        {
+            leftV[p] = leftW[p] = rightV[p] = rightW[p] = coupling[p] = 0.0f;
+            leftH[p] = leftCH[p] = rightH[p] = rightCH[p] = 0.0f;
+            substeps[p] = 1;
+
+            for (int i = 0; i < numSamples; i++)
+                leftIn[i * capacity + p] = rightIn[i * capacity + p] = 0.0f;
+        }
+    }
+
+    template <typename Policy>
+    void processLanes(int lane, int numSamples)
+    {
+        const int steps = *std::max_element(&substeps[lane], &substeps[lane] + SimdFloat::width);
+        const float scale = Policy::stepScale / steps;
+
+        FhnCoefficients<SimdFloat> l { SimdFloat::load(&leftA[lane]), SimdFloat::load(&leftB[lane]), 0.0f,
+                                       SimdFloat::load(&leftH[lane]) * scale, SimdFloat::load(&leftCH[lane]) * scale };
+        FhnCoefficients<SimdFloat> r { SimdFloat::load(&rightA[lane]), SimdFloat::load(&rightB[lane]), 0.0f,
+                                       SimdFloat::load(&rightH[lane]) * scale, SimdFloat::load(&rightCH[lane]) * scale };
+        SimdFloat le(0.0f), re(0.0f);
+
+        auto lv = SimdFloat::load(&leftV[lane]);
+        auto lw = SimdFloat::load(&leftW[lane]);
+        auto rv = SimdFloat::load(&rightV[lane]);
+        auto rw = SimdFloat::load(&rightW[lane]);
+        const auto g = SimdFloat::load(&coupling[lane]);
+
+        for (int i = 0; i < numSamples; i++)
+        {
+            const int offset = i * capacity + lane;
+            auto diff = g * (lv - rv);
+
+            fhnIntegrate<Policy>(lv, lw, SimdFloat::load(&leftIn[offset]) - diff, l, steps, le);
+            fhnIntegrate<Policy>(rv, rw, SimdFloat::load(&rightIn[offset]) + diff, r, steps, re);
+
+            lv.store(&leftOut[offset]);
+            rv.store(&rightOut[offset]);
+        }
+
+        lv.store(&leftV[lane]);
+        lw.store(&leftW[lane]);
+        rv.store(&rightV[lane]);
+        rw.store(&rightW[lane]);
+        le.store(&leftError[lane]);
+        re.store(&rightError[lane]);
+    }
+
+    void scatter(int numSamples)
+    {
+        for (int p = 0; p < numPairs; p++)
+        {
+            const auto& pair = pairs[p];
+
+            pair.left->setCurrentState(leftV[p], leftW[p]);
+            pair.right->setCurrentState(rightV[p], rightW[p]);
+
+            for (int i = 0; i < numSamples; i++)
+            {
+                pair.leftOutput[i] = leftOut[i * capacity + p];
+                pair.rightOutput[i] = rightOut[i * capacity + p];
+            }
+
+            pair.left->finishBlock(leftError[p], pair.leftOutput, numSamples);
+            pair.right->finishBlock(rightError[p], pair.rightOutput, numSamples);
+        }
+    }
+
+    std::vector<Pair> pairs;
+    int numPairs = 0;
+    int capacity = 0;
+    int blockSize = 0;
+    FhnIntegrator integrator = FhnIntegrator::rk4;
+
+    // one entry per lane
+    std::vector<float> leftV, leftW, rightV, rightW, coupling;
+    std::vector<float> leftA, leftB, leftH, leftCH, rightA, rightB, rightH, rightCH;
+    std::vector<float> leftError, rightError;
+    std::vector<int> substeps;
+
+    // [sample * capacity + lane]
+    std::vector<float> leftIn, rightIn, leftOut, rightOut;
+};
+
+#endif /* FHNSolverBank.h */
@@ -0,0 +1,130 @@
+/*
+  ==============================================================================
+
+    FastMath.h
+    Created: 8 Oct 2023 11:05:40am
+    Author:  Jeremy Bai
+
+  ==============================================================================
+*/
+
+#ifndef Fast_Math_h
+#define Fast_Math_h
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include "SimdFloat.h"
+
+/**
+ Polynomial replacements for the library maths in the synth's inner loops
+
+ Like the kernels in FHNIntegrators.h, each function is a template that runs
+ on float and on SimdFloat, so a loop can be written once and vectorised.
+ Every approximation states its maximum error over the range the synth uses,
+ and FHNRender --check-math measures those bounds against the double
+ precision standard library (--bench-math compares the speed).
+ */
+
+/// x * x * x, in place of std::pow(x, 3); within 2 ulp of the exact cube
+template <typename T>
+inline T fastCube(T x)
+{
+    return x * x * x;
+}
+
+//==============================================================================
+/// bound on |fastExp2(x) / 2^x - 1| for x in [-126, 126]
+static constexpr float fastExp2MaxRelativeError = 2.5e-7f;
+
+/**
+ 2^x, for pitch and ratio computations
+
+ x is split into round(x) and a fraction in [-0.5, 0.5]. The fraction goes
+ through a degree 5 polynomial fitted for relative error (7.5e-8 before
+ rounding) and the integer part is written straight into the exponent.
+ Inputs are clamped to [-126, 126], so the result is always a normal float.
+ */
+template <typename T>
+inline T fastExp2(T x)
+{
+    x = simdMax(simdMin(x, T(126.0f)), T(-126.0f));
+
+    const T n = simdFloor(x + T(0.5f));
+    const T f = x - n;
+    const T p = T(1.000000071655301f) + f * (T(0.6931469670628834f) + f * (T(0.24022119720751073f)
+              + f * (T(0.05550713275066408f) + f * (T(0.009675541502652835f) + f * T(0.0013276471959394272f)))));
+
+    return p * simdExp2Integer(n);
+}
+
+//==============================================================================
+/// bound on |fastLog2(x) - log2(x)| for x in [1/256, 256], beyond that it is about one ulp of the result
+static constexpr float fastLog2MaxError = 5.0e-7f;
+
+/**
+ log2(x) for positive normal x, scalar only
+
+ The exponent is read from the bits and the mantissa, folded into
+ [sqrt(1/2), sqrt(2)), goes through the atanh series of the logarithm up to
+ the seventh power. Used at control rate, where only the scalar form is needed.
+ */
+inline float fastLog2(float x)
+{
+    std::uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+
+    int exponent = static_cast<int>((bits >> 23) & 0xff) - 127;
+    bits = (bits & 0x007fffff) | 0x3f800000;
+
+    float m;
+    std::memcpy(&m, &bits, sizeof(m));
+
+    if (m > 1.41421356f)
+    {
+        m *= 0.5f;
+        exponent++;
+    }
+
+    // log2(m) = 2 / ln(2) * atanh(t), with t = (m - 1) / (m + 1) in [-0.172, 0.172]
+    const float t = (m - 1.0f) / (m + 1.0f);
+    const float t2 = t * t;
+    return static_cast<float>(exponent) + t * (2.8853900817779268f + t2 * (0.9617966939259756f
+                                        + t2 * (0.5770780163555854f + t2 * 0.4121985831111324f)));
+}
+
+//==============================================================================
+/// bound on |fastSin2Pi(p) - sin(2 pi p)| for |p| <= 4096, the error grows with |p| beyond that
+static constexpr float fastSin2PiMaxError = 3.0e-7f;
+
+/**
+ sin(2 pi p), with p in periods, so oscillator phases need no scaling
+
+ p is reduced to [-0.5, 0.5) and folded into the quarter period [-0.25, 0.25]
+ with min and max, so there are no branches, then an odd degree 9 polynomial
+ fitted for absolute error (3.4e-9 before rounding) gives the result.
+ */
+template <typename T>
+inline T fastSin2Pi(T p)
+{
+    const T x = p - simdFloor(p + T(0.5f));
+    const T t = simdMax(simdMin(x, T(0.5f) - x), T(-0.5f) - x);
+    const T t2 = t * t;
+
+    return t * (T(6.283185160088879f) + t2 * (T(-41.34165503126417f) + t2 * (T(81.60100406305283f)
+              + t2 * (T(-76.54978204493831f) + t2 * T(39.53670407803461f)))));
+}
+
+/// output[i] = fastSin2Pi(phase[i]), SimdFloat::width samples at a time; output may be phase
+inline void fastSin2PiBlock(const float* phase, float* output, int numSamples)
+{
+    int i = 0;
+
+    for (; i + SimdFloat::width <= numSamples; i += SimdFloat::width)
+        fastSin2Pi(SimdFloat::load(phase + i)).store(output + i);
+
+    for (; i < numSamples; i++)
+        output[i] = fastSin2Pi(phase[i]);
+}
+
+#endif /* FastMath.h */
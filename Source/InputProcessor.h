@@ -12,85 +12,136 @@
 #define Input_Processor_h
 
 #include <JuceHeader.h>
-#include "Oscillator.h"
+#include "BlockOscillator.h"
+#include "NoiseGenerator.h"
+#include "FastMath.h"
 
+/**
+ Builds the drive signal of one FHN solver: a phase modulated oscillator,
+ noise and a constant offset, rendered a block at a time
+ */
 class InputProcessor
 {
     
 public:
     InputProcessor(float _sampleRate)
-        : mainOsc(std::make_unique<SinOsc>()), 
-        modOsc(std::make_unique<SinOsc>())
     {
-        sampleRate = _sampleRate;
-        mainOsc->setSampleRate(sampleRate);
-        modOsc->setSampleRate(sampleRate);
+        setSampleRate(_sampleRate);
+        mainOsc.setWaveform(BlockOscillator::Waveform::sine);
+        modOsc.setWaveform(BlockOscillator::Waveform::sine);
     }
     
-    void resetMainType(float mainType)
+    void setSampleRate(float newSampleRate)
     {
-        if (!mainType)
-            mainOsc = std::make_unique<SinOsc>();
-        else if (mainType == 1)
-            mainOsc = std::make_unique<SquareOsc>();
-        else if (mainType == 2)
-            mainOsc = std::make_unique<SawToothOsc>();
-        mainOsc->setSampleRate(sampleRate);
+        sampleRate = newSampleRate;
+        mainOsc.setSampleRate(sampleRate);
+        modOsc.setSampleRate(sampleRate);
+        noise.setSampleRate(sampleRate);
     }
     
-    void resetModType(float modType)
+    /// restart the noise sequence, see BlockNoise::setSeed()
+    void setNoiseSeed(std::uint64_t seed)
     {
-        if (!modType)
-            modOsc = std::make_unique<SinOsc>();
-        else
-            modOsc = std::make_unique<SquareOsc>();
-        modOsc->setSampleRate(sampleRate);
+        noise.setSeed(seed);
+    }
+    
+    void setNoiseColour(NoiseColour colour)
+    {
+        noise.setColour(colour);
+    }
+    
+    /// 0 sine, 1 square, 2 sawtooth
+    void resetMainType(int mainType)
+    {
+        mainOsc.setWaveform(static_cast<BlockOscillator::Waveform>(juce::jlimit(0, 2, mainType)));
+    }
+    
+    /// 0 sine, 1 square
+    void resetModType(int modType)
+    {
+        modOsc.setWaveform(modType ? BlockOscillator::Waveform::square : BlockOscillator::Waveform::sine);
     }
     
     void updateParam(float newMainAmp, float newModFreq, float newModAmp, float newNoiseAmp, float pw)
     {
         modFreq = newModFreq;
+        modRatio = fastExp2(modFreq) - 1.0f;
         mainAmp = newMainAmp;
         modAmp = newModAmp;
         noiseAmp = newNoiseAmp;
         updatePulseWidth(pw);
     }
     
+    /// oscillator and noise amplitudes alone, for modulation at block rate
+    void setLevels(float newMainAmp, float newNoiseAmp)
+    {
+        mainAmp = newMainAmp;
+        noiseAmp = newNoiseAmp;
+    }
+    
     void updatePulseWidth(float pw)
     {
-        if (SquareOsc* mainSquare = dynamic_cast<SquareOsc*>(mainOsc.get()))
-            mainSquare->setPulseWidth(pw);
-        if (SquareOsc* modSquare = dynamic_cast<SquareOsc*>(modOsc.get()))
-            modSquare->setPulseWidth(pw);
+        mainOsc.setPulseWidth(pw);
+        modOsc.setPulseWidth(pw);
     }
     
     void resetPhase()
     {
-        mainOsc->resetPhase();
-        modOsc->resetPhase();
+        mainOsc.resetPhase();
+        modOsc.resetPhase();
     }
     
-    float processInput(float directInput, float frequency)
+    /**
+     Render the solver input for a block
+     
+     @param directInput constant offset added to the input
+     @param frequency per sample main oscillator frequency in Hz
+     @param frequencyOffset added to every frequency, e.g. the detune of the right channel
+     @param output destination for numSamples samples
+     */
+    void processBlock(float directInput, const float* frequency, float frequencyOffset, float* output, int numSamples)
     {
-        modOsc->setFrequency(frequency * (std::pow(2, modFreq) - 1));
-        mainOsc->setFrequency(frequency);
+        float shifted[chunkSize], phaseOffset[chunkSize], noiseInput[chunkSize];
         
-        auto phaseOffset = modOsc->processOscillator() * modAmp;
-        mainOsc->setPhaseOffset(phaseOffset);
-        
-        auto oscInput = mainOsc->processOscillator() * mainAmp;
-        auto noiseInput = (noise.nextFloat() - 0.5f) * noiseAmp * 2;
-        return directInput + oscInput + noiseInput;
+        for (int start = 0; start < numSamples; start += chunkSize)
+        {
+            const int n = juce::jmin(chunkSize, numSamples - start);
+            float* out = output + start;
+            
+            for (int i = 0; i < n; i++)
+                shifted[i] = frequency[start + i] + frequencyOffset;
+            
+            modOsc.render(shifted, modRatio, nullptr, phaseOffset, n);
+            for (int i = 0; i < n; i++)
+                phaseOffset[i] *= modAmp;
+            
+            mainOsc.render(shifted, 1.0f, phaseOffset, out, n);
+            
+            // the noise sequence only advances while noise is heard
+            if (noiseAmp != 0.0f)
+            {
+                noise.fill(noiseInput, n);
+                for (int i = 0; i < n; i++)
+                    out[i] = directInput + out[i] * mainAmp + noiseInput[i] * noiseAmp;
+            }
+            else
+            {
+                for (int i = 0; i < n; i++)
+                    out[i] = directInput + out[i] * mainAmp;
+            }
+        }
     }
     
     
 private:
-    juce::Random noise;
-    std::unique_ptr<Phasor> mainOsc; // std::unique_ptr
-    std::unique_ptr<Phasor> modOsc;
+    static constexpr int chunkSize = 64;
+    
+    BlockNoise noise;
+    BlockOscillator mainOsc, modOsc;
     
     float sampleRate;
-    float mainAmp, modFreq, modAmp, noiseAmp;
+    float mainAmp = 1.0f, modFreq = 0.0f, modAmp = 0.0f, noiseAmp = 0.0f;
+    float modRatio = 0.0f;      // modulator to main frequency ratio, derived from modFreq
     
 };
 
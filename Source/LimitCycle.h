@@ -0,0 +1,323 @@
+/*
+  ==============================================================================
+
+    LimitCycle.h
+    Created: 6 Oct 2023 3:14:22pm
+    Author:  Jeremy Bai
+
+  ==============================================================================
+*/
+
+#ifndef Limit_Cycle_h
+#define Limit_Cycle_h
+
+#include <JuceHeader.h>
+#include <cmath>
+#include <vector>
+#include "FHNSolver.h"
+
+/**
+ One period of a converged FHN limit cycle, captured from a live solver and played back from a table
+
+ With a constant input the FHN system settles on a periodic orbit, so once
+ the solver output repeats there is no need to keep integrating it. capture()
+ watches the solver output for upward crossings of the mid level, located on the
+ same cubic that play() interpolates with, and compares the length of
+ consecutive periods. When they agree, the last period is kept as a table
+ with a fractional length, and play() reads it with cubic interpolation.
+ Since the read position moves one sample at a time, the interpolation
+ weights only change when the position wraps.
+
+ Everything works at the solver rate, so with oversampling the table goes
+ through the same decimator as the live output and stays band-limited.
+
+ A capture is only valid for the solver settings it was taken with, see Key.
+ */
+class LimitCycle
+{
+public:
+    /// everything the shape and length of the cycle depend on
+    struct Key
+    {
+        float a = 0, b = 0, c = 0;
+        float h = 0;                // dt * k of the solver, includes time scale, note and sample rate
+        float input = 0;
+        FhnIntegrator integrator = FhnIntegrator::rk4;
+
+        static Key of(const FhnSolver& solver, float input)
+        {
+            const auto p = solver.getCoefficients();
+            return { p.a, p.b, p.c, p.h, input, solver.getIntegrator() };
+        }
+
+        bool operator==(const Key& other) const
+        {
+            return a == other.a && b == other.b && c == other.c && h == other.h
+                && input == other.input && integrator == other.integrator;
+        }
+
+        bool operator!=(const Key& other) const
+        {
+            return !(*this == other);
+        }
+    };
+
+    /// longest period that can be captured, in solver samples
+    static constexpr int maxPeriod = 4096;
+
+    /// allocate the table, call from prepare(), never from the audio thread
+    void prepare()
+    {
+        table.assign(maxPeriod + keptSamples + guardSamples + 1, 0.0f);
+        reset(key);
+    }
+
+    /// drop the capture and start looking for a cycle with the given settings
+    void reset(const Key& newKey)
+    {
+        key = newKey;
+        ready = false;
+        length = 0;
+        crossings = 0;
+        matches = 0;
+        guardLeft = 0;
+        threshold = 0.0f;
+        resetExtremes();
+    }
+
+    const Key& getKey() const
+    {
+        return key;
+    }
+
+    /// true once a period has been captured, from then on play() may replace the solver
+    bool isReady() const
+    {
+        return ready;
+    }
+
+    /**
+     Feed live solver output
+
+     Before the cycle is found the samples are recorded, afterwards they only
+     move the read position along, so playback can take over in phase.
+     */
+    void capture(const float* v, int numSamples)
+    {
+        if (ready)
+        {
+            advance(numSamples);
+            return;
+        }
+
+        for (int i = 0; i < numSamples; i++)
+        {
+            const float x = v[i];
+
+            // not enough room for another period: keep looking, centred on what was seen so far
+            if (length == maxPeriod + keptSamples && guardLeft == 0)
+            {
+                threshold = 0.5f * (highest + lowest);
+                restartFrom(length, 0.0f);
+                crossings = 0;
+            }
+
+            table[static_cast<size_t>(length++)] = x;
+            highest = juce::jmax(highest, x);
+            lowest = juce::jmin(lowest, x);
+
+            if (guardLeft > 0)
+            {
+                if (--guardLeft == 0)
+                {
+                    ready = true;
+                    position = length;
+                    advance(numSamples - i - 1);
+                    return;
+                }
+                continue;
+            }
+
+            // one sample behind, the cubic around a crossing needs the sample after it
+            if (length >= 4)
+            {
+                const float* t = table.data() + length - 3;
+                if (t[0] < threshold && t[1] >= threshold)
+                    crossed((length - 3) + findCrossing(t));
+            }
+        }
+    }
+
+    /// write numSamples samples of the captured cycle, only valid once isReady()
+    void play(float* output, int numSamples)
+    {
+        jassert(ready);
+
+        const double end = start + period;
+        int index = static_cast<int>(position);
+        float c0, c1, c2, c3;
+        weights(static_cast<float>(position - index), c0, c1, c2, c3);
+
+        for (int i = 0; i < numSamples; i++)
+        {
+            const float* t = table.data() + index;
+            output[i] = c0 * t[-1] + c1 * t[0] + c2 * t[1] + c3 * t[2];
+
+            position += 1.0;
+            index++;
+
+            if (position >= end)
+            {
+                position -= period;
+                index = static_cast<int>(position);
+                weights(static_cast<float>(position - index), c0, c1, c2, c3);
+            }
+        }
+    }
+
+    /**
+     Solver state at the last sample played, for going back to live integration
+
+     v is read from the table and w is solved from the FHN equation for dv,
+     with the slope taken from the table. The state lands close to the orbit,
+     which is attracting, so the live output continues without a jump.
+     */
+    FhnSolver::State getResumeState() const
+    {
+        const float v = valueAt(position - 1.0);
+
+        // the solver advances by about h / 2 per sample, see FHNIntegrators.h
+        const float slope = (valueAt(position) - valueAt(position - 2.0)) / key.h;
+
+        FhnSolver::State state;
+        state.v = v;
+        state.w = (v - 25.0f / 12.0f * v * v * v + 0.4f * key.input - slope) / 0.4f;
+        return state;
+    }
+
+private:
+    /// handle an upward crossing at a fractional table index
+    void crossed(double at)
+    {
+        if (crossings > 0)
+        {
+            const double cycle = at - start;
+
+            // ripple around the threshold, not a new period
+            if (cycle < minPeriod)
+                return;
+
+            const bool same = std::abs(cycle - period) < periodTolerance * cycle;
+
+            matches = same ? matches + 1 : 0;
+            period = cycle;
+
+            if (matches >= requiredMatches)
+            {
+                // keep this period, plus a few samples for the interpolation at its end
+                guardLeft = guardSamples;
+                return;
+            }
+
+            // the level of the first full period is kept, moving it would shift the crossings
+            if (crossings == 1)
+                threshold = 0.5f * (highest + lowest);
+        }
+
+        // the table always starts just before the latest crossing
+        restartFrom(length, static_cast<float>(at - (length - keptSamples)));
+        crossings++;
+    }
+
+    /// keep the last keptSamples samples, so the crossing at offset lies within them
+    void restartFrom(int end, float offset)
+    {
+        const int keep = juce::jmin(keptSamples, end);
+
+        for (int i = 0; i < keep; i++)
+            table[static_cast<size_t>(i)] = table[static_cast<size_t>(end - keep + i)];
+
+        length = keep;
+        start = (keep - keptSamples) + offset;
+        resetExtremes();
+    }
+
+    /// fraction of the way from t[0] to t[1] where the interpolating cubic reaches the threshold
+    float findCrossing(const float* t) const
+    {
+        float f = (threshold - t[0]) / (t[1] - t[0]);
+
+        for (int i = 0; i < 3; i++)
+        {
+            const float f2 = f * f;
+            float c0, c1, c2, c3;
+            weights(f, c0, c1, c2, c3);
+
+            const float value = c0 * t[-1] + c1 * t[0] + c2 * t[1] + c3 * t[2] - threshold;
+            const float slope = 0.5f * ((-3.0f * f2 + 4.0f * f - 1.0f) * t[-1] + (9.0f * f2 - 10.0f * f) * t[0]
+                                      + (-9.0f * f2 + 8.0f * f + 1.0f) * t[1] + (3.0f * f2 - 2.0f * f) * t[2]);
+
+            if (slope <= 0.0f)
+                break;
+
+            f = juce::jlimit(0.0f, 1.0f, f - value / slope);
+        }
+
+        return f;
+    }
+
+    void resetExtremes()
+    {
+        highest = -1.0e9f;
+        lowest = 1.0e9f;
+    }
+
+    void advance(int numSamples)
+    {
+        position = start + std::fmod(position + numSamples - start, period);
+    }
+
+    /// cubic interpolation at any position, wrapped into the captured period
+    float valueAt(double p) const
+    {
+        p = start + std::fmod(p - start + period, period);
+        const int index = static_cast<int>(p);
+        float c0, c1, c2, c3;
+        weights(static_cast<float>(p - index), c0, c1, c2, c3);
+
+        const float* t = table.data() + index;
+        return c0 * t[-1] + c1 * t[0] + c2 * t[1] + c3 * t[2];
+    }
+
+    /// Catmull-Rom weights for the samples at index - 1 .. index + 2
+    static void weights(float f, float& c0, float& c1, float& c2, float& c3)
+    {
+        const float f2 = f * f, f3 = f2 * f;
+        c0 = 0.5f * (-f3 + 2.0f * f2 - f);
+        c1 = 0.5f * (3.0f * f3 - 5.0f * f2 + 2.0f);
+        c2 = 0.5f * (-3.0f * f3 + 4.0f * f2 + f);
+        c3 = 0.5f * (f3 - f2);
+    }
+
+    static constexpr int keptSamples = 4;        // around the first crossing, for the interpolation
+    static constexpr int guardSamples = 2;       // after the last crossing
+    static constexpr int requiredMatches = 3;
+    static constexpr double minPeriod = 8.0;
+    static constexpr double periodTolerance = 3.0e-5;
+
+    std::vector<float> table;
+    Key key;
+
+    // capture
+    int length = 0;             // samples recorded
+    int crossings = 0, matches = 0, guardLeft = 0;
+    float threshold = 0.0f;
+    float highest = 0.0f, lowest = 0.0f;       // of the samples since the last crossing, for the threshold
+
+    // the period runs from start to start + period, as fractional table indices
+    double start = 0.0, period = 0.0;
+    double position = 0.0;
+    bool ready = false;
+};
+
+#endif /* LimitCycle.h */
@@ -0,0 +1,98 @@
+/*
+  ==============================================================================
+
+    Modulation.h
+    Created: 27 Sep 2023 9:18:05pm
+    Author:  Jeremy Bai
+
+  ==============================================================================
+*/
+
+#ifndef Modulation_h
+#define Modulation_h
+
+#include <JuceHeader.h>
+#include <cmath>
+#include "FastMath.h"
+
+/// how a ControlRamp moves between two control values
+enum class RampShape
+{
+    linear,
+    exponential     // constant ratio per sample, for frequencies and other strictly positive values
+};
+
+/**
+ Audio rate interpolation of a value computed at control rate
+
+ Slow modulators (LFO, pitch, time scale) are evaluated once every control
+ interval and setTarget() is given the value they should reach at the end of
+ it. fill() then writes the per-sample values, so the audio rate loops that
+ consume them only do arithmetic. Each segment ends exactly on its target, so
+ rounding in the exponential ramp never accumulates.
+ */
+template <RampShape shape>
+class ControlRamp
+{
+public:
+    /// jump to value with no interpolation, e.g. at the start of a note
+    void reset(float value)
+    {
+        current = target = value;
+        increment = shape == RampShape::linear ? 0.0f : 1.0f;
+    }
+
+    /**
+     Start a new segment
+
+     @param newTarget value reached on the last sample of the segment
+     @param numSamples length of the segment
+     */
+    void setTarget(float newTarget, int numSamples)
+    {
+        current = target;
+        target = newTarget;
+
+        if (shape == RampShape::linear)
+            increment = (target - current) / numSamples;
+        else
+            increment = current > 0.0f && target > 0.0f ? fastExp2(fastLog2(target / current) / numSamples) : 1.0f;
+    }
+
+    /// write numSamples values of the current segment, numSamples must be the length given to setTarget()
+    void fill(float* dest, int numSamples)
+    {
+        float value = current;
+
+        for (int i = 0; i < numSamples - 1; i++)
+        {
+            if (shape == RampShape::linear)
+                value += increment;
+            else
+                value *= increment;
+
+            dest[i] = value;
+        }
+
+        if (numSamples > 0)
+            dest[numSamples - 1] = target;
+
+        current = target;
+    }
+
+    float getTarget() const
+    {
+        return target;
+    }
+
+private:
+    float current = 0.0f, target = 0.0f;
+    float increment = 0.0f;
+};
+
+//==============================================================================
+/// samples between two evaluations of the control rate modulators
+static constexpr int defaultControlInterval = 32;
+static constexpr int maxControlInterval = 256;
+
+#endif /* Modulation.h */
@@ -0,0 +1,254 @@
+/*
+  ==============================================================================
+
+    ModulationMatrix.h
+    Created: 16 Oct 2023 4:12:37pm
+    Author:  Jeremy Bai
+
+  ==============================================================================
+*/
+
+#ifndef Modulation_Matrix_h
+#define Modulation_Matrix_h
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <vector>
+#include "SimdFloat.h"
+
+/// per voice values a route can read, written by each voice once per control tick
+enum class ModSource
+{
+    lfo1,           // the pitch LFO, -1..1
+    lfo2,           // -1..1
+    modEnvelope,    // 0..1
+    velocity,       // 0..1
+    key,            // octaves from middle C
+    modWheel,       // 0..1
+    aftertouch,     // channel or polyphonic pressure, 0..1
+    timbre,         // CC 74, the third dimension of MPE controllers, 0..1
+    pitchBend,      // the note's bend, octaves
+    numSources
+};
+
+/// what a route can change, in the units of ModulationMatrix::destinationRange
+enum class ModDestination
+{
+    timeScale,      // octaves
+    fhnA, fhnB, fhnC,
+    coupling,
+    detune,         // Hz
+    cutoff,         // octaves
+    oscAmp, noiseAmp, directInput,
+    numDestinations
+};
+
+/**
+ Routes from modulation sources to destinations, evaluated for every voice at once
+
+ Storage is structure-of-arrays: one row per source or destination and
+ control tick, holding a lane per voice. Voices write their sources for a
+ block, process() then runs every route over all lanes with SimdFloat,
+ one pass per control tick, and the voices read back the summed
+ destinations. The cost is routes times voices per tick and nothing per
+ sample, since the destinations are only read at control or block rate.
+ */
+class ModulationMatrix
+{
+public:
+    static constexpr int numSources = static_cast<int>(ModSource::numSources);
+    static constexpr int numDestinations = static_cast<int>(ModDestination::numDestinations);
+    static constexpr int maxRoutes = 8;
+
+    /// one slot of the matrix, as set by the modSource, modDest and modDepth parameters
+    struct Route
+    {
+        int source = -1;        // a ModSource, -1 for an empty slot
+        int destination = 0;    // a ModDestination
+        float depth = 0.0f;     // -1..1 of the destination's range
+    };
+
+    /// destination value of a route at full depth and a source of 1, in ModDestination order
+    static constexpr float destinationRange[numDestinations] =
+    {
+        1.0f,                   // time scale, octaves
+        0.5f, 0.5f, 0.1f,       // FHN a, b, c
+        1.0f,                   // coupling
+        20.0f,                  // detune, Hz
+        4.0f,                   // cutoff, octaves
+        1.0f, 1.0f, 1.0f        // oscillator, noise and direct input amplitudes
+    };
+
+    /// choices of the modSource parameters, "None" first and then ModSource order
+    static juce::StringArray getSourceNames()
+    {
+        return { "None", "LFO 1", "LFO 2", "Mod Envelope", "Velocity", "Key", "Mod Wheel", "Aftertouch", "Timbre", "Pitch Bend" };
+    }
+
+    /// choices of the modDest parameters, in ModDestination order
+    static juce::StringArray getDestinationNames()
+    {
+        return { "Time Scale", "FHN a", "FHN b", "FHN c", "Coupling", "Detune", "Cutoff",
+                 "Oscillator Amplitude", "Noise Input", "Direct Input" };
+    }
+
+    /// IDs of the modSource, modDest and modDepth parameters of a route, numbered from 1 while route counts from 0
+    static juce::StringArray getRouteParameterIds(int route)
+    {
+        const juce::String number(route + 1);
+        return { "modSource" + number, "modDest" + number, "modDepth" + number };
+    }
+
+    /**
+     Allocate the rows, the other methods never allocate
+
+     @param numLanes one lane per voice
+     @param maxTicksPerBlock control ticks in the longest block, see FHNSynthesiser::setControlInterval()
+     */
+    void prepare(int numLanes, int maxTicksPerBlock)
+    {
+        stride = (juce::jmax(1, numLanes) + SimdFloat::width - 1) / SimdFloat::width * SimdFloat::width;
+        maxTicks = juce::jmax(1, maxTicksPerBlock);
+
+        sources.assign(static_cast<size_t>(numSources * maxTicks * stride), 0.0f);
+        destinations.assign(static_cast<size_t>(numDestinations * maxTicks * stride), 0.0f);
+    }
+
+    /// keep the routes that do something, with their depth scaled to the destination's units
+    void setRoutes(const Route* newRoutes, int numNewRoutes)
+    {
+        numRoutes = 0;
+        std::fill(std::begin(sourceUsed), std::end(sourceUsed), false);
+        std::fill(std::begin(destinationRouted), std::end(destinationRouted), false);
+
+        for (int i = 0; i < juce::jmin(numNewRoutes, maxRoutes); i++)
+        {
+            const auto& route = newRoutes[i];
+
+            if (!juce::isPositiveAndBelow(route.source, numSources)
+                || !juce::isPositiveAndBelow(route.destination, numDestinations) || route.depth == 0.0f)
+                continue;
+
+            routes[numRoutes++] = { route.source, route.destination, route.depth * destinationRange[route.destination] };
+            sourceUsed[route.source] = true;
+            destinationRouted[route.destination] = true;
+        }
+
+        clearUnroutedDestinations();
+    }
+
+    /// take other's routes as they are, so that this matrix goes on playing them after other's change
+    void copyRoutesFrom(const ModulationMatrix& other)
+    {
+        std::copy(std::begin(other.routes), std::end(other.routes), std::begin(routes));
+        numRoutes = other.numRoutes;
+        std::copy(std::begin(other.sourceUsed), std::end(other.sourceUsed), std::begin(sourceUsed));
+        std::copy(std::begin(other.destinationRouted), std::end(other.destinationRouted), std::begin(destinationRouted));
+
+        clearUnroutedDestinations();
+    }
+
+    /// true if any route reads source, so a voice can skip the sources nobody uses
+    bool isUsed(ModSource source) const
+    {
+        return sourceUsed[static_cast<int>(source)];
+    }
+
+    /// true if any route changes destination
+    bool isRouted(ModDestination destination) const
+    {
+        return destinationRouted[static_cast<int>(destination)];
+    }
+
+    int getNumRoutes() const
+    {
+        return numRoutes;
+    }
+
+    int getMaxTicks() const
+    {
+        return maxTicks;
+    }
+
+    void setSource(ModSource source, int tick, int lane, float value)
+    {
+        jassert(tick < maxTicks && lane < stride);
+        row(sources, static_cast<int>(source), tick)[lane] = value;
+    }
+
+    /// sum of every route into destination for one voice, 0 if nothing is routed there
+    float getDestination(ModDestination destination, int tick, int lane) const
+    {
+        jassert(tick < maxTicks && lane < stride);
+        return row(destinations, static_cast<int>(destination), tick)[lane];
+    }
+
+    /// evaluate every route for every lane, one vectorised pass per control tick
+    void process(int numTicks)
+    {
+        jassert(numTicks <= maxTicks);
+
+        for (int tick = 0; tick < numTicks; tick++)
+        {
+            for (int d = 0; d < numDestinations; d++)
+                if (destinationRouted[d])
+                    std::fill(row(destinations, d, tick), row(destinations, d, tick) + stride, 0.0f);
+
+            for (int r = 0; r < numRoutes; r++)
+            {
+                const float* source = row(sources, routes[r].source, tick);
+                float* destination = row(destinations, routes[r].destination, tick);
+                const SimdFloat depth(routes[r].depth);
+
+                for (int lane = 0; lane < stride; lane += SimdFloat::width)
+                    (SimdFloat::load(destination + lane) + SimdFloat::load(source + lane) * depth).store(destination + lane);
+            }
+        }
+    }
+
+    /// evaluate a single lane, for a voice rendered outside FHNSynthesiser's batch
+    void processLane(int numTicks, int lane)
+    {
+        jassert(numTicks <= maxTicks && lane < stride);
+
+        for (int tick = 0; tick < numTicks; tick++)
+        {
+            for (int d = 0; d < numDestinations; d++)
+                if (destinationRouted[d])
+                    row(destinations, d, tick)[lane] = 0.0f;
+
+            for (int r = 0; r < numRoutes; r++)
+                row(destinations, routes[r].destination, tick)[lane] += row(sources, routes[r].source, tick)[lane] * routes[r].depth;
+        }
+    }
+
+private:
+    /// a destination that lost its routes reads 0 from now on, process() only clears the routed ones
+    void clearUnroutedDestinations()
+    {
+        for (int d = 0; d < numDestinations; d++)
+            if (!destinationRouted[d])
+                std::fill(row(destinations, d, 0), row(destinations, d, 0) + maxTicks * stride, 0.0f);
+    }
+
+    float* row(std::vector<float>& rows, int index, int tick)
+    {
+        return rows.data() + static_cast<size_t>((index * maxTicks + tick) * stride);
+    }
+
+    const float* row(const std::vector<float>& rows, int index, int tick) const
+    {
+        return rows.data() + static_cast<size_t>((index * maxTicks + tick) * stride);
+    }
+
+    // [source or destination][tick][lane]
+    int stride = 0, maxTicks = 0;
+    std::vector<float> sources, destinations;
+
+    Route routes[maxRoutes];
+    int numRoutes = 0;
+    bool sourceUsed[numSources] = {};
+    bool destinationRouted[numDestinations] = {};
+};
+
+#endif /* ModulationMatrix.h */
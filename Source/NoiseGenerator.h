@@ -0,0 +1,215 @@
+/*
+  ==============================================================================
+
+    NoiseGenerator.h
+    Created: 12 Oct 2023 10:37:15am
+    Author:  Jeremy Bai
+
+  ==============================================================================
+*/
+
+#ifndef Noise_Generator_h
+#define Noise_Generator_h
+
+#include <JuceHeader.h>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+/// spectrum of BlockNoise, in the order of the "noiseColour" parameter
+enum class NoiseColour
+{
+    white,
+    pink,
+    brown
+};
+
+/**
+ Seedable noise source that renders a block at a time
+
+ Uniform values come from lanes independent xoshiro128+ generators stepped
+ side by side, a loop the compiler turns into SIMD integer code, and are
+ mapped to [-1, 1) through the float exponent bits. The lane count is fixed
+ rather than taken from SimdFloat, and values left over from a group are
+ kept for the next call, so the sequence for a seed is the same on every
+ platform and for any block size.
+
+ Pink and brown noise are filtered from the white values: pink with the sum
+ of three one-pole low-passes plus the direct signal (P. Kellet's economy
+ filter, its poles moved with the sample rate), brown with a single leaky
+ integrator. Both are scaled to the RMS of the white noise, so changing the
+ colour does not change the level.
+ */
+class BlockNoise
+{
+public:
+    static constexpr int lanes = 8;
+
+    BlockNoise()
+    {
+        setSeed(0);
+        setSampleRate(44100.0);
+    }
+
+    /// restart the sequence, every seed gives an independent stream
+    void setSeed(std::uint64_t seed)
+    {
+        // splitmix64 spreads the seed over the whole state, as the xoshiro authors recommend
+        auto next = [&seed]()
+        {
+            std::uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        };
+
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            const auto first = next(), second = next();
+            s0[lane] = static_cast<std::uint32_t>(first);
+            s1[lane] = static_cast<std::uint32_t>(first >> 32);
+            s2[lane] = static_cast<std::uint32_t>(second);
+            s3[lane] = static_cast<std::uint32_t>(second >> 32) | 1u;      // never all zero
+        }
+
+        numPending = 0;
+        pinkState[0] = pinkState[1] = pinkState[2] = 0.0f;
+        brownState = 0.0f;
+    }
+
+    void setSampleRate(double sampleRate)
+    {
+        // pole frequencies and DC gains of the economy filter at its design rate of 44.1 kHz
+        static constexpr double pinkPoles[3] = { 16.5, 264.6, 3945.0 };
+        static constexpr double pinkDcGains[3] = { 42.15, 8.014, 2.448 };
+        static constexpr double pinkDirect = 0.1848;
+
+        double gains[3];
+        for (int k = 0; k < 3; k++)
+        {
+            pinkPole[k] = std::exp(-juce::MathConstants<double>::twoPi * pinkPoles[k] / sampleRate);
+            gains[k] = pinkDcGains[k] * (1.0 - pinkPole[k]);
+        }
+
+        // variance of the sum for unit variance input, then the gain that brings it back to the input's
+        double variance = pinkDirect * pinkDirect;
+        for (int i = 0; i < 3; i++)
+        {
+            variance += 2.0 * pinkDirect * gains[i];
+            for (int j = 0; j < 3; j++)
+                variance += gains[i] * gains[j] / (1.0 - pinkPole[i] * pinkPole[j]);
+        }
+
+        const double scale = 1.0 / std::sqrt(variance);
+        for (int k = 0; k < 3; k++)
+            pinkGain[k] = static_cast<float>(gains[k] * scale);
+        pinkDirectGain = static_cast<float>(pinkDirect * scale);
+
+        // one-pole at brownCorner Hz, output variance (1 - p) / (1 + p) of the input's before scaling
+        const double p = std::exp(-juce::MathConstants<double>::twoPi * brownCorner / sampleRate);
+        brownPole = static_cast<float>(p);
+        brownGain = static_cast<float>((1.0 - p) * std::sqrt((1.0 + p) / (1.0 - p)));
+    }
+
+    void setColour(NoiseColour newColour)
+    {
+        colour = newColour;
+    }
+
+    /// write numSamples noise values, white ones uniform in [-1, 1)
+    void fill(float* output, int numSamples)
+    {
+        int i = 0;
+
+        for (; i < numSamples && numPending > 0; i++)
+            output[i] = pending[lanes - numPending--];
+
+        for (; i + lanes <= numSamples; i += lanes)
+            nextGroup(output + i);
+
+        if (i < numSamples)
+        {
+            nextGroup(pending);
+            numPending = lanes;
+
+            for (; i < numSamples; i++)
+                output[i] = pending[lanes - numPending--];
+        }
+
+        switch (colour)
+        {
+            case NoiseColour::pink:     filterPink(output, numSamples); break;
+            case NoiseColour::brown:    filterBrown(output, numSamples); break;
+            default:                    break;
+        }
+    }
+
+private:
+    /// one value from every lane
+    void nextGroup(float* output)
+    {
+        std::uint32_t bits[lanes];
+
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            // xoshiro128+, the top 23 bits become the mantissa of a float in [1, 2)
+            bits[lane] = ((s0[lane] + s3[lane]) >> 9) | 0x3f800000u;
+
+            const std::uint32_t t = s1[lane] << 9;
+            s2[lane] ^= s0[lane];
+            s3[lane] ^= s1[lane];
+            s1[lane] ^= s2[lane];
+            s0[lane] ^= s3[lane];
+            s2[lane] ^= t;
+            s3[lane] = (s3[lane] << 11) | (s3[lane] >> 21);
+        }
+
+        std::memcpy(output, bits, sizeof(bits));
+
+        for (int lane = 0; lane < lanes; lane++)
+            output[lane] = output[lane] * 2.0f - 3.0f;
+    }
+
+    void filterPink(float* samples, int numSamples)
+    {
+        float b0 = pinkState[0], b1 = pinkState[1], b2 = pinkState[2];
+        const float p0 = static_cast<float>(pinkPole[0]), p1 = static_cast<float>(pinkPole[1]), p2 = static_cast<float>(pinkPole[2]);
+
+        for (int i = 0; i < numSamples; i++)
+        {
+            const float white = samples[i];
+            b0 = p0 * b0 + pinkGain[0] * white;
+            b1 = p1 * b1 + pinkGain[1] * white;
+            b2 = p2 * b2 + pinkGain[2] * white;
+            samples[i] = b0 + b1 + b2 + pinkDirectGain * white;
+        }
+
+        pinkState[0] = b0;
+        pinkState[1] = b1;
+        pinkState[2] = b2;
+    }
+
+    void filterBrown(float* samples, int numSamples)
+    {
+        float y = brownState;
+
+        for (int i = 0; i < numSamples; i++)
+            samples[i] = y = brownPole * y + brownGain * samples[i];
+
+        brownState = y;
+    }
+
+    static constexpr double brownCorner = 10.0;     // Hz, below this the spectrum flattens out
+
+    std::uint32_t s0[lanes], s1[lanes], s2[lanes], s3[lanes];
+    float pending[lanes] = {};
+    int numPending = 0;
+
+    NoiseColour colour = NoiseColour::white;
+    double pinkPole[3] = {};
+    float pinkGain[3] = {}, pinkDirectGain = 0.0f;
+    float pinkState[3] = {};
+    float brownPole = 0.0f, brownGain = 0.0f, brownState = 0.0f;
+};
+
+#endif /* NoiseGenerator.h */
@@ -12,6 +12,9 @@
 #ifndef Oscillator_h
 #define Oscillator_h
 
+#include <cmath>
+#include "FastMath.h"
+
 /**
  Base oscillator class
  
@@ -39,6 +42,19 @@ public:
         return output(phase + phaseOffset);
     }
 
+    /**
+     Advance the phase by numSamples samples at once and output the result
+     
+     Used for oscillators read at control rate, such as the LFO.
+     */
+    float advanceOscillator(int numSamples)
+    {
+        phase += phaseDelta * numSamples;
+        phase -= std::floor(phase);
+        
+        return output(phase + phaseOffset);
+    }
+
     // force reset phase to start next period
     void resetPhase()
     {
@@ -59,6 +75,7 @@ public:
     void setSampleRate(float sr)
     {
         sampleRate = sr;
+        inverseSampleRate = 1.0f / sr;
     }
     
     /**
@@ -69,7 +86,7 @@ public:
     void setFrequency(float freq)
     {
         frequency = freq;
-        phaseDelta = frequency / sampleRate;
+        phaseDelta = frequency * inverseSampleRate;
     }
     
     /// for phase modulation:
@@ -81,6 +98,7 @@ public:
 private:
     float frequency;
     float sampleRate;
+    float inverseSampleRate;      // so setFrequency() can be called per sample without a division
     float phase = 0.0f;
     float phaseDelta;
     
@@ -92,7 +110,7 @@ private:
  */
 class SinOsc : public Phasor
 {
-    float output(float p) override  { return std::sin(p * 2.0 * 3.1415926); }
+    float output(float p) override  { return fastSin2Pi(p); }
 };
 
 /**
@@ -0,0 +1,243 @@
+/*
+  ==============================================================================
+
+    Oversampling.h
+    Created: 16 Sep 2023 11:05:42am
+    Author:  Jeremy Bai
+
+  ==============================================================================
+*/
+
+#ifndef Oversampling_h
+#define Oversampling_h
+
+#include <JuceHeader.h>
+#include <vector>
+#include "SimdFloat.h"
+
+/**
+ 2:1 halfband FIR decimator in polyphase form
+
+ Every other tap of a halfband filter is zero apart from the centre one, so
+ each output sample is the dot product of the even input samples with
+ numTaps coefficients plus half of one delayed odd input sample. Outputs are
+ computed SimdFloat::width at a time by broadcasting each coefficient, which
+ keeps the inner loop free of horizontal sums.
+ */
+class HalfbandDecimator
+{
+public:
+    /**
+     Design the filter and allocate history
+
+     @param numEvenTaps length of the even polyphase branch (multiple of 2), the full filter has 2 * numEvenTaps - 1 taps
+     @param maxOutputSamples largest numOutput passed to process()
+     */
+    void prepare(int numEvenTaps, int maxOutputSamples)
+    {
+        numTaps = numEvenTaps;
+
+        // Kaiser windowed sinc, cut off at a quarter of the input rate
+        const double beta = 8.0;
+        const int length = 2 * numTaps - 1;
+        const int centre = numTaps - 1;
+        coefficients.assign(numTaps, 0.0f);
+
+        double sum = 0.0;
+        for (int j = 0; j < numTaps; j++)
+        {
+            const double d = 2 * j - centre;   // odd distance from the centre tap
+            const double r = (2.0 * (2 * j) - (length - 1)) / (length + 1);
+            const double window = besselI0(beta * std::sqrt(juce::jmax(0.0, 1.0 - r * r))) / besselI0(beta);
+            const double tap = std::sin(juce::MathConstants<double>::pi * d / 2.0) / (juce::MathConstants<double>::pi * d) * window;
+            coefficients[j] = static_cast<float>(tap);
+            sum += tap;
+        }
+
+        // even branch sums to 0.5 so the DC gain is one
+        for (auto& c : coefficients)
+            c = static_cast<float>(c * 0.5 / sum);
+
+        evenWork.assign(numTaps - 1 + maxOutputSamples + SimdFloat::width, 0.0f);
+        oddWork.assign(numTaps / 2 + maxOutputSamples, 0.0f);
+        maxOutput = maxOutputSamples;
+    }
+
+    void reset()
+    {
+        std::fill(evenWork.begin(), evenWork.end(), 0.0f);
+        std::fill(oddWork.begin(), oddWork.end(), 0.0f);
+    }
+
+    /**
+     Decimate 2 * numOutput input samples into numOutput output samples
+
+     input and output may point to the same buffer.
+     */
+    void process(const float* input, float* output, int numOutput)
+    {
+        jassert(numOutput <= maxOutput);
+
+        const int evenHistory = numTaps - 1;
+        const int oddHistory = numTaps / 2;
+
+        for (int n = 0; n < numOutput; n++)
+        {
+            evenWork[evenHistory + n] = input[2 * n];
+            oddWork[oddHistory + n] = input[2 * n + 1];
+        }
+
+        const float* taps = coefficients.data();
+        int n = 0;
+
+        for (; n + SimdFloat::width <= numOutput; n += SimdFloat::width)
+        {
+            auto acc = SimdFloat::load(&oddWork[n]) * 0.5f;
+
+            for (int t = 0; t < numTaps; t++)
+                acc += SimdFloat::load(&evenWork[n + t]) * taps[t];
+
+            acc.store(output + n);
+        }
+
+        for (; n < numOutput; n++)
+        {
+            float acc = oddWork[n] * 0.5f;
+
+            for (int t = 0; t < numTaps; t++)
+                acc += evenWork[n + t] * taps[t];
+
+            output[n] = acc;
+        }
+
+        // keep the tails for the next block
+        std::copy(evenWork.begin() + numOutput, evenWork.begin() + numOutput + evenHistory, evenWork.begin());
+        std::copy(oddWork.begin() + numOutput, oddWork.begin() + numOutput + oddHistory, oddWork.begin());
+    }
+
+private:
+    static double besselI0(double x)
+    {
+        double sum = 1.0, term = 1.0;
+        for (int k = 1; k < 32; k++)
+        {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+        }
+        return sum;
+    }
+
+    int numTaps = 0;
+    int maxOutput = 0;
+    std::vector<float> coefficients;
+    std::vector<float> evenWork, oddWork;
+};
+
+//==============================================================================
+/**
+ Oversampling stage around a voice's left/right solver pair
+
+ Inputs are linearly interpolated up by 2, 4 or 8, the solvers run on the
+ oversampled buffers, and the result is brought back down by a cascade of
+ halfband decimators. The early stages run at a high rate where the
+ transition band is wide, so they use short filters; only the last stage
+ needs the long one.
+ */
+class FhnOversampler
+{
+public:
+    static constexpr int maxFactor = 8;
+
+    void prepare(int maxBlockSize)
+    {
+        blockSize = maxBlockSize;
+
+        for (int ch = 0; ch < 2; ch++)
+        {
+            input[ch].assign(maxBlockSize * maxFactor, 0.0f);
+            output[ch].assign(maxBlockSize * maxFactor, 0.0f);
+
+            // stage 0 produces the base rate output, stage s produces 2^s times that
+            for (int stage = 0; stage < numStages; stage++)
+                decimators[ch][stage].prepare(stage == 0 ? 16 : 8, maxBlockSize << stage);
+        }
+
+        setFactor(1);
+    }
+
+    /**
+     Select 1, 2, 4 or 8 times oversampling and clear the filter state
+
+     Only call between notes, changing the factor mid-note would click.
+     */
+    void setFactor(int newFactor)
+    {
+        factor = juce::jlimit(1, maxFactor, juce::nextPowerOfTwo(newFactor));
+
+        for (int ch = 0; ch < 2; ch++)
+        {
+            lastInput[ch] = 0.0f;
+            for (auto& d : decimators[ch])
+                d.reset();
+        }
+    }
+
+    int getFactor() const
+    {
+        return factor;
+    }
+
+    /// oversampled input of the given channel, valid after upsample()
+    float* getInput(int channel)            { return input[channel].data(); }
+
+    /// buffer the solver should write its oversampled output to
+    float* getOutput(int channel)           { return output[channel].data(); }
+
+    /// linearly interpolate numSamples base rate samples into getInput(channel)
+    void upsample(int channel, const float* source, int numSamples)
+    {
+        float* dest = input[channel].data();
+        const float step = 1.0f / factor;
+        float previous = lastInput[channel];
+
+        for (int i = 0; i < numSamples; i++)
+        {
+            const float delta = (source[i] - previous) * step;
+            for (int j = 1; j <= factor; j++)
+                *dest++ = previous + delta * j;
+            previous = source[i];
+        }
+
+        lastInput[channel] = previous;
+    }
+
+    /// band-limit getOutput(channel) and write numSamples base rate samples to dest
+    void downsample(int channel, float* dest, int numSamples)
+    {
+        float* data = output[channel].data();
+        int length = numSamples * factor;
+
+        // highest rate stage first, the long filter in stage 0 runs last
+        for (int stage = numStagesFor(factor) - 1; stage >= 0; stage--)
+        {
+            length /= 2;
+            decimators[channel][stage].process(data, stage == 0 ? dest : data, length);
+        }
+    }
+
+private:
+    static constexpr int numStages = 3;
+
+    static int numStagesFor(int f)
+    {
+        return f >= 8 ? 3 : (f >= 4 ? 2 : (f >= 2 ? 1 : 0));
+    }
+
+    int blockSize = 0;
+    int factor = 1;
+    float lastInput[2] = { 0.0f, 0.0f };
+    std::vector<float> input[2], output[2];
+    HalfbandDecimator decimators[2][numStages];
+};
+
+#endif /* Oversampling.h */
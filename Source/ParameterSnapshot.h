@@ -0,0 +1,404 @@
+/*
+  ==============================================================================
+
+    ParameterSnapshot.h
+    Created: 24 Sep 2023 10:42:18am
+    Author:  Jeremy Bai
+
+  ==============================================================================
+*/
+
+#ifndef Parameter_Snapshot_h
+#define Parameter_Snapshot_h
+
+#include <JuceHeader.h>
+#include <atomic>
+#include <memory>
+#include "FHNIntegrators.h"
+#include "FHNNetwork.h"
+#include "ModulationMatrix.h"
+#include "NoiseGenerator.h"
+#include "SpscQueue.h"
+
+/**
+ Plain copy of every synth parameter for one block
+ */
+struct FhnParameters
+{
+    // inputs
+    float directInput = 0, oscAmp = 1, noiseAmp = 0;
+    float modFreq = 0, modAmp = 0, pulseWidth = 0.5f;
+    int mainType = 0, modType = 0;
+    NoiseColour noiseColour = NoiseColour::white;
+
+    // solver
+    float timeScale = 1;
+    FhnIntegrator integrator = FhnIntegrator::rk4;
+    int maxOversampling = 1;
+    int networkSize = 2;
+    FhnTopology topology = FhnTopology::ring;
+
+    // pitch and stereo
+    float lfoFreq = 0, lfoAmp = 0;
+    bool stereo = false;
+    float detune = 0, coupling = 0;
+
+    // filter
+    float cutoff = 20000, resonance = 20000, strength = 0;
+    float keytrack = 0;
+    int filterType = 0;
+
+    juce::ADSR::Parameters envelope;
+    float amp = 1;
+    int polyphony = 8;
+
+    // per note expression, see FHNSynthesiser::getExpression()
+    bool mpe = false;
+    float bendRange = 2, mpeBendRange = 48;
+
+    // modulation, see ModulationMatrix
+    float lfo2Freq = 1;
+    juce::ADSR::Parameters modEnvelope;
+    ModulationMatrix::Route modRoutes[ModulationMatrix::maxRoutes];
+};
+
+//==============================================================================
+/**
+ Per-block view of the parameter tree shared by all voices
+
+ update() reads each parameter's atomic once per block and records which
+ groups of parameters changed since the last block, so voices only redo the
+ expensive parts (filter settings, oscillator type, pulse width) when
+ they need to. Everything lives on the audio thread, nothing here locks.
+
+ Loading a state or preset changes every parameter at once, which the
+ message thread brackets with a ScopedSwap. Until the swap ends the audio
+ thread keeps the values it has, so no block sees half a preset, and the
+ new values are then read and derived on the message thread and handed
+ over with a single pointer exchange. The update() that takes them reports
+ wasSwapped(), so the voices can crossfade instead of jumping.
+ */
+class ParameterSnapshot
+{
+public:
+    /// groups of parameters reported by hasChanged()
+    enum Change : juce::uint32
+    {
+        inputs          = 1 << 0,
+        oscillatorType  = 1 << 1,
+        solver          = 1 << 2,
+        pitch           = 1 << 3,
+        filter          = 1 << 4,
+        envelope        = 1 << 5,
+        output          = 1 << 6,
+        voices          = 1 << 7,
+        modulation      = 1 << 8,
+        all             = 0xffffffff
+    };
+
+    explicit ParameterSnapshot(juce::AudioProcessorValueTreeState& apvts)
+    {
+        for (int i = 0; i < firstRouteIndex; i++)
+            connect(apvts, i, specs[i].id, specs[i].group);
+        
+        for (int route = 0; route < ModulationMatrix::maxRoutes; route++)
+        {
+            const auto ids = ModulationMatrix::getRouteParameterIds(route);
+            for (int field = 0; field < ids.size(); field++)
+                connect(apvts, firstRouteIndex + 3 * route + field, ids[field], modulation);
+        }
+        
+        for (int i = afterRoutesIndex; i < numParameters; i++)
+            connect(apvts, i, specsAfterRoutes[i - afterRoutesIndex].id, specsAfterRoutes[i - afterRoutesIndex].group);
+    }
+    
+    ~ParameterSnapshot()
+    {
+        delete published.exchange(nullptr);
+        reclaim();
+    }
+    
+    /**
+     Message thread: set many parameters as one change, e.g. while loading a state or switching programs
+     
+     The audio thread takes the parameters as they are when the swap ends,
+     not any of the intermediate values. Swaps must not be nested.
+     */
+    class ScopedSwap
+    {
+    public:
+        explicit ScopedSwap(ParameterSnapshot& snapshotToSwap) : snapshot(snapshotToSwap)
+        {
+            snapshot.beginSwap();
+        }
+        
+        ~ScopedSwap()
+        {
+            snapshot.endSwap();
+        }
+        
+    private:
+        ParameterSnapshot& snapshot;
+        
+        JUCE_DECLARE_NON_COPYABLE(ScopedSwap)
+    };
+
+    /**
+     Read the parameter tree, called once at the start of each block
+
+     @param sampleRate current host rate, reported as a filter change, since the voice filters depend on it
+     */
+    void update(double sampleRate)
+    {
+        changes = pending;
+        pending = 0;
+        swapped = false;
+        
+        // read before looking for a swap, an even generation means any swap that ended has been published
+        const auto generation = swapGeneration.load(std::memory_order_acquire);
+        
+        if (auto* prepared = published.exchange(nullptr, std::memory_order_acq_rel))
+        {
+            adopt(*prepared);
+            
+            // freed on the message thread, see reclaim()
+            retired.push(prepared);
+        }
+        else if ((generation & 1) == 0)
+        {
+            readSources(generation);
+        }
+        
+        if (sampleRate != lastSampleRate)
+        {
+            lastSampleRate = sampleRate;
+            changes |= filter;
+        }
+        
+        if (changes != 0 && !swapped)
+            derive(values, params);
+    }
+    
+    /// report every group as changed on the next update(), e.g. after voices are added
+    void invalidate()
+    {
+        pending = all;
+    }
+
+    /// true if any parameter of the given groups changed in the last update()
+    bool hasChanged(juce::uint32 groups) const
+    {
+        return (changes & groups) != 0;
+    }
+
+    /// true if the last update() took the parameters of a swap and any of them changed
+    bool wasSwapped() const
+    {
+        return swapped;
+    }
+    
+    const FhnParameters& get() const
+    {
+        return params;
+    }
+
+private:
+    enum Index
+    {
+        directInputIndex, oscAmpIndex, noiseAmpIndex,
+        modFreqIndex, modAmpIndex, pulseWidthIndex,
+        mainTypeIndex, modTypeIndex, noiseColourIndex,
+        timeScaleIndex, integratorIndex, oversamplingIndex, networkSizeIndex, topologyIndex,
+        lfoFreqIndex, lfoAmpIndex,
+        stereoIndex, detuneIndex, couplingIndex,
+        cutoffIndex, resonanceIndex, strengthIndex, filterTypeIndex, keytrackIndex,
+        attackIndex, decayIndex, sustainIndex, releaseIndex,
+        ampIndex, polyphonyIndex,
+        lfo2FreqIndex, modAttackIndex, modDecayIndex, modSustainIndex, modReleaseIndex,
+        firstRouteIndex,    // source, destination and depth of each route
+        afterRoutesIndex = firstRouteIndex + 3 * ModulationMatrix::maxRoutes,
+        mpeIndex = afterRoutesIndex, bendRangeIndex, mpeBendRangeIndex,
+        numParameters
+    };
+
+    struct Spec
+    {
+        const char* id;
+        juce::uint32 group;
+    };
+
+    // in Index order, up to the routes, whose IDs are numbered, see ModulationMatrix::getRouteParameterIds()
+    static constexpr Spec specs[firstRouteIndex] =
+    {
+        { "directInput", inputs }, { "oscAmp", inputs }, { "noiseAmp", inputs },
+        { "modFreq", inputs }, { "modAmp", inputs }, { "pulseWidth", inputs },
+        { "mainType", oscillatorType }, { "modType", oscillatorType }, { "noiseColour", inputs },
+        { "timeScale", solver }, { "integrator", solver }, { "oversampling", solver },
+        { "networkSize", solver }, { "topology", solver },
+        { "lfoFreq", pitch }, { "lfoAmp", pitch },
+        { "stereo", output }, { "detune", pitch }, { "coupling", solver },
+        { "cutoff", filter }, { "resonance", filter }, { "strength", output }, { "filterType", filter },
+        { "keytrack", filter },
+        { "attack", envelope }, { "decay", envelope }, { "sustain", envelope }, { "release", envelope },
+        { "amp", output }, { "polyphony", voices },
+        { "lfo2Freq", modulation },
+        { "modAttack", modulation }, { "modDecay", modulation }, { "modSustain", modulation }, { "modRelease", modulation }
+    };
+    
+    // in Index order, from afterRoutesIndex
+    static constexpr Spec specsAfterRoutes[numParameters - afterRoutesIndex] =
+    {
+        { "mpe", voices }, { "bendRange", voices }, { "mpeBendRange", voices }
+    };
+    
+    void connect(juce::AudioProcessorValueTreeState& apvts, int index, const juce::String& id, juce::uint32 group)
+    {
+        sources[index] = apvts.getRawParameterValue(id);
+        groups[index] = group;
+        jassert(sources[index] != nullptr);
+    }
+
+    /// a swap's new values, read and derived on the message thread
+    struct Prepared
+    {
+        float values[numParameters];
+        FhnParameters params;
+    };
+    
+    void beginSwap()
+    {
+        // odd while the parameters are being written
+        swapGeneration.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+    
+    void endSwap()
+    {
+        reclaim();
+        
+        auto prepared = std::make_unique<Prepared>();
+        for (int i = 0; i < numParameters; i++)
+            prepared->values[i] = sources[i]->load(std::memory_order_relaxed);
+        derive(prepared->values, prepared->params);
+        
+        // a swap the audio thread never took is still ours to free
+        delete published.exchange(prepared.release(), std::memory_order_acq_rel);
+        swapGeneration.fetch_add(1, std::memory_order_release);
+    }
+    
+    /// message thread: free the swaps the audio thread has finished with
+    void reclaim()
+    {
+        Prepared* done = nullptr;
+        while (retired.pop(done))
+            delete done;
+    }
+    
+    /// audio thread
+    void adopt(const Prepared& prepared)
+    {
+        for (int i = 0; i < numParameters; i++)
+        {
+            if (prepared.values[i] != values[i])
+            {
+                values[i] = prepared.values[i];
+                changes |= groups[i];
+            }
+        }
+        
+        params = prepared.params;
+        swapped = changes != 0;
+    }
+    
+    /// audio thread: the parameter atomics, dropped if a swap started while they were read
+    void readSources(juce::uint32 generation)
+    {
+        float latest[numParameters];
+        for (int i = 0; i < numParameters; i++)
+            latest[i] = sources[i]->load(std::memory_order_relaxed);
+        
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (swapGeneration.load(std::memory_order_relaxed) != generation)
+            return;
+        
+        for (int i = 0; i < numParameters; i++)
+        {
+            if (latest[i] != values[i])
+            {
+                values[i] = latest[i];
+                changes |= groups[i];
+            }
+        }
+    }
+    
+    static void derive(const float* values, FhnParameters& params)
+    {
+        params.directInput = values[directInputIndex];
+        params.oscAmp = values[oscAmpIndex];
+        params.noiseAmp = values[noiseAmpIndex];
+        params.modFreq = values[modFreqIndex];
+        params.modAmp = values[modAmpIndex];
+        params.pulseWidth = values[pulseWidthIndex];
+        params.mainType = static_cast<int>(values[mainTypeIndex]);
+        params.modType = static_cast<int>(values[modTypeIndex]);
+        params.noiseColour = static_cast<NoiseColour>(static_cast<int>(values[noiseColourIndex]));
+
+        params.timeScale = values[timeScaleIndex];
+        params.integrator = static_cast<FhnIntegrator>(static_cast<int>(values[integratorIndex]));
+        params.maxOversampling = 1 << static_cast<int>(values[oversamplingIndex]);
+        params.networkSize = juce::jlimit(2, FhnNetwork::maxNodes, static_cast<int>(values[networkSizeIndex]));
+        params.topology = static_cast<FhnTopology>(static_cast<int>(values[topologyIndex]));
+
+        params.lfoFreq = values[lfoFreqIndex];
+        params.lfoAmp = values[lfoAmpIndex];
+        params.stereo = values[stereoIndex] >= 0.5f;
+        params.detune = values[detuneIndex];
+        params.coupling = values[couplingIndex];
+
+        params.cutoff = values[cutoffIndex];
+        params.resonance = values[resonanceIndex];
+        params.strength = values[strengthIndex];
+        params.filterType = static_cast<int>(values[filterTypeIndex]);
+        params.keytrack = values[keytrackIndex];
+
+        params.envelope.attack = values[attackIndex];
+        params.envelope.decay = values[decayIndex];
+        params.envelope.sustain = values[sustainIndex];
+        params.envelope.release = values[releaseIndex];
+        params.amp = values[ampIndex];
+        params.polyphony = juce::jmax(1, static_cast<int>(values[polyphonyIndex]));
+        params.mpe = values[mpeIndex] >= 0.5f;
+        params.bendRange = values[bendRangeIndex];
+        params.mpeBendRange = values[mpeBendRangeIndex];
+
+        params.lfo2Freq = values[lfo2FreqIndex];
+        params.modEnvelope.attack = values[modAttackIndex];
+        params.modEnvelope.decay = values[modDecayIndex];
+        params.modEnvelope.sustain = values[modSustainIndex];
+        params.modEnvelope.release = values[modReleaseIndex];
+
+        // the source choice starts with "None"
+        for (int i = 0; i < ModulationMatrix::maxRoutes; i++)
+        {
+            const float* route = values + firstRouteIndex + 3 * i;
+            params.modRoutes[i] = { static_cast<int>(route[0]) - 1, static_cast<int>(route[1]), route[2] };
+        }
+    }
+
+    std::atomic<float>* sources[numParameters] = {};
+    juce::uint32 groups[numParameters] = {};
+    float values[numParameters] = {};
+
+    FhnParameters params;
+    double lastSampleRate = 0;
+    juce::uint32 changes = 0;
+    juce::uint32 pending = all;
+    
+    // preset swaps, see ScopedSwap
+    std::atomic<juce::uint32> swapGeneration { 0 };
+    std::atomic<Prepared*> published { nullptr };
+    SpscQueue<Prepared*, 8> retired;
+    bool swapped = false;
+};
+
+#endif /* ParameterSnapshot.h */
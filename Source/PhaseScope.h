@@ -0,0 +1,105 @@
+/*
+  ==============================================================================
+
+    PhaseScope.h
+    Created: 15 Oct 2023 11:37:46am
+    Author:  Jeremy Bai
+
+  ==============================================================================
+*/
+
+#ifndef Phase_Scope_h
+#define Phase_Scope_h
+
+#include <JuceHeader.h>
+#include <atomic>
+#include "FHNSolver.h"
+#include "SpscQueue.h"
+
+/// one point of the (v, w) trajectory shown by the editor's scope
+struct ScopePoint
+{
+    float v, w;
+};
+
+/**
+ Audio thread end of the phase plane scope
+
+ While a reader has the tap enabled, FHNSynthesiser hands it to the newest
+ voice, which publishes the state of its left solver every decimation
+ output samples into a SpscQueue. With the tap disabled, which is whenever
+ the editor is closed, no voice holds it and the audio thread does no work
+ for the scope at all.
+
+ The solvers keep w in registers for the whole block and only output v, so
+ w is followed here by integrating its linear equation, driven by the
+ published v and restarted from the solver's exact state at every block.
+ That costs a few operations per sample of one voice and tracks w to
+ within a few percent of its range even on high notes.
+ */
+class ScopeTap
+{
+public:
+    static constexpr int decimation = 4;        // output samples per point, 12000 points a second at 48 kHz
+    using Queue = SpscQueue<ScopePoint, 16384>;
+
+    /// reader side: start or stop asking the voices for points
+    void setEnabled(bool shouldBeEnabled)
+    {
+        enabled.store(shouldBeEnabled, std::memory_order_release);
+    }
+
+    bool isEnabled() const
+    {
+        return enabled.load(std::memory_order_acquire);
+    }
+
+    Queue& getQueue()
+    {
+        return queue;
+    }
+
+    /**
+     Audio thread: publish one block of the scope voice's left solver
+
+     @param v solver output at the solver rate
+     @param numSamples samples in v
+     @param oversampling solver samples per output sample
+     @param p the solver's coefficients for the block
+     @param start solver state before the block, or nullptr if the solver was not stepped, e.g. during cycle playback
+     */
+    void publish(const float* v, int numSamples, int oversampling, const FhnCoefficients<float>& p, const FhnSolver::State* start)
+    {
+        if (start != nullptr)
+        {
+            shadowW = start->w;
+            previousV = start->v;
+        }
+
+        // every integrator advances by about h / 2 per sample, see FHNIntegrators.h
+        const float ch = 0.5f * p.ch;
+        const int step = decimation * oversampling;
+
+        for (int i = 0; i < numSamples; i++)
+        {
+            shadowW += (1.25f * (previousV + v[i]) + p.a - p.b * shadowW) * ch;
+            previousV = v[i];
+
+            if (++phase >= step)
+            {
+                phase = 0;
+                queue.push({ v[i], shadowW });
+            }
+        }
+    }
+
+private:
+    Queue queue;
+    std::atomic<bool> enabled { false };
+
+    // audio thread only
+    float shadowW = 0.0f, previousV = 0.0f;
+    int phase = 0;
+};
+
+#endif /* PhaseScope.h */
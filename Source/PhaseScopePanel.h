@@ -0,0 +1,221 @@
+/*
+  ==============================================================================
+
+    PhaseScopePanel.h
+    Created: 15 Oct 2023 2:16:53pm
+    Author:  Jeremy Bai
+
+  ==============================================================================
+*/
+
+#ifndef Phase_Scope_Panel_h
+#define Phase_Scope_Panel_h
+
+#include <JuceHeader.h>
+#include <vector>
+#include "PhaseScope.h"
+
+/**
+ Editor view of the newest voice's left solver: the (v, w) phase portrait
+ on the left and the v waveform on the right
+
+ Enables the processor's ScopeTap while it exists and reads its queue on
+ the message thread at no more than frameRate frames a second. The grid is
+ drawn once per size into a cached image, the traces are rebuilt into
+ paths that keep their storage, and only the two plot areas are repainted,
+ and only when new points arrived, so an idle scope costs nothing.
+ */
+class PhaseScopePanel : public juce::Component,
+                        private juce::Timer
+{
+public:
+    static constexpr int preferredHeight = 220;
+    static constexpr int frameRate = 30;
+    static constexpr int historySize = 4096;        // points kept, about a third of a second
+    static constexpr int portraitPoints = 2048;
+    static constexpr int waveformPoints = 1024;
+
+    explicit PhaseScopePanel(ScopeTap& tapToRead) : tap(tapToRead), history(historySize, ScopePoint { 0.0f, 0.0f })
+    {
+        portrait.preallocateSpace(3 * portraitPoints + 8);
+        waveform.preallocateSpace(3 * waveformPoints + 8);
+        setOpaque(true);
+
+        // points left in the queue are from the last time the editor was open
+        tap.getQueue().discard();
+        tap.setEnabled(true);
+        startTimerHz(frameRate);
+    }
+
+    ~PhaseScopePanel() override
+    {
+        tap.setEnabled(false);
+    }
+
+    void paint(juce::Graphics& g) override
+    {
+        g.drawImageAt(background, 0, 0);
+
+        g.setColour(juce::Colours::lightgreen);
+        g.strokePath(portrait, juce::PathStrokeType(1.2f));
+        g.setColour(juce::Colours::lightskyblue);
+        g.strokePath(waveform, juce::PathStrokeType(1.2f));
+    }
+
+    void resized() override
+    {
+        auto area = getLocalBounds().reduced(6);
+        portraitArea = area.removeFromLeft(area.getHeight()).toFloat();
+        area.removeFromLeft(6);
+        waveformArea = area.toFloat();
+
+        drawBackground();
+        rebuildPaths();
+    }
+
+private:
+    void timerCallback() override
+    {
+        auto& queue = tap.getQueue();
+        ScopePoint point;
+        int numNew = 0;
+
+        while (queue.pop(point))
+        {
+            history[static_cast<size_t>(writePosition)] = point;
+            writePosition = (writePosition + 1) % historySize;
+            numNew++;
+        }
+
+        if (numNew == 0)
+            return;
+
+        numPoints = juce::jmin(historySize, numPoints + numNew);
+        rebuildPaths();
+
+        repaint(portraitArea.getSmallestIntegerContainer().expanded(2));
+        repaint(waveformArea.getSmallestIntegerContainer().expanded(2));
+    }
+
+    /// a point counting back from the newest, 0 being the newest
+    const ScopePoint& getPoint(int age) const
+    {
+        return history[static_cast<size_t>((writePosition - 1 - age + 2 * historySize) % historySize)];
+    }
+
+    /// the ranges follow the trajectory, growing at once and shrinking slowly, so a new note settles in
+    void updateRanges(int count)
+    {
+        float vMin = 1.0e9f, vMax = -1.0e9f, wMin = 1.0e9f, wMax = -1.0e9f;
+
+        for (int age = 0; age < count; age++)
+        {
+            const auto& p = getPoint(age);
+            vMin = juce::jmin(vMin, p.v);
+            vMax = juce::jmax(vMax, p.v);
+            wMin = juce::jmin(wMin, p.w);
+            wMax = juce::jmax(wMax, p.w);
+        }
+
+        auto follow = [](juce::Range<float> current, float low, float high)
+        {
+            const float margin = 0.1f * juce::jmax(0.1f, high - low);
+            low -= margin;
+            high += margin;
+
+            if (current.isEmpty())
+                return juce::Range<float>(low, high);
+
+            return juce::Range<float>(low < current.getStart() ? low : current.getStart() + 0.1f * (low - current.getStart()),
+                                      high > current.getEnd() ? high : current.getEnd() + 0.1f * (high - current.getEnd()));
+        };
+
+        vRange = follow(vRange, vMin, vMax);
+        wRange = follow(wRange, wMin, wMax);
+    }
+
+    void rebuildPaths()
+    {
+        portrait.clear();
+        waveform.clear();
+
+        if (numPoints < 2 || portraitArea.isEmpty())
+            return;
+
+        const int count = juce::jmin(numPoints, portraitPoints);
+        updateRanges(count);
+
+        auto toPortrait = [this](const ScopePoint& p)
+        {
+            return juce::Point<float>(juce::jmap(p.v, vRange.getStart(), vRange.getEnd(), portraitArea.getX(), portraitArea.getRight()),
+                                      juce::jmap(p.w, wRange.getStart(), wRange.getEnd(), portraitArea.getBottom(), portraitArea.getY()));
+        };
+
+        // oldest first, so the path runs the way the state moves
+        portrait.startNewSubPath(toPortrait(getPoint(count - 1)));
+        for (int age = count - 2; age >= 0; age--)
+            portrait.lineTo(toPortrait(getPoint(age)));
+
+        // waveform triggered on the latest rising crossing of the middle of v, so a steady note stands still
+        const int length = juce::jmin(numPoints, waveformPoints);
+        const float middle = vRange.getStart() + 0.5f * vRange.getLength();
+        int start = length - 1;
+
+        for (int age = length - 1; age < numPoints - 1; age++)
+        {
+            if (getPoint(age + 1).v < middle && getPoint(age).v >= middle)
+            {
+                start = age;
+                break;
+            }
+        }
+
+        const float xScale = waveformArea.getWidth() / static_cast<float>(juce::jmax(1, length - 1));
+        auto toWaveform = [this, start, xScale](int age)
+        {
+            return juce::Point<float>(waveformArea.getX() + static_cast<float>(start - age) * xScale,
+                                      juce::jmap(getPoint(age).v, vRange.getStart(), vRange.getEnd(), waveformArea.getBottom(), waveformArea.getY()));
+        };
+
+        waveform.startNewSubPath(toWaveform(start));
+        for (int age = start - 1; age > start - length; age--)
+            waveform.lineTo(toWaveform(age));
+    }
+
+    void drawBackground()
+    {
+        background = juce::Image(juce::Image::RGB, juce::jmax(1, getWidth()), juce::jmax(1, getHeight()), true);
+        juce::Graphics g(background);
+
+        g.fillAll(getLookAndFeel().findColour(juce::ResizableWindow::backgroundColourId).darker(0.3f));
+
+        for (auto area : { portraitArea, waveformArea })
+        {
+            g.setColour(juce::Colours::black.withAlpha(0.4f));
+            g.fillRect(area);
+            g.setColour(juce::Colours::white.withAlpha(0.15f));
+            g.drawVerticalLine(juce::roundToInt(area.getCentreX()), area.getY(), area.getBottom());
+            g.drawHorizontalLine(juce::roundToInt(area.getCentreY()), area.getX(), area.getRight());
+        }
+
+        g.setColour(juce::Colours::white.withAlpha(0.6f));
+        g.setFont(12.0f);
+        g.drawText("v", portraitArea.withTrimmedTop(portraitArea.getHeight() - 14.0f).reduced(4.0f, 0.0f), juce::Justification::centredRight);
+        g.drawText("w", portraitArea.withHeight(14.0f).reduced(4.0f, 0.0f), juce::Justification::centredLeft);
+        g.drawText("v(t)", waveformArea.withHeight(14.0f).reduced(4.0f, 0.0f), juce::Justification::centredLeft);
+    }
+
+    ScopeTap& tap;
+
+    std::vector<ScopePoint> history;
+    int writePosition = 0, numPoints = 0;
+
+    juce::Rectangle<float> portraitArea, waveformArea;
+    juce::Range<float> vRange, wRange;
+    juce::Path portrait, waveform;
+    juce::Image background;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PhaseScopePanel)
+};
+
+#endif /* PhaseScopePanel.h */
@@ -11,11 +11,17 @@
 
 //==============================================================================
 MyFHNSynthAudioProcessorEditor::MyFHNSynthAudioProcessorEditor (MyFHNSynthAudioProcessor& p)
-    : AudioProcessorEditor (&p), audioProcessor (p)
+    : AudioProcessorEditor (&p), audioProcessor (p),
+      parameterEditor (p), scopePanel (p.getScopeTap()), telemetryPanel (p.getTelemetry())
 {
+    addAndMakeVisible (parameterEditor);
+    addAndMakeVisible (scopePanel);
+    addAndMakeVisible (telemetryPanel);
+
     // Make sure that before the constructor has finished, you've set the
     // editor's size to whatever you need it to be.
-    setSize (400, 300);
+    setSize (juce::jmax (600, parameterEditor.getWidth()),
+             parameterEditor.getHeight() + PhaseScopePanel::preferredHeight + TelemetryPanel::preferredHeight);
 }
 
 MyFHNSynthAudioProcessorEditor::~MyFHNSynthAudioProcessorEditor()
@@ -27,14 +33,12 @@ void MyFHNSynthAudioProcessorEditor::paint (juce::Graphics& g)
 {
     // (Our component is opaque, so we must completely fill the background with a solid colour)
     g.fillAll (getLookAndFeel().findColour (juce::ResizableWindow::backgroundColourId));
-
-    g.setColour (juce::Colours::white);
-    g.setFont (15.0f);
-    g.drawFittedText ("Hello World!", getLocalBounds(), juce::Justification::centred, 1);
 }
 
 void MyFHNSynthAudioProcessorEditor::resized()
 {
-    // This is generally where you'll want to lay out the positions of any
-    // subcomponents in your editor..
+    auto area = getLocalBounds();
+    telemetryPanel.setBounds (area.removeFromBottom (TelemetryPanel::preferredHeight));
+    scopePanel.setBounds (area.removeFromBottom (PhaseScopePanel::preferredHeight));
+    parameterEditor.setBounds (area);
 }
@@ -10,9 +10,12 @@
 
 #include <JuceHeader.h>
 //#include "PluginProcessor.h"
+#include "PhaseScopePanel.h"
+#include "TelemetryPanel.h"
 
 //==============================================================================
 /**
+ The generic parameter editor, with the phase plane scope and the performance telemetry strip below it
 */
 class MyFHNSynthAudioProcessorEditor  : public juce::AudioProcessorEditor
 {
@@ -28,6 +31,10 @@ private:
     // This reference is provided as a quick way for your editor to
     // access the processor object that created it.
     MyFHNSynthAudioProcessor& audioProcessor;
+    
+    juce::GenericAudioProcessorEditor parameterEditor;
+    PhaseScopePanel scopePanel;
+    TelemetryPanel telemetryPanel;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MyFHNSynthAudioProcessorEditor)
 };
@@ -21,7 +21,23 @@ MyFHNSynthAudioProcessor::MyFHNSynthAudioProcessor()
                        .withOutput ("Output", juce::AudioChannelSet::stereo(), true)
                      #endif
                        ),
-    parameterTree(*this, nullptr, "parameterTreeID",
+    parameterTree(*this, nullptr, "parameterTreeID", createParameterLayout()),
+    parameters(parameterTree),
+    binaryState(*this)
+#endif
+{
+    fhnSynth.addSound(new FHNSynthSound());
+    fhnSynth.setScopeTap(&scopeTap);
+    loadPresetBank(getDefaultPresetBankFile());
+}
+
+MyFHNSynthAudioProcessor::~MyFHNSynthAudioProcessor()
+{
+}
+
+juce::AudioProcessorValueTreeState::ParameterLayout MyFHNSynthAudioProcessor::createParameterLayout()
+{
+    juce::AudioProcessorValueTreeState::ParameterLayout layout
     {
         std::make_unique<juce::AudioParameterFloat>("directInput", "Direct Input", 0.0f, 1.0f, 0.0f),
         std::make_unique<juce::AudioParameterFloat>("noiseAmp", "Noise Input", 0.0f, 1.0f, 0.0f),
@@ -55,14 +71,38 @@ MyFHNSynthAudioProcessor::MyFHNSynthAudioProcessor()
         std::make_unique<juce::AudioParameterFloat>("release", "Release", 0.0f, 1.0f, 0.1f),
         
         std::make_unique<juce::AudioParameterFloat>("amp", "Overall Amp", 0.0f, 1.0f, 1.0f),
-    })
-#endif
-{
-    fhnSynth.addSound(new FHNSynthSound());
-}
-
-MyFHNSynthAudioProcessor::~MyFHNSynthAudioProcessor()
-{
+        
+        // added after the first release, append new parameters below so host automation keeps its indices
+        std::make_unique<juce::AudioParameterChoice>("integrator", "FHN Integrator", juce::StringArray{"RK4", "Heun", "Semi-Implicit", "Adaptive RK23"}, 0),
+        std::make_unique<juce::AudioParameterChoice>("oversampling", "FHN Oversampling", juce::StringArray{"Off", "Up to 2x", "Up to 4x", "Up to 8x"}, 0),
+        std::make_unique<juce::AudioParameterInt>("polyphony", "Polyphony", 1, maxPolyphony, 8),
+        std::make_unique<juce::AudioParameterFloat>("keytrack", "Filter Key Tracking", 0.0f, 1.0f, 0.0f),
+        std::make_unique<juce::AudioParameterInt>("networkSize", "FHN Network Nodes", 2, FhnNetwork::maxNodes, 2),
+        std::make_unique<juce::AudioParameterChoice>("topology", "FHN Network Topology", juce::StringArray{"Ring", "Chain", "All-to-All", "Custom"}, 0),
+        std::make_unique<juce::AudioParameterChoice>("noiseColour", "Noise Colour", juce::StringArray{"White", "Pink", "Brown"}, 0),
+        
+        std::make_unique<juce::AudioParameterFloat>("lfo2Freq", "LFO 2 Frequency", 0.0f, 20.0f, 1.0f),
+        std::make_unique<juce::AudioParameterFloat>("modAttack", "Mod Attack", 0.0f, 1.0f, 0.1f),
+        std::make_unique<juce::AudioParameterFloat>("modDecay", "Mod Decay", 0.0f, 1.0f, 0.1f),
+        std::make_unique<juce::AudioParameterFloat>("modSustain", "Mod Sustain", 0.0f, 1.0f, 1.0f),
+        std::make_unique<juce::AudioParameterFloat>("modRelease", "Mod Release", 0.0f, 1.0f, 0.1f)
+    };
+    
+    for (int route = 0; route < ModulationMatrix::maxRoutes; route++)
+    {
+        const auto ids = ModulationMatrix::getRouteParameterIds(route);
+        const auto name = "Mod " + juce::String(route + 1);
+        
+        layout.add(std::make_unique<juce::AudioParameterChoice>(ids[0], name + " Source", ModulationMatrix::getSourceNames(), 0),
+                   std::make_unique<juce::AudioParameterChoice>(ids[1], name + " Destination", ModulationMatrix::getDestinationNames(), 0),
+                   std::make_unique<juce::AudioParameterFloat>(ids[2], name + " Depth", -1.0f, 1.0f, 0.0f));
+    }
+    
+    layout.add(std::make_unique<juce::AudioParameterBool>("mpe", "MPE", false),
+               std::make_unique<juce::AudioParameterInt>("bendRange", "Pitch Bend Range", 0, 48, 2),
+               std::make_unique<juce::AudioParameterInt>("mpeBendRange", "MPE Note Bend Range", 0, 96, 48));
+    
+    return layout;
 }
 
 //==============================================================================
@@ -105,26 +145,43 @@ double MyFHNSynthAudioProcessor::getTailLengthSeconds() const
 
 int MyFHNSynthAudioProcessor::getNumPrograms()
 {
-    return 1;   // NB: some hosts don't cope very well if you tell them there are 0 programs,
-                // so this should be at least 1, even if you're not really implementing programs.
+    return juce::jmax(1, presetBank.getNumPresets());   // NB: some hosts don't cope very well if you tell them there are 0 programs,
+                                                        // so this should be at least 1, even if there is no preset bank.
 }
 
 int MyFHNSynthAudioProcessor::getCurrentProgram()
 {
-    return 0;
+    return currentProgram;
 }
 
 void MyFHNSynthAudioProcessor::setCurrentProgram (int index)
 {
+    size_t size;
+    auto* state = presetBank.getState(index, size);
+    BinaryState::Extras extras;
+    
+    if (state == nullptr)
+        return;
+    
+    // only the parameters that differ from the current program are set, and playing notes crossfade to them
+    const ParameterSnapshot::ScopedSwap swap(parameters);
+    
+    if (binaryState.apply(state, size, extras))
+    {
+        // a bank state stores whichever program was current when it was saved, not its own place in the bank
+        extras.program = index;
+        applyExtras(extras);
+    }
 }
 
 const juce::String MyFHNSynthAudioProcessor::getProgramName (int index)
 {
-    return {};
+    return presetBank.getName(index);
 }
 
 void MyFHNSynthAudioProcessor::changeProgramName (int index, const juce::String& newName)
 {
+    // the bank is mapped read only and shared by every instance, rename presets where it is built (see FHNRender --make-bank)
 }
 
 //==============================================================================
@@ -134,10 +191,38 @@ void MyFHNSynthAudioProcessor::prepareToPlay (double sampleRate, int samplesPerB
     // initialisation that you need..
     
     fhnSynth.setCurrentPlaybackSampleRate(sampleRate);
-    for (int i = 0; i < voiceCount; i++)
+    
+    // voices render long host blocks in chunks, which keeps their scratch small at high polyphony
+    const int renderBlockSize = juce::jmin(samplesPerBlock, maxRenderBlockSize);
+    
+    // every voice the polyphony parameter can ask for is created up front, plus spares
+    // for stolen voices to fade out on. Hosts call this again on every rate or block
+    // size change, so reuse the voices that already exist.
+    if (fhnSynth.getNumVoices() != voiceCount)
+    {
+        fhnSynth.clearVoices();
+        for (int i = 0; i < voiceCount; i++)
+        {
+            fhnSynth.addVoice(new FHNSynthVoice(sampleRate, renderBlockSize));
+        }
+    }
+    else
     {
-        fhnSynth.addVoice(new FHNSynthVoice(sampleRate));
+        for (int i = 0; i < voiceCount; i++)
+        {
+            static_cast<FHNSynthVoice*>(fhnSynth.getVoice(i))->prepare(renderBlockSize);
+        }
     }
+    
+    fhnSynth.prepare(voiceCount, renderBlockSize);
+    fhnSynth.setControlInterval(controlInterval);
+    fhnSynth.setCycleCaching(cycleCaching);
+    fhnSynth.setCustomNetwork(parseNetwork(getCustomNetwork()));
+    fhnSynth.setNoiseSeed(noiseSeed);
+    fhnSynth.setParallelRendering(renderThreads, minParallelVoices);
+    
+    // new voices have not seen any parameters yet
+    parameters.invalidate();
 }
 
 void MyFHNSynthAudioProcessor::releaseResources()
@@ -174,6 +259,7 @@ bool MyFHNSynthAudioProcessor::isBusesLayoutSupported (const BusesLayout& layout
 
 void MyFHNSynthAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
+    const auto startTicks = juce::Time::getHighResolutionTicks();
     juce::ScopedNoDenormals noDenormals;
     auto totalNumInputChannels  = getTotalNumInputChannels();
     auto totalNumOutputChannels = getTotalNumOutputChannels();
@@ -187,13 +273,28 @@ void MyFHNSynthAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, j
     for (auto i = totalNumInputChannels; i < totalNumOutputChannels; ++i)
         buffer.clear (i, 0, buffer.getNumSamples());
 
-    for (int i = 0; i < voiceCount; i++)
-    {
-        FHNSynthVoice* voice = dynamic_cast<FHNSynthVoice*>(fhnSynth.getVoice(i));
-        voice->updateParameters(parameterTree);
-    }
+    parameters.update(getSampleRate());
     
-    fhnSynth.renderNextBlock(buffer, midiMessages, 0, buffer.getNumSamples());
+    // even when idle, a change is only reported for one block and the synth keeps its own copy of some of it
+    fhnSynth.updateParameters(parameters);
+    
+    // nothing sounding and nothing to start: the buffer is already silent
+    if (! midiMessages.isEmpty() || fhnSynth.getNumActiveVoices() > 0)
+        fhnSynth.renderNextBlock(buffer, midiMessages, 0, buffer.getNumSamples());
+    
+    recordTelemetry(startTicks, buffer.getNumSamples());
+}
+
+void MyFHNSynthAudioProcessor::recordTelemetry(juce::int64 startTicks, int numSamples)
+{
+    const double sampleRate = getSampleRate();
+    
+    BlockTelemetry record;
+    record.renderSeconds = static_cast<float>(juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks));
+    record.budgetSeconds = sampleRate > 0.0 ? static_cast<float>(numSamples / sampleRate) : 0.0f;
+    record.activeVoices = fhnSynth.getNumActiveVoices();
+    record.numSamples = numSamples;
+    telemetry.push(record);
 }
 
 //==============================================================================
@@ -204,34 +305,156 @@ bool MyFHNSynthAudioProcessor::hasEditor() const
 
 juce::AudioProcessorEditor* MyFHNSynthAudioProcessor::createEditor()
 {
-    return new juce::GenericAudioProcessorEditor (*this);
+    return new MyFHNSynthAudioProcessorEditor (*this);
 }
 
 //==============================================================================
 void MyFHNSynthAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 {
-    // You should use this method to store your parameters in the memory block.
-    // You could do that either as raw data, or use the XML or ValueTree classes
-    // as intermediaries to make it easy to save and load complex data.
-    auto state = parameterTree.copyState();
-    std::unique_ptr<juce::XmlElement> xml(state.createXml());
-    copyXmlToBinary(*xml, destData);
+    // read straight from the parameters, without going through the parameter tree or XML
+    binaryState.write(destData, { currentProgram, getCustomNetwork() });
 }
 
 void MyFHNSynthAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
-    // You should use this method to restore your parameters from this memory block,
-    // whose contents will have been created by the getStateInformation() call.
+    // the audio thread sees the whole new state or none of it, and playing notes crossfade to it
+    const ParameterSnapshot::ScopedSwap swap(parameters);
+    BinaryState::Extras extras;
+    
+    if (BinaryState::isBinaryState(data, static_cast<size_t>(juce::jmax(0, sizeInBytes))))
+    {
+        if (binaryState.apply(data, static_cast<size_t>(sizeInBytes), extras))
+            applyExtras(extras);
+        
+        return;
+    }
+    
+    // states saved before the binary format were XML
     std::unique_ptr<juce::XmlElement> xmlState(getXmlFromBinary(data, sizeInBytes));
     if (xmlState.get() != nullptr)
     {
         if (xmlState->hasTagName(parameterTree.state.getType()))
         {
             parameterTree.replaceState(juce::ValueTree::fromXml(*xmlState));
+            applyCustomNetwork();
         }
     }
 }
 
+void MyFHNSynthAudioProcessor::applyExtras(const BinaryState::Extras& extras)
+{
+    if (extras.program >= 0)
+        currentProgram = extras.program;
+    
+    // rebuilding the networks takes the callback lock, so skip it when the edges are unchanged
+    if (extras.customNetwork != getCustomNetwork())
+        setCustomNetwork(extras.customNetwork);
+}
+
+//==============================================================================
+int MyFHNSynthAudioProcessor::getNumActiveVoices() const
+{
+    return fhnSynth.getNumActiveVoices();
+}
+
+void MyFHNSynthAudioProcessor::setControlInterval(int numSamples)
+{
+    controlInterval = numSamples;
+    
+    // resizes the modulation matrix, which must not happen mid-block
+    const juce::ScopedLock lock(getCallbackLock());
+    fhnSynth.setControlInterval(controlInterval);
+}
+
+void MyFHNSynthAudioProcessor::setMinimumRenderingSubdivisionSize(int numSamples, bool shouldBeStrict)
+{
+    fhnSynth.setMinimumRenderingSubdivisionSize(juce::jmax(1, numSamples), shouldBeStrict);
+}
+
+void MyFHNSynthAudioProcessor::setCycleCaching(bool shouldCache)
+{
+    cycleCaching = shouldCache;
+    fhnSynth.setCycleCaching(cycleCaching);
+}
+
+void MyFHNSynthAudioProcessor::setRenderThreads(int numWorkers)
+{
+    renderThreads = juce::jmax(0, numWorkers);
+}
+
+void MyFHNSynthAudioProcessor::setNoiseSeed(juce::uint64 seed)
+{
+    noiseSeed = seed;
+}
+
+void MyFHNSynthAudioProcessor::setCustomNetwork(const juce::String& edges)
+{
+    parameterTree.state.setProperty(customNetworkId, edges, nullptr);
+    applyCustomNetwork();
+}
+
+juce::String MyFHNSynthAudioProcessor::getCustomNetwork() const
+{
+    return parameterTree.state.getProperty(customNetworkId).toString();
+}
+
+juce::AudioProcessorValueTreeState& MyFHNSynthAudioProcessor::getParameterTree()
+{
+    return parameterTree;
+}
+
+TelemetryRing& MyFHNSynthAudioProcessor::getTelemetry()
+{
+    return telemetry;
+}
+
+ScopeTap& MyFHNSynthAudioProcessor::getScopeTap()
+{
+    return scopeTap;
+}
+
+bool MyFHNSynthAudioProcessor::loadPresetBank(const juce::File& file)
+{
+    const bool opened = presetBank.open(file);
+    currentProgram = 0;
+    updateHostDisplay(ChangeDetails().withProgramChanged(true));
+    return opened;
+}
+
+juce::File MyFHNSynthAudioProcessor::getDefaultPresetBankFile()
+{
+    return juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
+        .getChildFile(JucePlugin_Name).getChildFile("Presets.fhnbank");
+}
+
+void MyFHNSynthAudioProcessor::applyCustomNetwork()
+{
+    auto edges = parseNetwork(getCustomNetwork());
+    
+    // voices copy the edges into storage they own, which must not happen mid-block
+    const juce::ScopedLock lock(getCallbackLock());
+    fhnSynth.setCustomNetwork(edges);
+}
+
+std::vector<FhnNetwork::Edge> MyFHNSynthAudioProcessor::parseNetwork(const juce::String& text)
+{
+    std::vector<FhnNetwork::Edge> edges;
+    
+    // "first-second" or "first-second:weight", nodes counted from 0
+    for (const auto& token : juce::StringArray::fromTokens(text, ", ;", ""))
+    {
+        const auto nodes = token.upToFirstOccurrenceOf(":", false, false);
+        if (!nodes.containsChar('-'))
+            continue;
+        
+        edges.push_back({ nodes.upToFirstOccurrenceOf("-", false, false).getIntValue(),
+                          nodes.fromFirstOccurrenceOf("-", false, false).getIntValue(),
+                          token.containsChar(':') ? token.fromFirstOccurrenceOf(":", false, false).getFloatValue() : 1.0f });
+    }
+    
+    return edges;
+}
+
 //==============================================================================
 // This creates new instances of the plugin..
 juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
@@ -9,6 +9,11 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "Synthesiser.h"
+#include "Telemetry.h"
+#include "PhaseScope.h"
+#include "BinaryState.h"
+#include "PresetBank.h"
 
 //==============================================================================
 /**
@@ -55,12 +60,82 @@ public:
     //==============================================================================
     void getStateInformation (juce::MemoryBlock& destData) override;
     void setStateInformation (const void* data, int sizeInBytes) override;
+    
+    //==============================================================================
+    /// number of voices currently sounding, for load reporting
+    int getNumActiveVoices() const;
+    
+    /// samples between control rate modulation updates, applied to every voice
+    void setControlInterval(int numSamples);
+    
+    /// shortest run rendered between MIDI events, see juce::Synthesiser::setMinimumRenderingSubdivisionSize(); 1 for sample accurate timing
+    void setMinimumRenderingSubdivisionSize(int numSamples, bool shouldBeStrict = false);
+    
+    /// let voices with a static input play their captured limit cycle instead of integrating (on by default)
+    void setCycleCaching(bool shouldCache);
+    
+    /// worker threads for parallel voice rendering, 0 (the default) renders on the audio thread only; applied in prepareToPlay
+    void setRenderThreads(int numWorkers);
+    
+    /// base seed of the voices' noise generators; applied in prepareToPlay, which restarts every noise sequence
+    void setNoiseSeed(juce::uint64 seed);
+    
+    /**
+     Edges of the custom network topology, saved with the state
+     
+     @param edges "first-second" or "first-second:weight" pairs of node numbers from 0, separated by commas
+     */
+    void setCustomNetwork(const juce::String& edges);
+    juce::String getCustomNetwork() const;
+    
+    /// the parameters, for tools that drive the DSP classes directly (see FHNRender --bench-dsp)
+    juce::AudioProcessorValueTreeState& getParameterTree();
+    
+    /// one record per processBlock, with its wall time and time budget; read by a single reader, normally the editor
+    TelemetryRing& getTelemetry();
+    
+    /// the phase plane scope's tap, enabled by the editor while it is open
+    ScopeTap& getScopeTap();
+    
+    /// map a preset bank written by PresetBank::write(); its presets become the programs
+    bool loadPresetBank(const juce::File& file);
+    
+    /// the bank every instance opens when it is created, if there is one
+    static juce::File getDefaultPresetBankFile();
 
 private:
-    juce::Synthesiser fhnSynth;
-    int voiceCount = 8;
+    FHNSynthesiser fhnSynth;
+    static constexpr int maxPolyphony = 128;
+    static constexpr int stealSpareVoices = 8;
+    static constexpr int voiceCount = maxPolyphony + stealSpareVoices;
+    static constexpr int maxRenderBlockSize = 256;
+    int controlInterval = defaultControlInterval;
+    int renderThreads = 0;
+    bool cycleCaching = true;
+    juce::uint64 noiseSeed = 0;
+    static constexpr int minParallelVoices = 4;
     
+    // custom network edges, kept as a property of the parameter state
+    static constexpr const char* customNetworkId = "customNetwork";
+    void applyCustomNetwork();
+    static std::vector<FhnNetwork::Edge> parseNetwork(const juce::String& text);
+    
+    static juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout();
     juce::AudioProcessorValueTreeState parameterTree;
+    ParameterSnapshot parameters;
+    
+    // written at the end of every processBlock, lock and allocation free
+    TelemetryRing telemetry;
+    void recordTelemetry(juce::int64 startTicks, int numSamples);
+    
+    // fed by the newest voice, only while the editor's scope has it enabled
+    ScopeTap scopeTap;
+    
+    // state and programs, see BinaryState.h and PresetBank.h
+    BinaryState binaryState;
+    PresetBank presetBank;
+    int currentProgram = 0;
+    void applyExtras(const BinaryState::Extras& extras);
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MyFHNSynthAudioProcessor)
 };
@@ -0,0 +1,242 @@
+/*
+  ==============================================================================
+
+    PresetBank.h
+    Created: 16 Oct 2023 11:05:51am
+    Author:  Jeremy Bai
+
+  ==============================================================================
+*/
+
+#ifndef Preset_Bank_h
+#define Preset_Bank_h
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <memory>
+#include <numeric>
+#include <vector>
+#include "BinaryState.h"
+
+/**
+ Read only library of named presets in a single memory mapped file
+
+ Every instance maps the same file, so the operating system keeps one copy
+ of it however many instances a session loads, and opening a bank reads
+ nothing but its header: names and states are read straight out of the
+ mapping when asked for. The layout, all little endian, is
+
+     uint32  magic "FHNB"
+     uint16  version
+     uint16  reserved
+     uint32  number of presets
+     uint32  reserved
+     per preset, in program order: uint32 name offset, name bytes, state offset, state bytes
+     per preset, sorted by hash: uint32 BinaryState::hash of the name, program index
+     names as UTF-8 and states as written by BinaryState
+
+ with offsets from the start of the file. Banks are written with write(),
+ which replaces the file rather than changing it, so instances that have
+ the old bank mapped keep reading it until they reopen.
+ */
+class PresetBank
+{
+public:
+    static constexpr juce::uint32 magic = 0x424e4846;     // "FHNB"
+    static constexpr juce::uint16 version = 1;
+    static constexpr size_t headerSize = 16;
+    static constexpr size_t indexEntrySize = 16;
+    static constexpr size_t lookupEntrySize = 8;
+
+    /// map a bank, returns false and leaves the bank empty if the file is missing or malformed
+    bool open(const juce::File& file)
+    {
+        close();
+
+        auto mapping = std::make_unique<juce::MemoryMappedFile>(file, juce::MemoryMappedFile::readOnly);
+        auto* data = static_cast<const char*>(mapping->getData());
+        const size_t size = mapping->getSize();
+
+        if (data == nullptr || size < headerSize || juce::ByteOrder::littleEndianInt(data) != magic
+            || juce::ByteOrder::littleEndianShort(data + 4) < 1)
+            return false;
+
+        const size_t count = juce::ByteOrder::littleEndianInt(data + 8);
+
+        if (size < headerSize + count * (indexEntrySize + lookupEntrySize))
+            return false;
+
+        // check every offset once here, so lookups never have to
+        for (size_t i = 0; i < count; i++)
+        {
+            auto* entry = data + headerSize + i * indexEntrySize;
+
+            if (!fits(juce::ByteOrder::littleEndianInt(entry), juce::ByteOrder::littleEndianInt(entry + 4), size)
+                || !fits(juce::ByteOrder::littleEndianInt(entry + 8), juce::ByteOrder::littleEndianInt(entry + 12), size)
+                || juce::ByteOrder::littleEndianInt(data + headerSize + count * indexEntrySize + i * lookupEntrySize + 4) >= count)
+                return false;
+        }
+
+        mappedFile = std::move(mapping);
+        base = data;
+        numPresets = static_cast<int>(count);
+        return true;
+    }
+
+    void close()
+    {
+        mappedFile.reset();
+        base = nullptr;
+        numPresets = 0;
+    }
+
+    int getNumPresets() const
+    {
+        return numPresets;
+    }
+
+    juce::String getName(int index) const
+    {
+        if (!juce::isPositiveAndBelow(index, numPresets))
+            return {};
+
+        auto* entry = getIndexEntry(index);
+        return juce::String::fromUTF8(base + juce::ByteOrder::littleEndianInt(entry),
+                                      static_cast<int>(juce::ByteOrder::littleEndianInt(entry + 4)));
+    }
+
+    /// program index of the preset with this name, or -1
+    int indexOf(const juce::String& name) const
+    {
+        const auto h = BinaryState::hash(name);
+        auto* lookup = base + headerSize + static_cast<size_t>(numPresets) * indexEntrySize;
+
+        // binary search of the hash table, then compare names to rule out collisions
+        int low = 0, high = numPresets;
+        while (low < high)
+        {
+            const int middle = (low + high) / 2;
+            if (juce::ByteOrder::littleEndianInt(lookup + static_cast<size_t>(middle) * lookupEntrySize) < h)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+
+        for (; low < numPresets; low++)
+        {
+            auto* entry = lookup + static_cast<size_t>(low) * lookupEntrySize;
+            if (juce::ByteOrder::littleEndianInt(entry) != h)
+                break;
+
+            const auto index = static_cast<int>(juce::ByteOrder::littleEndianInt(entry + 4));
+            if (getName(index) == name)
+                return index;
+        }
+
+        return -1;
+    }
+
+    /**
+     A preset's state, pointing into the mapping rather than copied
+
+     @param size receives the state's size in bytes
+     @returns nullptr if there is no such preset
+     */
+    const void* getState(int index, size_t& size) const
+    {
+        size = 0;
+
+        if (!juce::isPositiveAndBelow(index, numPresets))
+            return nullptr;
+
+        auto* entry = getIndexEntry(index);
+        size = juce::ByteOrder::littleEndianInt(entry + 12);
+        return base + juce::ByteOrder::littleEndianInt(entry + 8);
+    }
+
+    /**
+     Write a bank, replacing the file in one step once it is complete
+
+     @param states one state per name, as written by BinaryState, in program order
+     */
+    static bool write(const juce::File& file, const juce::StringArray& names, const juce::Array<juce::MemoryBlock>& states)
+    {
+        jassert(names.size() == states.size());
+        const auto count = static_cast<size_t>(juce::jmin(names.size(), states.size()));
+
+        juce::MemoryOutputStream names8, blobs;
+        std::vector<juce::uint32> nameOffsets, stateOffsets;
+        const auto dataStart = headerSize + count * (indexEntrySize + lookupEntrySize);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            nameOffsets.push_back(static_cast<juce::uint32>(names8.getDataSize()));
+            names8.write(names[static_cast<int>(i)].toRawUTF8(), names[static_cast<int>(i)].getNumBytesAsUTF8());
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            stateOffsets.push_back(static_cast<juce::uint32>(dataStart + names8.getDataSize() + blobs.getDataSize()));
+            blobs.write(states.getReference(static_cast<int>(i)).getData(), states.getReference(static_cast<int>(i)).getSize());
+        }
+
+        std::vector<juce::uint32> order(count);
+        std::iota(order.begin(), order.end(), 0u);
+        std::stable_sort(order.begin(), order.end(), [&](juce::uint32 x, juce::uint32 y)
+        {
+            return BinaryState::hash(names[static_cast<int>(x)]) < BinaryState::hash(names[static_cast<int>(y)]);
+        });
+
+        juce::TemporaryFile temporary(file);
+        {
+            juce::FileOutputStream out(temporary.getFile());
+            if (!out.openedOk())
+                return false;
+
+            out.writeInt(static_cast<int>(magic));
+            out.writeShort(static_cast<short>(version));
+            out.writeShort(0);
+            out.writeInt(static_cast<int>(count));
+            out.writeInt(0);
+
+            for (size_t i = 0; i < count; i++)
+            {
+                out.writeInt(static_cast<int>(dataStart + nameOffsets[i]));
+                out.writeInt(names[static_cast<int>(i)].getNumBytesAsUTF8());
+                out.writeInt(static_cast<int>(stateOffsets[i]));
+                out.writeInt(static_cast<int>(states.getReference(static_cast<int>(i)).getSize()));
+            }
+
+            for (auto index : order)
+            {
+                out.writeInt(static_cast<int>(BinaryState::hash(names[static_cast<int>(index)])));
+                out.writeInt(static_cast<int>(index));
+            }
+
+            out << names8 << blobs;
+            out.flush();
+
+            if (out.getStatus().failed())
+                return false;
+        }
+
+        return temporary.overwriteTargetFileWithTemporary();
+    }
+
+private:
+    const char* getIndexEntry(int index) const
+    {
+        return base + headerSize + static_cast<size_t>(index) * indexEntrySize;
+    }
+
+    static bool fits(size_t offset, size_t length, size_t size)
+    {
+        return offset <= size && length <= size - offset;
+    }
+
+    std::unique_ptr<juce::MemoryMappedFile> mappedFile;
+    const char* base = nullptr;
+    int numPresets = 0;
+};
+
+#endif /* PresetBank.h */
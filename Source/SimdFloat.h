@@ -0,0 +1,287 @@
+/*
+  ==============================================================================
+
+    SimdFloat.h
+    Created: 2 Sep 2023 4:12:07pm
+    Author:  Jeremy Bai
+
+  ==============================================================================
+*/
+
+#ifndef Simd_Float_h
+#define Simd_Float_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX__)
+ #include <immintrin.h>
+ #define FHN_SIMD_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+ #include <emmintrin.h>
+ #define FHN_SIMD_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+ #include <arm_neon.h>
+ #define FHN_SIMD_NEON 1
+#endif
+
+/**
+ Thin wrapper around the widest float register available at compile time.
+
+ AVX gives 8 lanes, SSE2 and NEON give 4, anything else falls back to a plain
+ 4 float array that the compiler can still auto-vectorise. The operators mirror
+ the scalar ones so DSP kernels can be written once as templates and
+ instantiated for both float and SimdFloat.
+ */
+struct SimdFloat
+{
+#if FHN_SIMD_AVX
+    static constexpr int width = 8;
+    using Register = __m256;
+#elif FHN_SIMD_SSE
+    static constexpr int width = 4;
+    using Register = __m128;
+#elif FHN_SIMD_NEON
+    static constexpr int width = 4;
+    using Register = float32x4_t;
+#else
+    static constexpr int width = 4;
+    struct Register { float lane[4]; };
+#endif
+
+    Register value;
+
+    SimdFloat() = default;
+    SimdFloat(Register v) : value(v) {}
+
+    /// broadcast a scalar to every lane
+    SimdFloat(float x)
+    {
+#if FHN_SIMD_AVX
+        value = _mm256_set1_ps(x);
+#elif FHN_SIMD_SSE
+        value = _mm_set1_ps(x);
+#elif FHN_SIMD_NEON
+        value = vdupq_n_f32(x);
+#else
+        for (auto& l : value.lane) l = x;
+#endif
+    }
+
+    /// unaligned load of width floats
+    static SimdFloat load(const float* p)
+    {
+#if FHN_SIMD_AVX
+        return _mm256_loadu_ps(p);
+#elif FHN_SIMD_SSE
+        return _mm_loadu_ps(p);
+#elif FHN_SIMD_NEON
+        return vld1q_f32(p);
+#else
+        Register r;
+        for (int i = 0; i < width; i++) r.lane[i] = p[i];
+        return r;
+#endif
+    }
+
+    /// unaligned store of width floats
+    void store(float* p) const
+    {
+#if FHN_SIMD_AVX
+        _mm256_storeu_ps(p, value);
+#elif FHN_SIMD_SSE
+        _mm_storeu_ps(p, value);
+#elif FHN_SIMD_NEON
+        vst1q_f32(p, value);
+#else
+        for (int i = 0; i < width; i++) p[i] = value.lane[i];
+#endif
+    }
+
+    friend SimdFloat operator+(SimdFloat a, SimdFloat b)
+    {
+#if FHN_SIMD_AVX
+        return _mm256_add_ps(a.value, b.value);
+#elif FHN_SIMD_SSE
+        return _mm_add_ps(a.value, b.value);
+#elif FHN_SIMD_NEON
+        return vaddq_f32(a.value, b.value);
+#else
+        Register r;
+        for (int i = 0; i < width; i++) r.lane[i] = a.value.lane[i] + b.value.lane[i];
+        return r;
+#endif
+    }
+
+    friend SimdFloat operator-(SimdFloat a, SimdFloat b)
+    {
+#if FHN_SIMD_AVX
+        return _mm256_sub_ps(a.value, b.value);
+#elif FHN_SIMD_SSE
+        return _mm_sub_ps(a.value, b.value);
+#elif FHN_SIMD_NEON
+        return vsubq_f32(a.value, b.value);
+#else
+        Register r;
+        for (int i = 0; i < width; i++) r.lane[i] = a.value.lane[i] - b.value.lane[i];
+        return r;
+#endif
+    }
+
+    friend SimdFloat operator*(SimdFloat a, SimdFloat b)
+    {
+#if FHN_SIMD_AVX
+        return _mm256_mul_ps(a.value, b.value);
+#elif FHN_SIMD_SSE
+        return _mm_mul_ps(a.value, b.value);
+#elif FHN_SIMD_NEON
+        return vmulq_f32(a.value, b.value);
+#else
+        Register r;
+        for (int i = 0; i < width; i++) r.lane[i] = a.value.lane[i] * b.value.lane[i];
+        return r;
+#endif
+    }
+
+    friend SimdFloat operator/(SimdFloat a, SimdFloat b)
+    {
+#if FHN_SIMD_AVX
+        return _mm256_div_ps(a.value, b.value);
+#elif FHN_SIMD_SSE
+        return _mm_div_ps(a.value, b.value);
+#elif FHN_SIMD_NEON && defined(__aarch64__)
+        return vdivq_f32(a.value, b.value);
+#else
+        float x[width], y[width];
+        a.store(x);
+        b.store(y);
+        for (int i = 0; i < width; i++) x[i] /= y[i];
+        return load(x);
+#endif
+    }
+
+    SimdFloat operator-() const                 { return SimdFloat(0.0f) - *this; }
+    SimdFloat& operator+=(SimdFloat b)          { return *this = *this + b; }
+    SimdFloat& operator-=(SimdFloat b)          { return *this = *this - b; }
+    SimdFloat& operator*=(SimdFloat b)          { return *this = *this * b; }
+};
+
+//==============================================================================
+// min / max overloads so templated kernels can clamp floats and registers alike
+
+inline float simdMin(float a, float b)          { return std::min(a, b); }
+inline float simdMax(float a, float b)          { return std::max(a, b); }
+
+inline SimdFloat simdMin(SimdFloat a, SimdFloat b)
+{
+#if FHN_SIMD_AVX
+    return _mm256_min_ps(a.value, b.value);
+#elif FHN_SIMD_SSE
+    return _mm_min_ps(a.value, b.value);
+#elif FHN_SIMD_NEON
+    return vminq_f32(a.value, b.value);
+#else
+    SimdFloat::Register r;
+    for (int i = 0; i < SimdFloat::width; i++) r.lane[i] = std::min(a.value.lane[i], b.value.lane[i]);
+    return r;
+#endif
+}
+
+inline SimdFloat simdMax(SimdFloat a, SimdFloat b)
+{
+#if FHN_SIMD_AVX
+    return _mm256_max_ps(a.value, b.value);
+#elif FHN_SIMD_SSE
+    return _mm_max_ps(a.value, b.value);
+#elif FHN_SIMD_NEON
+    return vmaxq_f32(a.value, b.value);
+#else
+    SimdFloat::Register r;
+    for (int i = 0; i < SimdFloat::width; i++) r.lane[i] = std::max(a.value.lane[i], b.value.lane[i]);
+    return r;
+#endif
+}
+
+/**
+ x limited to [low, high], with NaN passed through unchanged on every path
+
+ simdMin() and simdMax() follow the instruction set when a lane is NaN, and
+ minps / maxps return their second operand, so each is given x last here.
+ */
+inline float simdClamp(float x, float low, float high)
+{
+    return x < low ? low : (x > high ? high : x);
+}
+
+inline SimdFloat simdClamp(SimdFloat x, SimdFloat low, SimdFloat high)
+{
+#if FHN_SIMD_AVX
+    return _mm256_max_ps(low.value, _mm256_min_ps(high.value, x.value));
+#elif FHN_SIMD_SSE
+    return _mm_max_ps(low.value, _mm_min_ps(high.value, x.value));
+#elif FHN_SIMD_NEON
+    return vmaxq_f32(low.value, vminq_f32(high.value, x.value));
+#else
+    SimdFloat::Register r;
+    for (int i = 0; i < SimdFloat::width; i++) r.lane[i] = simdClamp(x.value.lane[i], low.value.lane[i], high.value.lane[i]);
+    return r;
+#endif
+}
+
+//==============================================================================
+// helpers for the approximations in FastMath.h, again with float overloads
+
+/// largest integer not above x, in every lane; the SSE2 version needs |x| < 2^31
+inline float simdFloor(float x)                 { return std::floor(x); }
+
+inline SimdFloat simdFloor(SimdFloat x)
+{
+#if FHN_SIMD_AVX
+    return _mm256_floor_ps(x.value);
+#elif FHN_SIMD_SSE
+    // truncate towards zero, then step down the lanes where that rounded up
+    const __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(x.value));
+    return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, x.value), _mm_set1_ps(1.0f)));
+#elif FHN_SIMD_NEON && defined(__aarch64__)
+    return vrndmq_f32(x.value);
+#else
+    float lanes[SimdFloat::width];
+    x.store(lanes);
+    for (auto& l : lanes) l = std::floor(l);
+    return SimdFloat::load(lanes);
+#endif
+}
+
+/// 2^n for integral n in [-126, 127], built directly from the exponent bits
+inline float simdExp2Integer(float n)
+{
+    const auto bits = static_cast<std::uint32_t>(static_cast<std::int32_t>(n) + 127) << 23;
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+inline SimdFloat simdExp2Integer(SimdFloat n)
+{
+#if FHN_SIMD_AVX && defined(__AVX2__)
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n.value), _mm256_set1_epi32(127)), 23));
+#elif FHN_SIMD_AVX
+    // AVX without AVX2 has no 256 bit integer ops, do each half with SSE2
+    const auto half = [](__m128 h) { return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(h), _mm_set1_epi32(127)), 23)); };
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(half(_mm256_castps256_ps128(n.value))),
+                                half(_mm256_extractf128_ps(n.value, 1)), 1);
+#elif FHN_SIMD_SSE
+    return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n.value), _mm_set1_epi32(127)), 23));
+#elif FHN_SIMD_NEON
+    return vreinterpretq_f32_s32(vshlq_n_s32(vaddq_s32(vcvtq_s32_f32(n.value), vdupq_n_s32(127)), 23));
+#else
+    float lanes[SimdFloat::width];
+    n.store(lanes);
+    for (auto& l : lanes) l = simdExp2Integer(l);
+    return SimdFloat::load(lanes);
+#endif
+}
+
+#endif /* SimdFloat.h */
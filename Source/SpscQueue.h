@@ -0,0 +1,85 @@
+/*
+  ==============================================================================
+
+    SpscQueue.h
+    Created: 15 Oct 2023 10:21:09am
+    Author:  Jeremy Bai
+
+  ==============================================================================
+*/
+
+#ifndef Spsc_Queue_h
+#define Spsc_Queue_h
+
+#include <JuceHeader.h>
+#include <array>
+#include <atomic>
+
+/**
+ Fixed size single producer, single consumer queue for passing data off the audio thread
+
+ The audio thread push()es and one reader, usually the editor on the message
+ thread, pop()s. Each side only writes its own index and reads the other's,
+ so neither ever waits, locks or allocates, and push() costs a copy and two
+ atomic operations. If the reader falls behind, for example while the editor
+ is closed, new items are dropped and counted rather than overwriting ones
+ being read.
+
+ @tparam Item trivially copyable record type
+ @tparam capacity number of slots, a power of two
+ */
+template <typename Item, int capacity>
+class SpscQueue
+{
+public:
+    /// producer only, returns false if the queue was full and the item dropped
+    bool push(const Item& item)
+    {
+        const auto write = writeIndex.load(std::memory_order_relaxed);
+
+        if (write - readIndex.load(std::memory_order_acquire) >= static_cast<juce::uint32>(capacity))
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        items[write & mask] = item;
+        writeIndex.store(write + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// consumer only, returns false if there is nothing new
+    bool pop(Item& item)
+    {
+        const auto read = readIndex.load(std::memory_order_relaxed);
+
+        if (read == writeIndex.load(std::memory_order_acquire))
+            return false;
+
+        item = items[read & mask];
+        readIndex.store(read + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// consumer only, forget everything queued so far, e.g. stale items from before the editor opened
+    void discard()
+    {
+        readIndex.store(writeIndex.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    /// items lost because the reader was not keeping up
+    int getNumDropped() const
+    {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr juce::uint32 mask = capacity - 1;
+    static_assert(capacity > 0 && (capacity & mask) == 0, "capacity must be a power of two");
+
+    std::array<Item, capacity> items;
+    std::atomic<juce::uint32> writeIndex { 0 }, readIndex { 0 };
+    std::atomic<int> dropped { 0 };
+};
+
+#endif /* SpscQueue.h */
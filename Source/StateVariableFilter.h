@@ -0,0 +1,179 @@
+/*
+  ==============================================================================
+
+    StateVariableFilter.h
+    Created: 10 Oct 2023 9:26:51am
+    Author:  Jeremy Bai
+
+  ==============================================================================
+*/
+
+#ifndef State_Variable_Filter_h
+#define State_Variable_Filter_h
+
+#include <JuceHeader.h>
+#include <cmath>
+#include "SimdFloat.h"
+#include "Modulation.h"
+
+/// response selected by the filterType parameter, in its order
+enum class FilterType
+{
+    lowPass,
+    highPass,
+    bandPass
+};
+
+/**
+ One sample of a topology-preserving (trapezoidal) state variable filter
+
+ g = tan(pi * cutoff / sampleRate) and k = 1 / Q are used directly, so they
+ can change on every sample without the filter blowing up or clicking, which
+ is what makes per-sample cutoff modulation cheap compared to recomputing
+ biquad coefficients. Unmodulated, the low-pass, high-pass and band-pass
+ outputs match the bilinear transform biquads of juce::IIRCoefficients.
+
+ Written as a template like the kernels in FHNIntegrators.h, so it also runs
+ several filters at once in the lanes of a SimdFloat.
+
+ @param x input sample
+ @param g, k frequency and damping coefficients
+ @param s1, s2 filter state, updated in place
+ @param low, band receive the low-pass and band-pass outputs, high-pass is x - k * band - low
+ */
+template <typename T>
+inline void svfTick(T x, T g, T k, T& s1, T& s2, T& low, T& band)
+{
+    const T a1 = T(1.0f) / (T(1.0f) + g * (g + k));
+    const T a2 = g * a1;
+    const T a3 = g * a2;
+
+    const T v3 = x - s2;
+    band = a1 * s1 + a2 * v3;
+    low = s2 + a2 * s1 + a3 * v3;
+
+    s1 = T(2.0f) * band - s1;
+    s2 = T(2.0f) * low - s2;
+}
+
+//==============================================================================
+/**
+ Per voice filter stage: a state variable filter on the left and right solver outputs
+
+ The two channels share their coefficients and run as lanes 0 and 1 of a
+ SimdFloat, so a stereo sample costs the same as a mono one. Cutoff and Q are
+ set at control rate with setTarget() and g and k are ramped linearly per
+ sample in process(), so modulation such as key tracking or an envelope
+ costs one tan() per control interval. The dry/wet strength is folded into
+ the output mix, which is ramped as well when the strength or type changes.
+ */
+class StereoFilter
+{
+public:
+    void setSampleRate(double newRate)
+    {
+        sampleRate = newRate;
+    }
+
+    void setType(FilterType newType)
+    {
+        type = newType;
+    }
+
+    /// clear the filter state, e.g. at the end of a note
+    void reset()
+    {
+        s1 = s2 = SimdFloat(0.0f);
+    }
+
+    /// move to cutoff (Hz) and q at once, with no ramp
+    void jumpTo(float cutoff, float q)
+    {
+        gRamp.reset(frequencyCoefficient(cutoff));
+        kRamp.reset(1.0f / q);
+    }
+
+    /**
+     Ramp to cutoff (Hz) and q over the next numSamples samples
+
+     @param numSamples length of the next process() call, at most maxControlInterval
+     */
+    void setTarget(float cutoff, float q, int numSamples)
+    {
+        jassert(numSamples <= maxControlInterval);
+        gRamp.setTarget(frequencyCoefficient(cutoff), numSamples);
+        kRamp.setTarget(1.0f / q, numSamples);
+    }
+
+    /**
+     Filter a segment of both channels in place
+
+     @param strength 0 leaves the input unchanged, 1 is the filter output alone
+     @param numSamples must be the length given to the last setTarget()
+     */
+    void process(float* left, float* right, int numSamples, float strength)
+    {
+        gRamp.fill(gBuffer, numSamples);
+        kRamp.fill(kBuffer, numSamples);
+
+        // every response is a mix of x, k * band and low, since high = x - k * band - low
+        float target[numMixes] = { 1.0f - strength, 0.0f, 0.0f };
+
+        switch (type)
+        {
+            case FilterType::lowPass:   target[lowMix] = strength; break;
+            case FilterType::highPass:  target[inputMix] += strength; target[bandMix] = target[lowMix] = -strength; break;
+            case FilterType::bandPass:  target[bandMix] = strength; break;
+        }
+
+        // a new type or strength is faded in over the segment, switching the mix at once would click
+        SimdFloat gains[numMixes], steps[numMixes];
+        for (int m = 0; m < numMixes; m++)
+        {
+            steps[m] = SimdFloat((target[m] - mix[m]) / numSamples);
+            gains[m] = SimdFloat(mix[m]);
+            mix[m] = target[m];
+        }
+
+        float lanes[SimdFloat::width] = {};
+
+        for (int i = 0; i < numSamples; i++)
+        {
+            const SimdFloat g(gBuffer[i]), k(kBuffer[i]);
+
+            for (int m = 0; m < numMixes; m++)
+                gains[m] += steps[m];
+
+            lanes[0] = left[i];
+            lanes[1] = right[i];
+            const auto x = SimdFloat::load(lanes);
+
+            SimdFloat low, band;
+            svfTick(x, g, k, s1, s2, low, band);
+
+            (gains[inputMix] * x + gains[bandMix] * k * band + gains[lowMix] * low).store(lanes);
+            left[i] = lanes[0];
+            right[i] = lanes[1];
+        }
+    }
+
+private:
+    /// g for a cutoff in Hz, kept below Nyquist where tan() runs off to infinity
+    float frequencyCoefficient(float cutoff) const
+    {
+        const double limited = juce::jlimit(1.0, 0.49 * sampleRate, static_cast<double>(cutoff));
+        return static_cast<float>(std::tan(juce::MathConstants<double>::pi * limited / sampleRate));
+    }
+
+    double sampleRate = 44100.0;
+    FilterType type = FilterType::lowPass;
+
+    enum { inputMix, bandMix, lowMix, numMixes };
+    float mix[numMixes] = { 1.0f, 0.0f, 0.0f };
+
+    SimdFloat s1 = SimdFloat(0.0f), s2 = SimdFloat(0.0f);
+    ControlRamp<RampShape::linear> gRamp, kRamp;
+    float gBuffer[maxControlInterval] = {}, kBuffer[maxControlInterval] = {};
+};
+
+#endif /* StateVariableFilter.h */
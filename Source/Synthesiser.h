@@ -15,6 +15,17 @@
 #include "Oscillator.h"
 #include "InputProcessor.h"
 #include "FHNSolver.h"
+#include "FHNSolverBank.h"
+#include "FHNNetwork.h"
+#include "Oversampling.h"
+#include "ParameterSnapshot.h"
+#include "Modulation.h"
+#include "VoiceRenderPool.h"
+#include "LimitCycle.h"
+#include "FastMath.h"
+#include "StateVariableFilter.h"
+#include "PhaseScope.h"
+#include "ModulationMatrix.h"
 
 class FHNSynthSound : public juce::SynthesiserSound
 {
@@ -23,6 +34,15 @@ public:
     bool appliesToChannel (int midiChannel) override      { return true; }
 };
 
+/// what the MIDI controllers say about one note, see FHNSynthesiser::getExpression()
+struct NoteExpression
+{
+    float bend = 0.0f;          // semitones
+    float pressure = 0.0f;      // 0..1
+    float timbre = 0.0f;        // 0..1, CC 74
+    float modWheel = 0.0f;      // 0..1
+};
+
 /*!
  @class FHNSynthVoice
  @abstract A synth voice that creates sounds utilising FHN solver.
@@ -36,101 +56,163 @@ public:
      Initialise voice and pass sample rate to oscillators and envelope
      
      @param sampleRate float type sample rate
+     @param maxBlockSize largest block the voice will be asked to render in one go
      */
-    FHNSynthVoice(float sampleRate)
-      : lfo(new SinOsc),
-        leftInput(new InputProcessor(sampleRate)),
-        rightInput(new InputProcessor(sampleRate)),
-        leftSolver(new FhnSolver(sampleRate)),
-        rightSolver(new FhnSolver(sampleRate))
+    FHNSynthVoice(float sampleRate, int maxBlockSize)
+      : lfo(std::make_unique<SinOsc>()),
+        leftInput(std::make_unique<InputProcessor>(sampleRate)),
+        rightInput(std::make_unique<InputProcessor>(sampleRate)),
+        leftSolver(std::make_unique<FhnSolver>(sampleRate)),
+        rightSolver(std::make_unique<FhnSolver>(sampleRate))
         
     {
         lfo->setSampleRate(sampleRate);
+        lfo2.setSampleRate(sampleRate);
+        lfo2.setFrequency(lfo2Freq);
         envelope.setSampleRate(sampleRate);
+        modEnvelope.setSampleRate(sampleRate);
+        
+        prepare(maxBlockSize);
+    }
+    
+    /**
+     Allocate all per block storage, the render methods never allocate
+     
+     Call from prepareToPlay, never while the voice is rendering.
+     
+     @param maxBlockSize largest block the voice will be asked to render in one go
+     */
+    void prepare(int maxBlockSize)
+    {
+        if (playing)
+            finishNote();
+        
+        blockSize = maxBlockSize;
+        network.prepare();
+        
+        envelopeBuffer.assign(blockSize, 0.0f);
+        pitchBuffer.assign(blockSize, 0.0f);
+        leftInputBuffer.assign(blockSize, 0.0f);
+        rightInputBuffer.assign(blockSize, 0.0f);
+        leftSolverBuffer.assign(blockSize, 0.0f);
+        rightSolverBuffer.assign(blockSize, 0.0f);
+        oversampler.prepare(blockSize);
+        leftCycle.prepare();
+        rightCycle.prepare();
+    }
+    
+    /**
+     Keep every sample rate dependent module in step with the host
+     
+     Called by juce::Synthesiser when the voice is added and whenever the playback rate changes.
+     */
+    void setCurrentPlaybackSampleRate(double newRate) override
+    {
+        juce::SynthesiserVoice::setCurrentPlaybackSampleRate(newRate);
+        
+        if (newRate <= 0)
+            return;
+        
+        lfo->setSampleRate(newRate);
+        lfo->setFrequency(lfoFreq);
+        lfo2.setSampleRate(newRate);
+        lfo2.setFrequency(lfo2Freq);
+        envelope.setSampleRate(newRate);
+        modEnvelope.setSampleRate(newRate);
+        updateExpressionSmoothing();
+        filter.setSampleRate(newRate);
+        leftInput->setSampleRate(newRate);
+        rightInput->setSampleRate(newRate);
+        updateSolverRate();
     }
 
     /**
-     Update synth parameters from parameter tree's current state, called per buffer
+     Update synth parameters from the shared per-block snapshot
+     
+     Plain values are copied every block, anything more expensive is only
+     redone for the parameter groups the snapshot reports as changed.
+     
+     @param snapshot parameters of the current block
+     @param everything apply every group, for a voice that skipped blocks while idle
     */
-    void updateParameters(juce::AudioProcessorValueTreeState& apvts)
+    void updateParameters(const ParameterSnapshot& snapshot, bool everything = false)
     {
+        const auto& params = snapshot.get();
+        const auto changed = [&snapshot, everything](juce::uint32 groups) { return everything || snapshot.hasChanged(groups); };
+        
         // update main params
-        directInput = *apvts.getRawParameterValue("directInput");
-        oscAmp = *apvts.getRawParameterValue("oscAmp");
-        noiseAmp = *apvts.getRawParameterValue("noiseAmp");
+        directInput = params.directInput;
+        oscAmp = params.oscAmp;
+        noiseAmp = params.noiseAmp;
+        timeScale = params.timeScale;
+        amp = params.amp;
         
-        modFreq = *apvts.getRawParameterValue("modFreq");
-        modAmp = *apvts.getRawParameterValue("modAmp");
+        // applied on the next note, see chooseOversampling()
+        maxOversampling = params.maxOversampling;
+        networkSize = params.networkSize;
         
-        pulseWidth = *apvts.getRawParameterValue("pulseWidth");
+        lfoFreq = params.lfoFreq;
+        lfoAmp = params.lfoAmp;
+        stereo = params.stereo;
+        detune = params.detune;
+        coupling = params.coupling;
+        strength = params.strength;
         
-        timeScale = *apvts.getRawParameterValue("timeScale");
+        if (changed(ParameterSnapshot::pitch))
+            lfo->setFrequency(lfoFreq);
         
-        amp = *apvts.getRawParameterValue("amp");
+        if (changed(ParameterSnapshot::solver))
+        {
+            leftSolver->setIntegrator(params.integrator);
+            rightSolver->setIntegrator(params.integrator);
+            network.setIntegrator(params.integrator);
+            network.setTopology(params.topology, coupling);
+        }
         
         // check input processor osc type change and update params
-        float newMainType = *apvts.getRawParameterValue("mainType");
-        float newModType = *apvts.getRawParameterValue("modType");
-        
-        if (mainType != newMainType)
+        if (changed(ParameterSnapshot::oscillatorType))
         {
-            mainType = newMainType;
-            leftInput->resetMainType(mainType);
-            rightInput->resetMainType(mainType);
+            if (mainType != params.mainType || everything)
+            {
+                mainType = params.mainType;
+                leftInput->resetMainType(mainType);
+                rightInput->resetMainType(mainType);
+            }
+            if (modType != params.modType || everything)
+            {
+                modType = params.modType;
+                leftInput->resetModType(modType);
+                rightInput->resetModType(modType);
+            }
         }
-        if (modType != newModType)
+        
+        // a new oscillator starts with the default pulse width, so pass it on after a type change too
+        if (changed(ParameterSnapshot::inputs | ParameterSnapshot::oscillatorType))
         {
-            modType = newModType;
-            leftInput->resetModType(modType);
-            rightInput->resetModType(modType);
+            leftInput->updateParam(params.oscAmp, params.modFreq, params.modAmp, params.noiseAmp, params.pulseWidth);
+            rightInput->updateParam(params.oscAmp, params.modFreq, params.modAmp, params.noiseAmp, params.pulseWidth);
+            leftInput->setNoiseColour(params.noiseColour);
+            rightInput->setNoiseColour(params.noiseColour);
         }
         
-        leftInput->updateParam(oscAmp, modFreq, modAmp, noiseAmp, pulseWidth);
-        rightInput->updateParam(oscAmp, modFreq, modAmp, noiseAmp, pulseWidth);
-        
-        lfoFreq = *apvts.getRawParameterValue("lfoFreq");
-        lfoAmp = *apvts.getRawParameterValue("lfoAmp");
-        lfo->setFrequency(lfoFreq);
-        
-        stereo = *apvts.getRawParameterValue("stereo");
-        detune = *apvts.getRawParameterValue("detune");
-        coupling = *apvts.getRawParameterValue("coupling");
+        // cutoff and Q are ramped to at control rate, see renderOutput()
+        if (changed(ParameterSnapshot::filter))
+        {
+            filter.setType(static_cast<FilterType>(params.filterType));
+            cutoff = params.cutoff;
+            resonance = params.resonance;
+            keytrack = params.keytrack;
+        }
         
-        // update filter
-        cutoff = *apvts.getRawParameterValue("cutoff");
-        resonance = *apvts.getRawParameterValue("resonance");
-        strength = *apvts.getRawParameterValue("strength");
+        if (changed(ParameterSnapshot::envelope))
+            envelope.setParameters(params.envelope);
         
-        filterType = *apvts.getRawParameterValue("filterType");
-        switch (static_cast<int>(filterType))
+        if (changed(ParameterSnapshot::modulation))
         {
-            case 0:
-                coeff = juce::IIRCoefficients::makeLowPass(getSampleRate(), cutoff, resonance);
-                leftFilter.setCoefficients(coeff);
-                rightFilter.setCoefficients(coeff);
-                break;
-            case 1:
-                coeff = juce::IIRCoefficients::makeHighPass(getSampleRate(), cutoff, resonance);
-                leftFilter.setCoefficients(coeff);
-                rightFilter.setCoefficients(coeff);
-                break;
-            case 2:
-                coeff = juce::IIRCoefficients::makeBandPass(getSampleRate(), cutoff, resonance);
-                leftFilter.setCoefficients(coeff);
-                rightFilter.setCoefficients(coeff);
-                break;
-            default:
-                leftFilter.makeInactive();
-                rightFilter.makeInactive();
-                break;
+            lfo2Freq = params.lfo2Freq;
+            lfo2.setFrequency(lfo2Freq);
+            modEnvelope.setParameters(params.modEnvelope);
         }
-        
-        // update ADSR
-        envelopeParam.attack = * apvts.getRawParameterValue("attack");
-        envelopeParam.decay = * apvts.getRawParameterValue("decay");;
-        envelopeParam.sustain = * apvts.getRawParameterValue("sustain");;
-        envelopeParam.release = * apvts.getRawParameterValue("release");;
-        envelope.setParameters(envelopeParam);
     }
 
     /**
@@ -147,9 +229,28 @@ public:
         ending = false;
 
         noteFrequency = juce::MidiMessage::getMidiNoteInHertz(midiNoteNumber);
+        pitchRamp.reset(noteFrequency);
+        filter.jumpTo(filterCutoff(noteFrequency), resonance);
+        fadeLength = fadeRemaining = 0;
+        fadeInLength = fadeInRemaining = 0;
+        
+        // more than two nodes replace the solver pair for the whole note
+        useNetwork = networkSize > 2;
+        if (useNetwork && network.getSize() != networkSize)
+            network.setSize(networkSize);
+        
+        oversampler.setFactor(chooseOversampling());
+        updateSolverRate();
         
         envelope.reset();
         envelope.noteOn();
+        
+        velocityValue = velocity;
+        keyValue = (midiNoteNumber - 60) / 12.0f;
+        notePressure = 0.0f;
+        expressionStarted = false;
+        modEnvelope.reset();
+        modEnvelope.noteOn();
     }
     
     /// Called when a MIDI noteOff message is received
@@ -162,6 +263,7 @@ public:
     void stopNote(float /*velocity*/, bool allowTailOff) override
     {
         envelope.noteOff();
+        modEnvelope.noteOff();
         ending = true;
     }
     
@@ -177,81 +279,508 @@ public:
      */
     void renderNextBlock(juce::AudioSampleBuffer& outputBuffer, int startSample, int numSamples) override
     {
-        if (playing) // check to see if this voice should be playing
+        while (playing && numSamples > 0)
+        {
+            auto numThisTime = juce::jmin(numSamples, blockSize);
+            
+            renderModulation(numThisTime);
+            if (modulation != nullptr)
+                modulation->processLane(getNumTicks(numThisTime), modulationLane);
+            
+            renderModulated(outputBuffer, startSample, numThisTime);
+            
+            startSample += numThisTime;
+            numSamples -= numThisTime;
+        }
+    }
+    
+    /**
+     Render a block whose modulation has already been evaluated, the rest of renderNextBlock()
+     
+     FHNSynthesiser runs renderModulation() for every voice and evaluates the
+     matrix for all of them at once before calling this.
+     
+     @param numSamples must not exceed maxBlockSize given to the constructor
+     */
+    void renderModulated(juce::AudioSampleBuffer& outputBuffer, int startSample, int numSamples)
+    {
+        renderInputs(numSamples);
+        renderSolvers();
+        renderOutput(outputBuffer, startSample);
+    }
+    
+    /**
+     Number of samples between evaluations of the LFO and other slow modulators
+     
+     @param numSamples clamped to 1..maxControlInterval
+     */
+    void setControlInterval(int numSamples)
+    {
+        controlInterval = juce::jlimit(1, maxControlInterval, numSamples);
+        updateExpressionSmoothing();
+    }
+    
+    /**
+     Restart the noise of both channels, so a render is the same every time
+     
+     @param seed the left channel uses seed and the right one seed + 1
+     */
+    void setNoiseSeed(std::uint64_t seed)
+    {
+        leftInput->setNoiseSeed(seed);
+        rightInput->setNoiseSeed(seed + 1);
+    }
+    
+    /// edges used when the topology parameter is set to custom, see FhnNetwork::setCustomEdges()
+    void setCustomNetwork(const std::vector<FhnNetwork::Edge>& edges)
+    {
+        network.setCustomEdges(edges);
+    }
+    
+    /// allow the solvers to be replaced by a captured limit cycle for static inputs, see LimitCycle
+    void setCycleCaching(bool shouldCache)
+    {
+        cycleCaching = shouldCache;
+    }
+    
+    /**
+     Lane of matrix that holds this voice's modulation, set by FHNSynthesiser::prepare()
+     
+     The lane stays the same for the voice's lifetime, while the matrix
+     changes for a crossfade tail, see FHNSynthesiser::beginCrossfades().
+     
+     @param matrix nullptr for no modulation, then every destination reads 0
+     */
+    void setModulation(ModulationMatrix* matrix, int lane)
+    {
+        modulation = matrix;
+        modulationLane = lane;
+    }
+    
+    int getModulationLane() const
+    {
+        return modulationLane;
+    }
+    
+    /// MIDI channel whose expression this voice follows, set by FHNSynthesiser::noteOn()
+    void setExpressionChannel(int midiChannel)
+    {
+        expressionChannel = midiChannel;
+    }
+    
+    int getExpressionChannel() const
+    {
+        return expressionChannel;
+    }
+    
+    /**
+     Latest expression of this voice's note, set by FHNSynthesiser before each render
+     
+     The voice glides to it at control rate in renderModulation(), from the
+     first value it is given after a note starts.
+     */
+    void setExpression(const NoteExpression& newExpression)
+    {
+        expressionTarget = newExpression;
+    }
+    
+    /// control ticks in a block of numSamples, the last one may be short
+    int getNumTicks(int numSamples) const
+    {
+        return (numSamples + controlInterval - 1) / controlInterval;
+    }
+    
+    /// publish this voice's solver state to tap while it is not null; set by FHNSynthesiser between blocks
+    void setScopeTap(ScopeTap* tap)
+    {
+        scopeTap = tap;
+    }
+    
+    /// true between startNote() and the end of the release
+    bool isPlaying() const
+    {
+        return playing;
+    }
+    
+    /// true once the note is released, before it has finished
+    bool isReleasing() const
+    {
+        return ending;
+    }
+    
+    /// envelope level at the end of the last rendered block
+    float getLevel() const
+    {
+        return level;
+    }
+    
+    /// called when the voice is stolen: fade out over seconds, then end the note
+    void fadeOut(double seconds = stealFadeSeconds)
+    {
+        if (fadeLength == 0)
+            fadeLength = fadeRemaining = juce::jmax(1, static_cast<int>(getSampleRate() * seconds));
+    }
+    
+    /// fade in over seconds, the mirror image of fadeOut(), for a voice taking over from a crossfade tail
+    void fadeIn(double seconds)
+    {
+        fadeInLength = fadeInRemaining = juce::jmax(1, static_cast<int>(getSampleRate() * seconds));
+    }
+    
+    /**
+     Carry on other's note from exactly where it is, then fade out over seconds
+     
+     Used to crossfade a playing voice to a new preset: this voice keeps
+     rendering the old one while other fades in on the new parameters, both
+     starting from the same solver, oscillator and filter state. Every module
+     is copied by value into this voice's own storage, which was sized by the
+     same prepare() call, so nothing is allocated. The copy plays no MIDI note
+     of its own and FHNSynthesiser does not update its parameters; it keeps
+     its own lane, which FHNSynthesiser moves to a matrix holding the old
+     preset's routes.
+     */
+    void continueFrom(const FHNSynthVoice& other, double seconds)
+    {
+        jassert(blockSize == other.blockSize);
+        
+        playing = other.playing;
+        ending = other.ending;
+        stereo = other.stereo;
+        envelope = other.envelope;
+        *lfo = *other.lfo;
+        lfo2 = other.lfo2;
+        modEnvelope = other.modEnvelope;
+        *leftInput = *other.leftInput;
+        *rightInput = *other.rightInput;
+        *leftSolver = *other.leftSolver;
+        *rightSolver = *other.rightSolver;
+        
+        directInput = other.directInput;
+        oscAmp = other.oscAmp;
+        noiseAmp = other.noiseAmp;
+        noteFrequency = other.noteFrequency;
+        detune = other.detune;
+        coupling = other.coupling;
+        lfoFreq = other.lfoFreq;
+        lfoAmp = other.lfoAmp;
+        mainType = other.mainType;
+        modType = other.modType;
+        timeScale = other.timeScale;
+        amp = other.amp;
+        level = other.level;
+        fadeInLength = other.fadeInLength;
+        fadeInRemaining = other.fadeInRemaining;
+        
+        lfo2Freq = other.lfo2Freq;
+        velocityValue = other.velocityValue;
+        keyValue = other.keyValue;
+        notePressure = other.notePressure;
+        expressionChannel = other.expressionChannel;
+        expression = other.expression;
+        expressionTarget = other.expressionTarget;
+        expressionSmoothing = other.expressionSmoothing;
+        expressionStarted = other.expressionStarted;
+        currentTimeScale = other.currentTimeScale;
+        currentDetune = other.currentDetune;
+        currentCoupling = other.currentCoupling;
+        currentDirectInput = other.currentDirectInput;
+        
+        controlInterval = other.controlInterval;
+        pitchRamp = other.pitchRamp;
+        maxOversampling = other.maxOversampling;
+        oversampler = other.oversampler;
+        networkSize = other.networkSize;
+        useNetwork = other.useNetwork;
+        network = other.network;
+        
+        cycleCaching = other.cycleCaching;
+        staticInput = other.staticInput;
+        capturingCycle = other.capturingCycle;
+        playingCycle = other.playingCycle;
+        leftCycle = other.leftCycle;
+        rightCycle = other.rightCycle;
+        
+        filter = other.filter;
+        cutoff = other.cutoff;
+        resonance = other.resonance;
+        keytrack = other.keytrack;
+        strength = other.strength;
+        
+        crossfadeTail = true;
+        fadeLength = 0;
+        fadeOut(seconds);
+    }
+    
+    /// true while rendering the old preset of a crossfade, see continueFrom()
+    bool isCrossfadeTail() const
+    {
+        return crossfadeTail;
+    }
+    
+    /// true while fading out after being stolen
+    bool isFading() const
+    {
+        return fadeLength > 0;
+    }
+    
+    /// end the note right away, without a release
+    void cutNote()
+    {
+        if (playing)
+            finishNote();
+    }
+    
+    /**
+     Modulation stage, before renderInputs(): the control rate modulators for the next numSamples samples
+     
+     The LFO and the note's pitch bend set the pitch once per control
+     interval, ramped exponentially in between, and every source of the
+     modulation matrix is written to this voice's lane at the end of each
+     interval, so that the matrix can be evaluated for all voices before any
+     of them reads its destinations.
+     
+     @param numSamples must not exceed maxBlockSize given to the constructor
+     */
+    void renderModulation(int numSamples)
+    {
+        jassert(numSamples <= blockSize);
+        
+        const bool modEnvelopeUsed = modulation != nullptr && modulation->isUsed(ModSource::modEnvelope);
+        
+        if (!expressionStarted)
+        {
+            expression = expressionTarget;
+            expressionStarted = true;
+        }
+        
+        // control rate: LFO and pitch once per interval, ramped exponentially in between
+        for (int start = 0, tick = 0; start < numSamples; start += controlInterval, tick++)
+        {
+            const int numThisTime = juce::jmin(controlInterval, numSamples - start);
+            const float lfoValue = lfo->advanceOscillator(numThisTime);
+            
+            smoothExpression();
+            pitchRamp.setTarget(noteFrequency * fastExp2(lfoValue * lfoAmp + expression.bend / 12.0f), numThisTime);
+            pitchRamp.fill(pitchBuffer.data() + start, numThisTime);
+            
+            if (modulation == nullptr)
+                continue;
+            
+            // the envelope is the one source with a per sample cost, so it only runs while something reads it
+            float modEnvelopeValue = 0.0f;
+            if (modEnvelopeUsed)
+                for (int i = 0; i < numThisTime; i++)
+                    modEnvelopeValue = modEnvelope.getNextSample();
+            
+            modulation->setSource(ModSource::lfo1, tick, modulationLane, lfoValue);
+            modulation->setSource(ModSource::lfo2, tick, modulationLane, lfo2.advanceOscillator(numThisTime));
+            modulation->setSource(ModSource::modEnvelope, tick, modulationLane, modEnvelopeValue);
+            modulation->setSource(ModSource::velocity, tick, modulationLane, velocityValue);
+            modulation->setSource(ModSource::key, tick, modulationLane, keyValue);
+            modulation->setSource(ModSource::modWheel, tick, modulationLane, expression.modWheel);
+            modulation->setSource(ModSource::aftertouch, tick, modulationLane, juce::jmax(expression.pressure, notePressure));
+            modulation->setSource(ModSource::timbre, tick, modulationLane, expression.timbre);
+            modulation->setSource(ModSource::pitchBend, tick, modulationLane, expression.bend / 12.0f);
+        }
+    }
+    
+    /**
+     First render stage: envelope and solver inputs for the next numSamples samples
+     
+     Also finds the sample on which the release finishes, so the later stages
+     only process the part of the block that is actually heard. Reads the
+     pitch and modulation written by renderModulation().
+     
+     @param numSamples must not exceed maxBlockSize given to the constructor
+     */
+    void renderInputs(int numSamples)
+    {
+        jassert(numSamples <= blockSize);
+        
+        if (scopeTap != nullptr)
+            scopeStart = leftSolver->getState();
+        
+        numActiveSamples = numSamples;
+        noteFinished = false;
+        
+        // audio rate: envelope first, it decides how much of the block is heard
+        for (int i = 0; i < numSamples; i++)
         {
-            // iterate through the necessary number of samples (from startSample up to startSample + numSamples)
-            for (int sampleIndex = startSample;   sampleIndex < (numSamples);   sampleIndex++)
+            float envelopeVal = envelope.getNextSample();
+            envelopeBuffer[i] = envelopeVal;
+            
+            if (ending && envelopeVal < 0.00001f)
             {
-
-                // get envelope sample
-                float envelopeVal = envelope.getNextSample();
-
-                lfo->setFrequency(lfoFreq);
-                auto leftFrequency = noteFrequency * std::pow(2, lfo->processOscillator() * lfoAmp);
-                auto rightFrequency = leftFrequency + detune;
-                
-                auto left = leftInput->processInput(directInput, leftFrequency);
-                auto right = rightInput->processInput(directInput, rightFrequency);
-
-                auto k1 = noteFrequency / 0.01615f * timeScale;
-                auto k2 = (noteFrequency + detune) / 0.01615f * timeScale;
-                
-                leftSolver->setTemporalScale(k1);
-                rightSolver->setTemporalScale(k2);
-                
-                auto currentDiff = leftSolver->getCurrentState() - rightSolver->getCurrentState();
-                
-                auto leftSample = leftSolver->processSystem(left - coupling * currentDiff);
-                auto rightSample = rightSolver->processSystem(right + coupling * currentDiff);
-                
-                auto filteredLeft = leftFilter.processSingleSampleRaw(leftSample);
-                auto filteredRight = rightFilter.processSingleSampleRaw(rightSample);
-                
-                auto leftOutput = leftSample * (1 - strength) + filteredLeft * strength;
-                auto rightOutput = rightSample * (1 - strength) + filteredRight * strength;
-                
-                if (!stereo)
+                numActiveSamples = i + 1;
+                noteFinished = true;
+                break;
+            }
+        }
+        
+        // stolen voice: a short linear fade on top of the envelope, then the note ends
+        if (fadeLength > 0)
+        {
+            for (int i = 0; i < numActiveSamples; i++)
+            {
+                if (fadeRemaining <= 0)
                 {
-                    leftOutput = (leftOutput + rightOutput) / 2.0f;
-                    rightOutput = leftOutput;
+                    numActiveSamples = i;
+                    noteFinished = true;
+                    break;
                 }
                 
-                // for each channel, write the currentSample float to the output
-                for (int chan = 0; chan < outputBuffer.getNumChannels(); chan++)
-                {
-                    // The output sample is scaled by 0.2 so that it is not too loud by default
-                    if (chan % 2 == 0)
-                        outputBuffer.addSample (chan, sampleIndex, leftOutput * envelopeVal * amp * 0.5);
-                    if (chan % 2 == 1)
-                        outputBuffer.addSample (chan, sampleIndex, rightOutput * envelopeVal * amp * 0.5);
-                }
-
-                if (ending)
-                {
-                    if (envelopeVal < 0.00001f)
-                    {
-                        clearCurrentNote();
-                        playing = false;
-
-                        // reset oscillators to avoid clipping when starting next note
-                        lfo->resetPhase();
-                        leftInput->resetPhase();
-                        rightInput->resetPhase();
-                        leftSolver->setCurrentState(0, 0);
-                        rightSolver->setCurrentState(0, 0);
-                        
-                        leftFilter.reset();
-                        rightFilter.reset();
-                    }
-                }
+                envelopeBuffer[i] *= static_cast<float>(--fadeRemaining) / fadeLength;
+            }
+        }
+        
+        // taking over from a crossfade tail, whose fade out leaves exactly the rest of the gain
+        for (int i = 0; i < numActiveSamples && fadeInRemaining > 0; i++)
+            envelopeBuffer[i] *= 1.0f - static_cast<float>(--fadeInRemaining) / fadeInLength;
+        
+        if (numActiveSamples > 0)
+            level = envelopeBuffer[numActiveSamples - 1];
+        
+        applyModulation();
+        
+        // the solver bank steps a whole block with fixed coefficients, so the time scale is updated per block
+        auto k1 = noteFrequency / 0.01615f * currentTimeScale;
+        auto k2 = (noteFrequency + currentDetune) / 0.01615f * currentTimeScale;
+        
+        leftSolver->setTemporalScale(k1);
+        rightSolver->setTemporalScale(k2);
+        
+        if (useNetwork)
+            network.setTemporalScale(k1, k2);
+        
+        // a captured cycle stands in for the inputs and solvers
+        if (updateLimitCycles())
+            return;
+        
+        leftInput->processBlock(currentDirectInput, pitchBuffer.data(), 0.0f, leftInputBuffer.data(), numActiveSamples);
+        rightInput->processBlock(currentDirectInput, pitchBuffer.data(), currentDetune, rightInputBuffer.data(), numActiveSamples);
+        
+        if (oversampler.getFactor() > 1)
+        {
+            oversampler.upsample(0, leftInputBuffer.data(), numActiveSamples);
+            oversampler.upsample(1, rightInputBuffer.data(), numActiveSamples);
+        }
+    }
+    
+    /// solver rate multiple for the current note, 1 when not oversampling
+    int getOversamplingFactor() const
+    {
+        return oversampler.getFactor();
+    }
+    
+    /**
+     Second render stage, batched: hand the solver pair to the bank instead of stepping it here
+     
+     @return false if the bank is full and renderSolvers() must be called instead
+     */
+    bool addToBank(FhnSolverBank& bank)
+    {
+        // a crossfade tail may still be on the old preset's integrator, which the bank no longer runs
+        if (playingCycle || useNetwork || crossfadeTail)
+        {
+            renderSolvers();
+            return true;
+        }
+        
+        return bank.addPair(*leftSolver, *rightSolver, currentCoupling,
+                            solverInput(0), solverInput(1), solverOutput(0), solverOutput(1));
+    }
+    
+    /// Second render stage, unbatched: step the coupled solver pair over the active samples
+    void renderSolvers()
+    {
+        if (playingCycle)
+        {
+            leftCycle.play(solverOutput(0), numActiveSamples * oversampler.getFactor());
+            rightCycle.play(solverOutput(1), numActiveSamples * oversampler.getFactor());
+            return;
+        }
+        
+        if (useNetwork)
+        {
+            network.process(solverInput(0), solverInput(1), solverOutput(0), solverOutput(1),
+                            numActiveSamples * oversampler.getFactor());
+            return;
+        }
+        
+        FhnSolver::processCoupledBlock(*leftSolver, *rightSolver, currentCoupling,
+                                       solverInput(0), solverInput(1), solverOutput(0), solverOutput(1),
+                                       numActiveSamples * oversampler.getFactor());
+    }
+    
+    /**
+     Last render stage: filter, stereo mix and envelope, added into the output buffer
+     
+     @param outputBuffer buffer to add into
+     @param startSample position in outputBuffer of the first sample passed to renderInputs()
+     */
+    void renderOutput(juce::AudioSampleBuffer& outputBuffer, int startSample)
+    {
+        // network voices mix several nodes into the output, which is no single solver's v
+        if (scopeTap != nullptr && !useNetwork)
+            scopeTap->publish(solverOutput(0), numActiveSamples * oversampler.getFactor(), oversampler.getFactor(),
+                              leftSolver->getCoefficients(), playingCycle ? nullptr : &scopeStart);
+        
+        if (capturingCycle)
+        {
+            leftCycle.capture(solverOutput(0), numActiveSamples * oversampler.getFactor());
+            rightCycle.capture(solverOutput(1), numActiveSamples * oversampler.getFactor());
+            
+            // both channels must have settled, with detune they have cycles of their own
+            playingCycle = leftCycle.isReady() && rightCycle.isReady();
+            capturingCycle = !playingCycle;
+        }
+        
+        if (oversampler.getFactor() > 1)
+        {
+            oversampler.downsample(0, leftSolverBuffer.data(), numActiveSamples);
+            oversampler.downsample(1, rightSolverBuffer.data(), numActiveSamples);
+        }
+        
+        renderFilter();
+        
+        for (int i = 0; i < numActiveSamples; i++)
+        {
+            auto leftOutput = leftSolverBuffer[i];
+            auto rightOutput = rightSolverBuffer[i];
+            
+            if (!stereo)
+            {
+                leftOutput = (leftOutput + rightOutput) / 2.0f;
+                rightOutput = leftOutput;
+            }
+            
+            auto envelopeVal = envelopeBuffer[i];
+            
+            // for each channel, write the currentSample float to the output
+            for (int chan = 0; chan < outputBuffer.getNumChannels(); chan++)
+            {
+                // The output sample is scaled by 0.2 so that it is not too loud by default
+                if (chan % 2 == 0)
+                    outputBuffer.addSample (chan, startSample + i, leftOutput * envelopeVal * amp * 0.5);
+                if (chan % 2 == 1)
+                    outputBuffer.addSample (chan, startSample + i, rightOutput * envelopeVal * amp * 0.5);
             }
         }
+        
+        if (noteFinished)
+            finishNote();
     }
     
     void pitchWheelMoved(int) override {}
 
     void controllerMoved(int, int) override {}
     
+    /// polyphonic aftertouch of this voice's note, read together with its channel's pressure
+    void aftertouchChanged(int newValue) override
+    {
+        notePressure = newValue / 127.0f;
+    }
+    
     /**
      Can this voice play a sound.
 
@@ -264,33 +793,1071 @@ public:
     }
     //--------------------------------------------------------------------------
 private:
-    //--------------------------------------------------------------------------
-    // Set up any necessary variables here
+    /**
+     Oversampling factor for a new note, up to the preset's limit
+     
+     The FHN output is treated as band-limited to about oversamplingHarmonics
+     harmonics of noteFrequency * timeScale (around -60 dB for typical
+     settings), and the solver rate is doubled until that fits under Nyquist.
+     */
+    int chooseOversampling() const
+    {
+        const double bandwidth = noteFrequency * timeScale * oversamplingHarmonics;
+        int factor = 1;
+        
+        while (factor < maxOversampling && bandwidth > getSampleRate() * factor * 0.5)
+            factor *= 2;
+        
+        return factor;
+    }
     
-    bool playing = false;
-    bool ending = false;
-    bool stereo = false;
-
-    juce::ADSR envelope;
-    juce::ADSR::Parameters envelopeParam;
-
-    // main oscillators and modules
-    SinOsc* lfo;
-    InputProcessor* leftInput, * rightInput;
-    FhnSolver* leftSolver, * rightSolver;
+    /// solvers run at the host rate times the oversampling factor
+    void updateSolverRate()
+    {
+        const auto rate = static_cast<float>(getSampleRate()) * oversampler.getFactor();
+        
+        if (rate > 0)
+        {
+            leftSolver->setDt(1.0f / rate);
+            rightSolver->setDt(1.0f / rate);
+            network.setDt(1.0f / rate);
+        }
+    }
+    
+    /// end the note and reset every module, so the next note starts from silence
+    void finishNote()
+    {
+        clearCurrentNote();
+        playing = false;
+        noteFinished = false;
+        fadeLength = fadeRemaining = 0;
+        fadeInLength = fadeInRemaining = 0;
+        crossfadeTail = false;
+        level = 0.0f;
+        
+        // reset oscillators to avoid clipping when starting next note
+        lfo->resetPhase();
+        lfo2.resetPhase();
+        modEnvelope.reset();
+        leftInput->resetPhase();
+        rightInput->resetPhase();
+        leftSolver->setCurrentState(0, 0);
+        rightSolver->setCurrentState(0, 0);
+        network.reset();
+        
+        filter.reset();
+        
+        leftCycle.reset({});
+        rightCycle.reset({});
+        playingCycle = capturingCycle = false;
+    }
+    
+    /**
+     Decide once per block whether the captured limit cycles can replace the solvers
+     
+     The input must be the direct input alone with a steady pitch, the voice
+     must be running the solver pair rather than a network, and the channels
+     must either be identical (no detune) or independent (no coupling),
+     otherwise the stereo pair is not periodic. As soon as any of
+     that changes, or the solver settings the cycles were captured with, the
+     solvers take over again from the state the cycles had reached.
+     
+     @return true if this block is played from the cycles
+     */
+    bool updateLimitCycles()
+    {
+        const bool steady = cycleCaching && staticInput && !useNetwork && lfoAmp == 0.0f
+                            && (currentCoupling == 0.0f || currentDetune == 0.0f);
+        const auto leftKey = LimitCycle::Key::of(*leftSolver, currentDirectInput);
+        const auto rightKey = LimitCycle::Key::of(*rightSolver, currentDirectInput);
+        
+        if (steady && leftKey == leftCycle.getKey() && rightKey == rightCycle.getKey())
+        {
+            capturingCycle = !playingCycle;
+            return playingCycle;
+        }
+        
+        if (playingCycle)
+        {
+            auto left = leftCycle.getResumeState();
+            auto right = rightCycle.getResumeState();
+            leftSolver->setCurrentState(left.v, left.w);
+            rightSolver->setCurrentState(right.v, right.w);
+        }
+        
+        leftCycle.reset(leftKey);
+        rightCycle.reset(rightKey);
+        playingCycle = false;
+        capturingCycle = steady;
+        return false;
+    }
+    
+    /**
+     Filter the downsampled solver outputs in place, with the cutoff following the pitch at control rate
+     
+     With strength at 0 the output would be the dry signal, so the filter is
+     skipped and restarts from silence when it is turned up again.
+     */
+    void renderFilter()
+    {
+        if (strength <= 0.0f)
+        {
+            filter.reset();
+            filter.jumpTo(filterCutoff(pitchRamp.getTarget()), resonance);
+            return;
+        }
+        
+        const bool modulated = modulates(ModDestination::cutoff);
+        
+        for (int start = 0, tick = 0; start < numActiveSamples; start += controlInterval, tick++)
+        {
+            const int numThisTime = juce::jmin(controlInterval, numActiveSamples - start);
+            float tickCutoff = filterCutoff(pitchBuffer[start + numThisTime - 1]);
+            
+            if (modulated)
+                tickCutoff *= fastExp2(modulationValue(ModDestination::cutoff, tick));
+            
+            filter.setTarget(tickCutoff, resonance, numThisTime);
+            filter.process(leftSolverBuffer.data() + start, rightSolverBuffer.data() + start, numThisTime, strength);
+        }
+    }
+    
+    /**
+     Apply the block rate destinations of the modulation matrix, read at the block's first control tick
+     
+     Like the time scale these feed the solvers, which the bank steps a whole
+     block at a time with fixed coefficients. The cutoff follows every tick,
+     see renderFilter(). With nothing routed the values are the parameters.
+     */
+    void applyModulation()
+    {
+        const float mainLevel = juce::jmax(0.0f, oscAmp + modulationValue(ModDestination::oscAmp, 0));
+        const float noiseLevel = juce::jmax(0.0f, noiseAmp + modulationValue(ModDestination::noiseAmp, 0));
+        
+        currentTimeScale = timeScale;
+        if (modulates(ModDestination::timeScale))
+            currentTimeScale *= fastExp2(modulationValue(ModDestination::timeScale, 0));
+        
+        currentDetune = detune + modulationValue(ModDestination::detune, 0);
+        currentCoupling = juce::jlimit(0.0f, 1.0f, coupling + modulationValue(ModDestination::coupling, 0));
+        currentDirectInput = directInput + modulationValue(ModDestination::directInput, 0);
+        
+        // with nothing but the direct input driving the solvers they settle on a limit cycle
+        staticInput = mainLevel == 0.0f && noiseLevel == 0.0f;
+        
+        leftInput->setLevels(mainLevel, noiseLevel);
+        rightInput->setLevels(mainLevel, noiseLevel);
+        
+        // b and c stay positive, the system diverges otherwise
+        const float a = FhnSolver::defaultA + modulationValue(ModDestination::fhnA, 0);
+        const float b = juce::jmax(0.0f, FhnSolver::defaultB + modulationValue(ModDestination::fhnB, 0));
+        const float c = juce::jmax(0.001f, FhnSolver::defaultC + modulationValue(ModDestination::fhnC, 0));
+        
+        leftSolver->setParameter(a, b, c);
+        rightSolver->setParameter(a, b, c);
+        
+        if (useNetwork)
+        {
+            network.setParameter(a, b, c);
+            network.setCoupling(currentCoupling);
+        }
+    }
+    
+    /// one control tick of the glide towards the latest expression, so stepped MIDI values do not zipper
+    void smoothExpression()
+    {
+        expression.bend += (expressionTarget.bend - expression.bend) * expressionSmoothing;
+        expression.pressure += (expressionTarget.pressure - expression.pressure) * expressionSmoothing;
+        expression.timbre += (expressionTarget.timbre - expression.timbre) * expressionSmoothing;
+        expression.modWheel += (expressionTarget.modWheel - expression.modWheel) * expressionSmoothing;
+    }
+    
+    /// one pole coefficient per control tick for a time constant of expressionSeconds
+    void updateExpressionSmoothing()
+    {
+        if (getSampleRate() > 0)
+            expressionSmoothing = 1.0f - std::exp(static_cast<float>(-controlInterval / (expressionSeconds * getSampleRate())));
+    }
+    
+    bool modulates(ModDestination destination) const
+    {
+        return modulation != nullptr && modulation->isRouted(destination);
+    }
+    
+    /// this voice's sum of the routes into destination, 0 when nothing is routed there
+    float modulationValue(ModDestination destination, int tick) const
+    {
+        return modulates(destination) ? modulation->getDestination(destination, tick, modulationLane) : 0.0f;
+    }
+    
+    /// cutoff moved by keytrack octaves per octave of pitch away from middle C
+    float filterCutoff(float pitch) const
+    {
+        if (keytrack == 0.0f)
+            return cutoff;
+        
+        return cutoff * fastExp2(keytrack * fastLog2(pitch / keytrackCentre));
+    }
+    
+    float* solverInput(int channel)
+    {
+        if (oversampler.getFactor() > 1)
+            return oversampler.getInput(channel);
+        return channel == 0 ? leftInputBuffer.data() : rightInputBuffer.data();
+    }
+    
+    float* solverOutput(int channel)
+    {
+        if (oversampler.getFactor() > 1)
+            return oversampler.getOutput(channel);
+        return channel == 0 ? leftSolverBuffer.data() : rightSolverBuffer.data();
+    }
+    
+    //--------------------------------------------------------------------------
+    // Set up any necessary variables here
+    
+    bool playing = false;
+    bool ending = false;
+    bool stereo = false;
+
+    juce::ADSR envelope;
+
+    // main oscillators and modules
+    std::unique_ptr<SinOsc> lfo;
+    std::unique_ptr<InputProcessor> leftInput, rightInput;
+    std::unique_ptr<FhnSolver> leftSolver, rightSolver;
 
     // main params
-    float directInput, oscAmp, noiseAmp, modFreq, modAmp, pulseWidth;
-    float noteFrequency, detune, coupling, lfoFreq, lfoAmp;
-    float mainType{0}, modType{0};
-    float timeScale;
+    float directInput{0};
+    float oscAmp{1}, noiseAmp{0};
+    float noteFrequency{0}, detune{0}, coupling{0}, lfoFreq{0}, lfoAmp{0};
+    int mainType{0}, modType{0};
+    float timeScale{1};
     float amp{1};
     
-    // IIR filter
-    juce::IIRFilter leftFilter, rightFilter;
-    juce::IIRCoefficients coeff;
-    float cutoff, resonance, keytrack, strength, filterType;
+    // modulation matrix lane and sources, see renderModulation()
+    ModulationMatrix* modulation = nullptr;
+    int modulationLane = 0;
+    SinOsc lfo2;
+    juce::ADSR modEnvelope;
+    float lfo2Freq{1};
+    float velocityValue{0}, keyValue{0}, notePressure{0};
+    
+    // per note expression, smoothed at control rate, see setExpression()
+    static constexpr double expressionSeconds = 0.01;
+    int expressionChannel = 1;
+    NoteExpression expression, expressionTarget;
+    float expressionSmoothing = 1.0f;
+    bool expressionStarted = false;
+    
+    // the main params with this block's modulation applied, see applyModulation()
+    float currentTimeScale{1}, currentDetune{0}, currentCoupling{0}, currentDirectInput{0};
+    
+    // voice stealing and preset crossfades
+    static constexpr double stealFadeSeconds = 0.005;
+    int fadeLength = 0, fadeRemaining = 0;
+    int fadeInLength = 0, fadeInRemaining = 0;
+    bool crossfadeTail = false;
+    float level = 0.0f;
+    
+    // control rate modulation
+    int controlInterval = defaultControlInterval;
+    ControlRamp<RampShape::exponential> pitchRamp;
+    
+    // oversampling of the solver pair, chosen per note
+    static constexpr double oversamplingHarmonics = 24.0;
+    int maxOversampling = 1;
+    FhnOversampler oversampler;
+    
+    // N node network in place of the solver pair, chosen per note
+    int networkSize = 2;
+    bool useNetwork = false;
+    FhnNetwork network;
+    
+    // limit cycle playback for static inputs, see updateLimitCycles()
+    bool cycleCaching = true;
+    bool staticInput = false;
+    bool capturingCycle = false, playingCycle = false;
+    LimitCycle leftCycle, rightCycle;
+    
+    // phase plane scope, only one voice at a time has a tap
+    ScopeTap* scopeTap = nullptr;
+    FhnSolver::State scopeStart;
+    
+    // filter, shared by both channels
+    static constexpr float keytrackCentre = 261.63f;        // middle C
+    StereoFilter filter;
+    float cutoff{20000}, resonance{20000}, keytrack{0};
+    float strength{0};
+    
+    // per block scratch, sized in prepare()
+    int blockSize = 0;
+    int numActiveSamples = 0;
+    bool noteFinished = false;
+    std::vector<float> envelopeBuffer;
+    std::vector<float> pitchBuffer;
+    std::vector<float> leftInputBuffer, rightInputBuffer;
+    std::vector<float> leftSolverBuffer, rightSolverBuffer;
+
+};
 
+//==============================================================================
+/*!
+ @class FHNSynthesiser
+ @abstract juce::Synthesiser that steps the FHN solvers of all playing voices as one batch.
+ 
+ Voice rendering is split into three stages: each voice first renders its
+ inputs, then every solver pair is stepped together in an FhnSolverBank,
+ then each voice filters and mixes its own output. Before them the voices
+ write their modulation sources and the ModulationMatrix is evaluated for
+ all of them at once.
+ 
+ With setParallelRendering() and enough voices playing, whole voices are
+ instead rendered concurrently on a VoiceRenderPool.
+ 
+ @namespace none
+ */
+class FHNSynthesiser : public juce::Synthesiser
+{
+public:
+    /// juce::Synthesiser's own default for setMinimumRenderingSubdivisionSize(), under a millisecond at 44.1 kHz
+    static constexpr int defaultSubdivision = 32;
+    
+    /**
+     Allocate the solver bank and voice lists, call after the voices have been added
+     
+     @param maxVoices number of voices that can be batched per block
+     @param maxBlockSize largest block rendered in one go, longer blocks are split
+     */
+    void prepare(int maxVoices, int maxBlockSize)
+    {
+        solverBank.prepare(maxVoices, maxBlockSize * FhnOversampler::maxFactor);
+        blockSize = maxBlockSize;
+        
+        voiceScratch.resize(maxVoices);
+        for (auto& scratch : voiceScratch)
+            scratch.setSize(2, maxBlockSize);
+        
+        activeVoices.clear();
+        activeVoices.reserve(voices.size());
+        freeVoices.clear();
+        freeVoices.reserve(voices.size());
+        
+        // the voices may have been replaced, the scope voice is chosen again on the next block
+        scopeVoice = nullptr;
+        
+        // one matrix lane per voice, spares included, since crossfade tails and stolen voices keep modulating
+        modulation.prepare(voices.size(), getNumTicks(blockSize));
+        tailModulation.prepare(voices.size(), getNumTicks(blockSize));
+        
+        // free list is a stack, so push in reverse to hand out voice 0 first
+        for (int i = voices.size(); --i >= 0;)
+        {
+            auto* voice = static_cast<FHNSynthVoice*>(voices.getUnchecked(i));
+            voice->setScopeTap(nullptr);
+            voice->setModulation(&modulation, i);
+            if (voice->isPlaying())
+                activeVoices.push_back(voice);
+            else
+                freeVoices.push_back(voice);
+        }
+    }
+    
+    /**
+     Opt in to rendering voices on worker threads, call from prepareToPlay
+     
+     Each voice renders into its own scratch buffer on whichever thread picks
+     it up, then the buffers are summed in voice order on the audio thread, so
+     the result does not depend on scheduling. Blocks with fewer than
+     minVoices playing voices stay on the audio thread.
+     
+     @param numWorkers worker threads besides the audio thread, 0 to turn parallel rendering off
+     @param minVoices smallest number of playing voices worth spreading over threads
+     */
+    void setParallelRendering(int numWorkers, int minVoices)
+    {
+        if (numWorkers != renderPool.getNumWorkers())
+            renderPool.start(numWorkers);
+        
+        minParallelVoices = juce::jmax(2, minVoices);
+    }
+    
+    /**
+     Pass this block's parameters to the solver bank and the playing voices
+     
+     Idle voices are skipped, they get the full snapshot when they start a note.
+     When the snapshot took a whole new preset, the playing voices crossfade
+     to it, see beginCrossfades(), and the routes they had are kept for the
+     tails before the new ones are set.
+     
+     Call this for every block, including those with nothing to render: the
+     routes are only rebuilt in the block that reports a modulation change.
+     */
+    void updateParameters(const ParameterSnapshot& snapshot)
+    {
+        parameters = &snapshot;
+        polyphony = snapshot.get().polyphony;
+        mpe = snapshot.get().mpe;
+        bendRange = snapshot.get().bendRange;
+        mpeBendRange = snapshot.get().mpeBendRange;
+        solverBank.setIntegrator(snapshot.get().integrator);
+        
+        if (snapshot.wasSwapped())
+            tailModulation.copyRoutesFrom(modulation);
+        
+        if (snapshot.hasChanged(ParameterSnapshot::modulation))
+            modulation.setRoutes(snapshot.get().modRoutes, ModulationMatrix::maxRoutes);
+        
+        if (snapshot.wasSwapped())
+            beginCrossfades();
+        
+        for (auto* voice : activeVoices)
+            if (!voice->isCrossfadeTail())
+                voice->updateParameters(snapshot);
+    }
+    
+    /// control interval of every voice, see FHNSynthVoice::setControlInterval(); resizes the modulation matrix, not while rendering
+    void setControlInterval(int numSamples)
+    {
+        controlInterval = juce::jlimit(1, maxControlInterval, numSamples);
+        
+        for (auto* voice : voices)
+            static_cast<FHNSynthVoice*>(voice)->setControlInterval(controlInterval);
+        
+        if (blockSize > 0)
+        {
+            modulation.prepare(voices.size(), getNumTicks(blockSize));
+            tailModulation.prepare(voices.size(), getNumTicks(blockSize));
+        }
+    }
+    
+    /// noise seed of every voice, each voice and channel gets a stream of its own
+    void setNoiseSeed(std::uint64_t seed)
+    {
+        for (int i = 0; i < voices.size(); i++)
+            static_cast<FHNSynthVoice*>(voices.getUnchecked(i))->setNoiseSeed(seed + 2 * static_cast<std::uint64_t>(i));
+    }
+    
+    /// custom network edges of every voice, see FHNSynthVoice::setCustomNetwork(); not while rendering
+    void setCustomNetwork(const std::vector<FhnNetwork::Edge>& edges)
+    {
+        for (auto* voice : voices)
+            static_cast<FHNSynthVoice*>(voice)->setCustomNetwork(edges);
+    }
+    
+    /**
+     juce::Synthesiser::setMinimumRenderingSubdivisionSize(), which renderNextBlock() follows
+     
+     The base class keeps the values to itself, so they are copied here.
+     
+     @param numSamples shortest run rendered between two events, 1 renders every event on its own sample
+     @param shouldBeStrict also hold the first event of a block to numSamples after the block start
+     */
+    void setMinimumRenderingSubdivisionSize(int numSamples, bool shouldBeStrict = false) noexcept
+    {
+        juce::Synthesiser::setMinimumRenderingSubdivisionSize(numSamples, shouldBeStrict);
+        minimumSubdivision = juce::jmax(1, numSamples);
+        subdivisionIsStrict = shouldBeStrict;
+    }
+    
+    /// limit cycle playback of every voice, see FHNSynthVoice::setCycleCaching()
+    void setCycleCaching(bool shouldCache)
+    {
+        for (auto* voice : voices)
+            static_cast<FHNSynthVoice*>(voice)->setCycleCaching(shouldCache);
+    }
+    
+    /// scope fed by the newest voice while the tap is enabled, see ScopeTap
+    void setScopeTap(ScopeTap* tap)
+    {
+        scopeTap = tap;
+    }
+    
+    /// switch between batched solving and the plain per-voice renderNextBlock() path
+    void setBatchedRendering(bool shouldBatch)
+    {
+        batched = shouldBatch;
+    }
+    
+    /// voices currently producing sound, including ones fading out after being stolen
+    int getNumActiveVoices() const
+    {
+        return static_cast<int>(activeVoices.size());
+    }
+    
+    //--------------------------------------------------------------------------
+    /**
+     Render a block and handle its MIDI events, in place of juce::Synthesiser::renderNextBlock()
+     
+     The render is split as juce::Synthesiser splits it, see
+     setMinimumRenderingSubdivisionSize(): an event is played on its own
+     sample unless it comes less than the minimum subdivision after the last
+     split, in which case it is handled at that split. A burst of events
+     from an arpeggiator, a chord or an expression stream then costs one
+     split rather than one each, and the batched solvers keep their long
+     vectorised runs. Only events the voices respond to split the render,
+     see splitsBlock(); controllers they ignore are handled without
+     interrupting it.
+     
+     Unlike juce::Synthesiser, no lock is taken, here or in the MIDI handlers
+     below. The voices and sounds only change in prepareToPlay, which never
+     runs during a block, and the other setters say when they may be called.
+     */
+    void renderNextBlock(juce::AudioBuffer<float>& outputAudio, const juce::MidiBuffer& midiData, int startSample, int numSamples)
+    {
+        const int endSample = startSample + numSamples;
+        
+        int position = startSample;
+        bool firstSplit = true;
+        auto event = midiData.findNextSamplePosition(startSample);
+        
+        for (; event != midiData.cend(); ++event)
+        {
+            const auto metadata = *event;
+            if (metadata.samplePosition >= endSample)
+                break;
+            
+            const auto message = metadata.getMessage();
+            
+            // unless strict, the first split of a block can fall anywhere, as in juce::Synthesiser
+            const int minimum = firstSplit && !subdivisionIsStrict ? 1 : minimumSubdivision;
+            
+            if (splitsBlock(message) && metadata.samplePosition - position >= minimum)
+            {
+                renderVoices(outputAudio, position, metadata.samplePosition - position);
+                position = metadata.samplePosition;
+                firstSplit = false;
+            }
+            
+            handleMidiEvent(message);
+        }
+        
+        if (position < endSample)
+            renderVoices(outputAudio, position, endSample - position);
+        
+        // events past the end of the block, as juce::Synthesiser handles them
+        for (; event != midiData.cend(); ++event)
+            handleMidiEvent((*event).getMessage());
+    }
+    
+    /**
+     Start a voice from the free list, stealing one if the polyphony limit is reached
+     
+     Taking a voice is O(1), a pop from the free list in place of
+     juce::Synthesiser's search through every voice, and there is only one
+     sound, so no canPlaySound() check is needed either. The rest is not:
+     the retrigger check, the count against the polyphony limit and choosing
+     a voice to steal each walk the playing voices, so a note on costs
+     O(active voices). A stolen voice fades out over a few milliseconds on
+     one of the spare voices while the new note starts on another, so the
+     polyphony limit is kept below the number of voices allocated.
+     */
+    void noteOn(int midiChannel, int midiNoteNumber, float velocity) override
+    {
+        if (sounds.size() == 0)
+            return;
+        
+        // a note that is still ringing (sustain pedal or release) is retriggered, as juce::Synthesiser does
+        for (auto* voice : activeVoices)
+            if (voice->getCurrentlyPlayingNote() == midiNoteNumber && voice->isPlayingChannel(midiChannel))
+                stopVoice(voice, 1.0f, true);
+        
+        int numSounding = 0;
+        for (auto* voice : activeVoices)
+            numSounding += voice->isFading() ? 0 : 1;
+        
+        if (numSounding >= polyphony)
+            if (auto* victim = chooseVoiceToSteal())
+                victim->fadeOut();
+        
+        FHNSynthVoice* voice = nullptr;
+        
+        if (!freeVoices.empty())
+        {
+            voice = freeVoices.back();
+            freeVoices.pop_back();
+        }
+        else if (!activeVoices.empty())
+        {
+            // every voice busy, even the spares: cut the oldest one dead
+            voice = activeVoices.front();
+            voice->cutNote();
+            activeVoices.erase(activeVoices.begin());
+        }
+        else
+        {
+            return;
+        }
+        
+        // a voice that was a crossfade tail goes back to the current routes
+        voice->setModulation(&modulation, voice->getModulationLane());
+        
+        if (parameters != nullptr)
+            voice->updateParameters(*parameters, true);
+        
+        startVoice(voice, sounds.getUnchecked(0), midiChannel, midiNoteNumber, velocity);
+        voice->setSustainPedalDown(juce::isPositiveAndBelow(midiChannel - 1, numChannels) && sustainPedalDown[midiChannel - 1]);
+        voice->setExpressionChannel(midiChannel);
+        activeVoices.push_back(voice);
+    }
+    
+    /// as juce::Synthesiser::noteOff(), over the playing voices only and without the voice lock
+    void noteOff(int midiChannel, int midiNoteNumber, float velocity, bool allowTailOff) override
+    {
+        for (auto* voice : activeVoices)
+        {
+            if (voice->getCurrentlyPlayingNote() == midiNoteNumber && voice->isPlayingChannel(midiChannel))
+            {
+                voice->setKeyDown(false);
+                
+                if (!(voice->isSustainPedalDown() || voice->isSostenutoPedalDown()))
+                    stopVoice(voice, velocity, allowTailOff);
+            }
+        }
+    }
+    
+    /// as juce::Synthesiser::allNotesOff(), without the voice lock; audio thread only
+    void allNotesOff(int midiChannel, bool allowTailOff) override
+    {
+        for (auto* voice : activeVoices)
+            if (midiChannel <= 0 || voice->isPlayingChannel(midiChannel))
+                voice->stopNote(1.0f, allowTailOff);
+        
+        std::fill(std::begin(sustainPedalDown), std::end(sustainPedalDown), false);
+    }
+    
+    void handleSustainPedal(int midiChannel, bool isDown) override
+    {
+        if (!juce::isPositiveAndBelow(midiChannel - 1, numChannels))
+            return;
+        
+        for (auto* voice : activeVoices)
+        {
+            if (!voice->isPlayingChannel(midiChannel))
+                continue;
+            
+            if (isDown)
+            {
+                if (voice->isKeyDown())
+                    voice->setSustainPedalDown(true);
+            }
+            else
+            {
+                voice->setSustainPedalDown(false);
+                
+                if (!(voice->isKeyDown() || voice->isSostenutoPedalDown()))
+                    stopVoice(voice, 1.0f, true);
+            }
+        }
+        
+        sustainPedalDown[midiChannel - 1] = isDown;
+    }
+    
+    void handleSostenutoPedal(int midiChannel, bool isDown) override
+    {
+        for (auto* voice : activeVoices)
+        {
+            if (!voice->isPlayingChannel(midiChannel))
+                continue;
+            
+            if (isDown)
+                voice->setSostenutoPedalDown(true);
+            else if (voice->isSostenutoPedalDown())
+                stopVoice(voice, 1.0f, true);
+        }
+    }
+    
+    void handleAftertouch(int midiChannel, int midiNoteNumber, int aftertouchValue) override
+    {
+        for (auto* voice : activeVoices)
+            if (voice->getCurrentlyPlayingNote() == midiNoteNumber && (midiChannel <= 0 || voice->isPlayingChannel(midiChannel)))
+                voice->aftertouchChanged(aftertouchValue);
+    }
+    
+    /**
+     Expression controllers only update their channel's entry, see getExpression()
+     
+     juce::Synthesiser passes every controller to every voice on the channel,
+     which an MPE controller sending a stream per finger makes expensive. The
+     voices read their channel before each render instead, so a message
+     costs the same however many voices are playing. The pedals go to the
+     handlers above, and the voices ignore every other controller.
+     */
+    void handleController(int midiChannel, int controllerNumber, int controllerValue) override
+    {
+        if (!juce::isPositiveAndBelow(midiChannel - 1, numChannels))
+            return;
+        
+        auto& channel = channelExpression[midiChannel - 1];
+        
+        if (controllerNumber == 1)
+        {
+            channel.modWheel = controllerValue / 127.0f;
+            return;
+        }
+        
+        if (controllerNumber == 74)
+        {
+            channel.timbre = controllerValue / 127.0f;
+            return;
+        }
+        
+        switch (controllerNumber)
+        {
+            case 64:    handleSustainPedal(midiChannel, controllerValue >= 64); break;
+            case 66:    handleSostenutoPedal(midiChannel, controllerValue >= 64); break;
+            case 121:   channel = {}; break;     // reset all controllers
+            default:    break;
+        }
+    }
+    
+    void handleChannelPressure(int midiChannel, int channelPressureValue) override
+    {
+        if (juce::isPositiveAndBelow(midiChannel - 1, numChannels))
+            channelExpression[midiChannel - 1].pressure = channelPressureValue / 127.0f;
+    }
+    
+    void handlePitchWheel(int midiChannel, int wheelValue) override
+    {
+        if (juce::isPositiveAndBelow(midiChannel - 1, numChannels))
+            channelExpression[midiChannel - 1].bend = (wheelValue - 8192) / 8192.0f;
+    }
+    
+    /**
+     What a note on midiChannel expresses, from the controllers sent on that channel
+     
+     With the mpe parameter on, each note has a member channel of its own and
+     channel 1 is the master channel of the lower zone: its bend, scaled by
+     the bendRange parameter, adds to every note's own bend, scaled by
+     mpeBendRange, and its other controllers apply to every note as well, the
+     larger value winning. Without MPE a note follows its own channel.
+     */
+    NoteExpression getExpression(int midiChannel) const
+    {
+        const auto& own = channelExpression[juce::jlimit(1, numChannels, midiChannel) - 1];
+        
+        if (!mpe || midiChannel == masterChannel)
+            return { own.bend * bendRange, own.pressure, own.timbre, own.modWheel };
+        
+        const auto& master = channelExpression[masterChannel - 1];
+        return { own.bend * mpeBendRange + master.bend * bendRange,
+                 juce::jmax(own.pressure, master.pressure),
+                 juce::jmax(own.timbre, master.timbre),
+                 juce::jmax(own.modWheel, master.modWheel) };
+    }
+    
+protected:
+    using juce::Synthesiser::renderVoices;
+    
+    /// as juce::Synthesiser::handleMidiEvent(), so that every message reaches the lock free handlers above
+    void handleMidiEvent(const juce::MidiMessage& message) override
+    {
+        const int channel = message.getChannel();
+        
+        if (message.isNoteOn())
+            noteOn(channel, message.getNoteNumber(), message.getFloatVelocity());
+        else if (message.isNoteOff())
+            noteOff(channel, message.getNoteNumber(), message.getFloatVelocity(), true);
+        else if (message.isAllNotesOff() || message.isAllSoundOff())
+            allNotesOff(channel, true);
+        else if (message.isPitchWheel())
+            handlePitchWheel(channel, message.getPitchWheelValue());
+        else if (message.isAftertouch())
+            handleAftertouch(channel, message.getNoteNumber(), message.getAfterTouchValue());
+        else if (message.isChannelPressure())
+            handleChannelPressure(channel, message.getChannelPressureValue());
+        else if (message.isController())
+            handleController(channel, message.getControllerNumber(), message.getControllerValue());
+    }
+    
+    void renderVoices(juce::AudioBuffer<float>& outputAudio, int startSample, int numSamples) override
+    {
+        updateScopeVoice();
+        
+        if (activeVoices.empty())
+            return;
+        
+        const int numActive = static_cast<int>(activeVoices.size());
+        const bool parallel = renderPool.getNumWorkers() > 0 && numActive >= minParallelVoices
+                              && numActive <= static_cast<int>(voiceScratch.size());
+        
+        if (blockSize <= 0)
+        {
+            // not prepared, so there is no matrix either
+            for (auto* voice : activeVoices)
+                voice->renderNextBlock(outputAudio, startSample, numSamples);
+        }
+        else
+        {
+            while (numSamples > 0)
+            {
+                auto numThisTime = juce::jmin(numSamples, blockSize);
+                
+                renderModulation(numThisTime);
+                
+                if (parallel)
+                {
+                    renderParallel(outputAudio, startSample, numThisTime);
+                }
+                else if (batched)
+                {
+                    renderBatch(outputAudio, startSample, numThisTime);
+                }
+                else
+                {
+                    for (auto* voice : activeVoices)
+                        if (voice->isPlaying())
+                            voice->renderModulated(outputAudio, startSample, numThisTime);
+                }
+                
+                startSample += numThisTime;
+                numSamples -= numThisTime;
+            }
+        }
+        
+        releaseFinishedVoices();
+    }
+    
+private:
+    /// events that start, stop or hold notes or change their expression; the voices ignore everything else
+    static bool splitsBlock(const juce::MidiMessage& message)
+    {
+        if (message.isController())
+        {
+            // mod wheel, sustain, sostenuto, timbre and reset all controllers, see handleController()
+            switch (message.getControllerNumber())
+            {
+                case 1: case 64: case 66: case 74: case 121:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+        
+        return message.isNoteOnOrOff() || message.isAllNotesOff() || message.isAllSoundOff()
+               || message.isPitchWheel() || message.isChannelPressure() || message.isAftertouch();
+    }
+    
+    /// control ticks in a block of numSamples, as the voices count them
+    int getNumTicks(int numSamples) const
+    {
+        return (numSamples + controlInterval - 1) / controlInterval;
+    }
+    
+    /// first stage for every voice: their sources, then every route for all of them in one pass per control tick
+    void renderModulation(int numSamples)
+    {
+        bool tails = false;
+        
+        for (auto* voice : activeVoices)
+        {
+            if (voice->isPlaying())
+            {
+                voice->setExpression(getExpression(voice->getExpressionChannel()));
+                voice->renderModulation(numSamples);
+                tails = tails || voice->isCrossfadeTail();
+            }
+        }
+        
+        if (modulation.getNumRoutes() > 0)
+            modulation.process(getNumTicks(numSamples));
+        
+        if (tails && tailModulation.getNumRoutes() > 0)
+            tailModulation.process(getNumTicks(numSamples));
+    }
+    
+    /// quietest voice already in its release, otherwise the oldest one
+    FHNSynthVoice* chooseVoiceToSteal() const
+    {
+        FHNSynthVoice* quietest = nullptr;
+        FHNSynthVoice* oldest = nullptr;
+        
+        for (auto* voice : activeVoices)
+        {
+            if (voice->isFading())
+                continue;
+            
+            if (oldest == nullptr)
+                oldest = voice;
+            
+            if (voice->isReleasing() && (quietest == nullptr || voice->getLevel() < quietest->getLevel()))
+                quietest = voice;
+        }
+        
+        return quietest != nullptr ? quietest : oldest;
+    }
+    
+    /**
+     Crossfade every sounding voice to the preset it is about to be given, as far as spare voices allow
+     
+     Called before the voices are updated. Each voice's state, still on the
+     old preset, is copied to a free voice that plays it on and fades it out
+     over crossfadeSeconds, while the voice itself fades in on the new preset
+     from the same state, so the solvers, oscillators and filter carry on
+     instead of jumping. The copies come from the voices preallocated for
+     stealing and at most maxCrossfadeVoices start per swap, newest first;
+     any voice beyond that takes the new preset at once.
+     
+     The copies read their lanes of tailModulation, which holds the routes
+     of the old preset, so they modulate as the voices did before the swap.
+     A swap within crossfadeSeconds of the last one moves the tails still
+     fading from it to the routes in between.
+     */
+    void beginCrossfades()
+    {
+        int started = 0;
+        
+        // the tails are appended, so index rather than iterate, newest first
+        for (size_t i = activeVoices.size(); i-- > 0 && started < maxCrossfadeVoices && !freeVoices.empty();)
+        {
+            auto* voice = activeVoices[i];
+            
+            // stolen voices and tails are fading out already
+            if (voice->isFading())
+                continue;
+            
+            auto* tail = freeVoices.back();
+            freeVoices.pop_back();
+            
+            tail->continueFrom(*voice, crossfadeSeconds);
+            tail->setModulation(&tailModulation, tail->getModulationLane());
+            voice->fadeIn(crossfadeSeconds);
+            activeVoices.push_back(tail);
+            started++;
+        }
+    }
+    
+    /// hand the scope tap to the newest voice, or take it away when the scope is closed
+    void updateScopeVoice()
+    {
+        const bool wanted = scopeTap != nullptr && scopeTap->isEnabled() && !activeVoices.empty();
+        FHNSynthVoice* newest = nullptr;
+        
+        // a crossfade tail is appended after the voice it copies, which is the one to show
+        for (auto it = activeVoices.rbegin(); wanted && it != activeVoices.rend() && newest == nullptr; ++it)
+            if (!(*it)->isCrossfadeTail())
+                newest = *it;
+        
+        if (newest == scopeVoice)
+            return;
+        
+        if (scopeVoice != nullptr)
+            scopeVoice->setScopeTap(nullptr);
+        
+        if (newest != nullptr)
+            newest->setScopeTap(scopeTap);
+        
+        scopeVoice = newest;
+    }
+    
+    /// move voices whose note ended back to the free list, keeping the rest in start order
+    void releaseFinishedVoices()
+    {
+        size_t kept = 0;
+        
+        for (auto* voice : activeVoices)
+        {
+            if (voice->isPlaying())
+                activeVoices[kept++] = voice;
+            else
+                freeVoices.push_back(voice);
+        }
+        
+        activeVoices.resize(kept);
+    }
+    
+    void renderBatch(juce::AudioBuffer<float>& outputAudio, int startSample, int numSamples)
+    {
+        for (auto* voice : activeVoices)
+            if (voice->isPlaying())
+                voice->renderInputs(numSamples);
+        
+        // one batch per oversampling factor, as a batch shares its sample count
+        for (int factor = 1; factor <= FhnOversampler::maxFactor; factor *= 2)
+        {
+            solverBank.clear();
+            
+            for (auto* voice : activeVoices)
+                if (voice->isPlaying() && voice->getOversamplingFactor() == factor && !voice->addToBank(solverBank))
+                    voice->renderSolvers();
+            
+            solverBank.process(numSamples * factor);
+        }
+        
+        for (auto* voice : activeVoices)
+            if (voice->isPlaying())
+                voice->renderOutput(outputAudio, startSample);
+    }
+    
+    void renderParallel(juce::AudioBuffer<float>& outputAudio, int startSample, int numSamples)
+    {
+        parallelSamples = numSamples;
+        renderPool.run(static_cast<int>(activeVoices.size()), renderParallelVoice, this);
+        
+        // fixed voice order, whatever thread rendered each one
+        for (size_t v = 0; v < activeVoices.size(); v++)
+        {
+            const auto& scratch = voiceScratch[v];
+            for (int chan = 0; chan < outputAudio.getNumChannels(); chan++)
+                outputAudio.addFrom(chan, startSample, scratch, chan % 2, 0, numSamples);
+        }
+    }
+    
+    /// VoiceRenderPool job: one voice into its own scratch buffer
+    static void renderParallelVoice(void* context, int index)
+    {
+        auto& synth = *static_cast<FHNSynthesiser*>(context);
+        auto& scratch = synth.voiceScratch[static_cast<size_t>(index)];
+        
+        auto* voice = synth.activeVoices[static_cast<size_t>(index)];
+        
+        scratch.clear(0, synth.parallelSamples);
+        if (voice->isPlaying())
+            voice->renderModulated(scratch, 0, synth.parallelSamples);
+    }
+    
+    FhnSolverBank solverBank;
+    int blockSize = 0;
+    bool batched = true;
+    
+    // voice allocation, both lists are reserved in prepare() so noteOn() never allocates
+    std::vector<FHNSynthVoice*> activeVoices;      // oldest first
+    std::vector<FHNSynthVoice*> freeVoices;
+    int polyphony = 8;
+    const ParameterSnapshot* parameters = nullptr;
+    int minimumSubdivision = defaultSubdivision;
+    bool subdivisionIsStrict = false;
+    
+    // modulation, one lane per voice, see renderModulation(); crossfade tails read tailModulation
+    ModulationMatrix modulation, tailModulation;
+    int controlInterval = defaultControlInterval;
+    
+    // per channel expression, see handleController() and getExpression()
+    struct ChannelExpression
+    {
+        float bend = 0.0f;          // -1..1
+        float pressure = 0.0f, timbre = 0.0f, modWheel = 0.0f;
+    };
+    
+    static constexpr int numChannels = 16;
+    static constexpr int masterChannel = 1;
+    ChannelExpression channelExpression[numChannels];
+    bool sustainPedalDown[numChannels] = {};
+    bool mpe = false;
+    float bendRange = 2.0f, mpeBendRange = 48.0f;
+    
+    // preset crossfades, see beginCrossfades()
+    static constexpr double crossfadeSeconds = 0.02;
+    static constexpr int maxCrossfadeVoices = 32;
+    
+    // parallel rendering, see setParallelRendering()
+    VoiceRenderPool renderPool;
+    int minParallelVoices = 4;
+    std::vector<juce::AudioBuffer<float>> voiceScratch;
+    int parallelSamples = 0;
+    
+    ScopeTap* scopeTap = nullptr;
+    FHNSynthVoice* scopeVoice = nullptr;
 };
 
 #endif /* Synthesiser.h */
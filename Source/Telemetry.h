@@ -0,0 +1,130 @@
+/*
+  ==============================================================================
+
+    Telemetry.h
+    Created: 14 Oct 2023 3:48:20pm
+    Author:  Jeremy Bai
+
+  ==============================================================================
+*/
+
+#ifndef Telemetry_h
+#define Telemetry_h
+
+#include <JuceHeader.h>
+#include <array>
+#include "SpscQueue.h"
+
+/// what processBlock records about every block it renders
+struct BlockTelemetry
+{
+    float renderSeconds = 0.0f;     ///< wall time spent in processBlock
+    float budgetSeconds = 0.0f;     ///< numSamples / sample rate, the time the host allows
+    int activeVoices = 0;           ///< voices sounding at the end of the block
+    int numSamples = 0;             ///< samples rendered
+
+    float getLoad() const
+    {
+        return budgetSeconds > 0.0f ? renderSeconds / budgetSeconds : 0.0f;
+    }
+};
+
+/// one record per processBlock, read by the editor or a logging thread, about 20 s of 256 sample blocks at 48 kHz
+using TelemetryRing = SpscQueue<BlockTelemetry, 4096>;
+
+//==============================================================================
+/**
+ Summary of the records read from a TelemetryRing, kept by the reader
+
+ Load is render time over budget, 1 being a block that took as long as the
+ audio it produced. Blocks above nearXrunLoad leave too little headroom for
+ the host's own work and are counted as near dropouts, blocks above 1 as
+ dropouts. Percentiles come from a histogram of the load, so adding a block
+ costs the same however long the instance has been running.
+ */
+class TelemetryStats
+{
+public:
+    static constexpr float nearXrunLoad = 0.8f;
+    static constexpr int numBins = 100;
+    static constexpr float binWidth = 0.02f;        // load per bin, the last one takes everything from 2 up
+
+    void add(const BlockTelemetry& record)
+    {
+        const float load = record.getLoad();
+        const int bin = juce::jlimit(0, numBins - 1, static_cast<int>(load / binWidth));
+
+        histogram[static_cast<size_t>(bin)]++;
+        numBlocks++;
+        totalRenderSeconds += record.renderSeconds;
+        totalBudgetSeconds += record.budgetSeconds;
+        peakLoad = juce::jmax(peakLoad, load);
+        peakVoices = juce::jmax(peakVoices, record.activeVoices);
+        latestVoices = record.activeVoices;
+
+        if (load > 1.0f)
+            xruns++;
+        else if (load > nearXrunLoad)
+            nearXruns++;
+    }
+
+    /// read everything the ring holds, returns the load of just those blocks, or -1 if there were none
+    float addAll(TelemetryRing& ring)
+    {
+        BlockTelemetry record;
+        double render = 0.0, budget = 0.0;
+
+        while (ring.pop(record))
+        {
+            add(record);
+            render += record.renderSeconds;
+            budget += record.budgetSeconds;
+        }
+
+        return budget > 0.0 ? static_cast<float>(render / budget) : -1.0f;
+    }
+
+    void reset()
+    {
+        *this = TelemetryStats();
+    }
+
+    /// load below which the given fraction of blocks fall, to the resolution of a bin
+    float getPercentileLoad(float fraction) const
+    {
+        const auto target = static_cast<juce::int64>(std::ceil(fraction * static_cast<float>(numBlocks)));
+        juce::int64 count = 0;
+
+        for (int bin = 0; bin < numBins; bin++)
+        {
+            count += histogram[static_cast<size_t>(bin)];
+            if (count >= target && count > 0)
+                return static_cast<float>(bin + 1) * binWidth;
+        }
+
+        return 0.0f;
+    }
+
+    /// render time over budget of every block added since the last reset
+    float getAverageLoad() const
+    {
+        return totalBudgetSeconds > 0.0 ? static_cast<float>(totalRenderSeconds / totalBudgetSeconds) : 0.0f;
+    }
+
+    const std::array<juce::int64, numBins>& getHistogram() const    { return histogram; }
+    juce::int64 getNumBlocks() const                                { return numBlocks; }
+    juce::int64 getNumNearXruns() const                             { return nearXruns; }
+    juce::int64 getNumXruns() const                                 { return xruns; }
+    float getPeakLoad() const                                       { return peakLoad; }
+    int getPeakVoices() const                                       { return peakVoices; }
+    int getLatestVoices() const                                     { return latestVoices; }
+
+private:
+    std::array<juce::int64, numBins> histogram {};
+    juce::int64 numBlocks = 0, nearXruns = 0, xruns = 0;
+    double totalRenderSeconds = 0.0, totalBudgetSeconds = 0.0;
+    float peakLoad = 0.0f;
+    int peakVoices = 0, latestVoices = 0;
+};
+
+#endif /* Telemetry.h */
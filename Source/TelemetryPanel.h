@@ -0,0 +1,128 @@
+/*
+  ==============================================================================
+
+    TelemetryPanel.h
+    Created: 14 Oct 2023 5:02:37pm
+    Author:  Jeremy Bai
+
+  ==============================================================================
+*/
+
+#ifndef Telemetry_Panel_h
+#define Telemetry_Panel_h
+
+#include <JuceHeader.h>
+#include "Telemetry.h"
+
+/**
+ Editor strip showing how close the instance runs to dropouts
+
+ Reads the processor's TelemetryRing ten times a second on the message
+ thread, so it is the ring's only reader while the editor is open. Shows
+ the load of the last tenth of a second, the average, 99th percentile and
+ peak load, the voice count and the near dropout and dropout counters, with
+ the load histogram underneath. Click to reset the counters, e.g. after
+ changing a patch setting.
+ */
+class TelemetryPanel : public juce::Component,
+                       private juce::Timer
+{
+public:
+    static constexpr int preferredHeight = 110;
+
+    explicit TelemetryPanel(TelemetryRing& ringToRead) : ring(ringToRead)
+    {
+        // records from before the editor opened describe a patch that may be long gone
+        ring.discard();
+        startTimerHz(10);
+    }
+
+    void paint(juce::Graphics& g) override
+    {
+        auto area = getLocalBounds().reduced(6);
+        auto percent = [](float load) { return juce::String(load * 100.0f, 1) + "%"; };
+
+        g.fillAll(getLookAndFeel().findColour(juce::ResizableWindow::backgroundColourId).darker(0.3f));
+        g.setFont(13.0f);
+        g.setColour(juce::Colours::white);
+
+        g.drawText("load " + (recentLoad >= 0.0f ? percent(recentLoad) : juce::String("-"))
+                   + "   average " + percent(stats.getAverageLoad())
+                   + "   p99 " + percent(stats.getPercentileLoad(0.99f))
+                   + "   peak " + percent(stats.getPeakLoad()),
+                   area.removeFromTop(16), juce::Justification::centredLeft);
+
+        const bool warn = stats.getNumNearXruns() > 0 || stats.getNumXruns() > 0;
+        g.setColour(warn ? juce::Colours::orange : juce::Colours::white);
+        g.drawText("voices " + juce::String(stats.getLatestVoices()) + " (peak " + juce::String(stats.getPeakVoices()) + ")"
+                   + "   near dropouts " + juce::String(stats.getNumNearXruns())
+                   + "   dropouts " + juce::String(stats.getNumXruns())
+                   + "   blocks " + juce::String(stats.getNumBlocks()),
+                   area.removeFromTop(16), juce::Justification::centredLeft);
+
+        area.removeFromTop(4);
+        paintHistogram(g, area.toFloat());
+    }
+
+    void mouseDown(const juce::MouseEvent&) override
+    {
+        stats.reset();
+        repaint();
+    }
+
+private:
+    void timerCallback() override
+    {
+        const float load = stats.addAll(ring);
+
+        // an idle host stops calling processBlock, keep showing the last value
+        if (load >= 0.0f)
+            recentLoad = load;
+
+        repaint();
+    }
+
+    /// blocks per load bin on a log scale, 0 to 200% load, with the near dropout and dropout lines
+    void paintHistogram(juce::Graphics& g, juce::Rectangle<float> area)
+    {
+        const auto& histogram = stats.getHistogram();
+        const auto largest = *std::max_element(histogram.begin(), histogram.end());
+        const float maxLoad = TelemetryStats::numBins * TelemetryStats::binWidth;
+        const float barWidth = area.getWidth() / TelemetryStats::numBins;
+        auto loadToX = [&](float load) { return area.getX() + area.getWidth() * load / maxLoad; };
+
+        g.setColour(juce::Colours::black.withAlpha(0.4f));
+        g.fillRect(area);
+
+        if (largest > 0)
+        {
+            const float scale = area.getHeight() / std::log1p(static_cast<float>(largest));
+
+            for (int bin = 0; bin < TelemetryStats::numBins; bin++)
+            {
+                const auto count = histogram[static_cast<size_t>(bin)];
+                if (count == 0)
+                    continue;
+
+                const float load = bin * TelemetryStats::binWidth;
+                const float height = scale * std::log1p(static_cast<float>(count));
+                g.setColour(load >= 1.0f ? juce::Colours::red
+                                         : (load >= TelemetryStats::nearXrunLoad ? juce::Colours::orange : juce::Colours::lightgreen));
+                g.fillRect(area.getX() + bin * barWidth, area.getBottom() - height, juce::jmax(1.0f, barWidth - 1.0f), height);
+            }
+        }
+
+        g.setColour(juce::Colours::orange.withAlpha(0.7f));
+        g.drawVerticalLine(juce::roundToInt(loadToX(TelemetryStats::nearXrunLoad)), area.getY(), area.getBottom());
+        g.setColour(juce::Colours::red.withAlpha(0.7f));
+        g.drawVerticalLine(juce::roundToInt(loadToX(1.0f)), area.getY(), area.getBottom());
+    }
+
+    TelemetryRing& ring;
+    TelemetryStats stats;
+    float recentLoad = -1.0f;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(TelemetryPanel)
+};
+
+#endif /* TelemetryPanel.h */
@@ -0,0 +1,236 @@
+/*
+  ==============================================================================
+
+    VoiceRenderPool.h
+    Created: 3 Oct 2023 7:26:51pm
+    Author:  Jeremy Bai
+
+  ==============================================================================
+*/
+
+#ifndef Voice_Render_Pool_h
+#define Voice_Render_Pool_h
+
+#include <JuceHeader.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#if JUCE_INTEL
+ #include <emmintrin.h>
+#endif
+
+#if JUCE_MAC || JUCE_IOS
+ #include <dispatch/dispatch.h>
+#elif JUCE_LINUX || JUCE_BSD || JUCE_ANDROID
+ #include <semaphore.h>
+#endif
+
+/**
+ Counting semaphore whose post() never takes a lock, so the audio thread can wake parked workers
+
+ Platforms without a native semaphore fall back to juce::WaitableEvent, where
+ several posts in a row may wake only one waiter. The pool tolerates that, the
+ caller simply does more of the work itself.
+ */
+class WorkerSemaphore
+{
+public:
+#if JUCE_MAC || JUCE_IOS
+    WorkerSemaphore()   : semaphore(dispatch_semaphore_create(0)) {}
+    ~WorkerSemaphore()  { dispatch_release(semaphore); }
+    void post()         { dispatch_semaphore_signal(semaphore); }
+    void wait()         { dispatch_semaphore_wait(semaphore, DISPATCH_TIME_FOREVER); }
+private:
+    dispatch_semaphore_t semaphore;
+#elif JUCE_LINUX || JUCE_BSD || JUCE_ANDROID
+    WorkerSemaphore()   { sem_init(&semaphore, 0, 0); }
+    ~WorkerSemaphore()  { sem_destroy(&semaphore); }
+    void post()         { sem_post(&semaphore); }
+    void wait()         { while (sem_wait(&semaphore) != 0) {} }
+private:
+    sem_t semaphore;
+#else
+    void post()         { event.signal(); }
+    void wait()         { event.wait(); }
+private:
+    juce::WaitableEvent event;
+#endif
+
+    JUCE_DECLARE_NON_COPYABLE(WorkerSemaphore)
+};
+
+//==============================================================================
+/**
+ Small pool of pinned worker threads for rendering voices in parallel
+
+ run() hands out job indices from one atomic ticket holding the dispatch
+ generation and the number of jobs left, so any idle thread takes the next
+ voice, and a worker that wakes up late can never claim a job of another
+ dispatch. The calling audio thread takes jobs too and then spins until the
+ last one is done. Workers spin for a while after each dispatch and then
+ park on a semaphore. Nothing in run() allocates or locks.
+ */
+class VoiceRenderPool
+{
+public:
+    /// job callback, called once for each index in [0, numJobs)
+    using JobFunction = void (*)(void* context, int index);
+
+    ~VoiceRenderPool()
+    {
+        stop();
+    }
+
+    /**
+     Start the workers, call from prepareToPlay, never from the audio thread
+
+     @param numWorkers threads in addition to the audio thread, capped at the number of cores minus one
+     */
+    void start(int numWorkers)
+    {
+        stop();
+
+        numWorkers = juce::jmin(numWorkers, juce::SystemStats::getNumCpus() - 1);
+        for (int i = 0; i < numWorkers; i++)
+        {
+            workers.push_back(std::make_unique<Worker>(*this, i));
+
+            // keep core 0 for the host's audio thread
+            workers.back()->setAffinityMask(juce::uint32(1) << ((i + 1) % juce::jmin(32, juce::SystemStats::getNumCpus())));
+            workers.back()->startThread(juce::Thread::Priority::highest);
+        }
+    }
+
+    /// stop and join the workers
+    void stop()
+    {
+        for (auto& worker : workers)
+            worker->signalThreadShouldExit();
+
+        for (size_t i = 0; i < workers.size(); i++)
+            wakeUp.post();
+
+        for (auto& worker : workers)
+            worker->stopThread(1000);
+
+        workers.clear();
+    }
+
+    int getNumWorkers() const
+    {
+        return static_cast<int>(workers.size());
+    }
+
+    /// run job(context, i) for every i in [0, numJobs) and return once all of them are finished
+    void run(int numJobs, JobFunction job, void* context)
+    {
+        jobFunction = job;
+        jobContext = context;
+        completed.store(0, std::memory_order_relaxed);
+
+        // new generation with all jobs left, publishes the job above
+        const auto generation = (ticket.load(std::memory_order_relaxed) >> 32) + 1;
+        ticket.store((generation << 32) | static_cast<juce::uint32>(numJobs), std::memory_order_seq_cst);
+
+        for (int parked = numParked.load(std::memory_order_seq_cst); parked > 0; parked--)
+            wakeUp.post();
+
+        runJobs(generation);
+
+        while (completed.load(std::memory_order_acquire) < numJobs)
+            spinPause();
+    }
+
+private:
+    class Worker : public juce::Thread
+    {
+    public:
+        Worker(VoiceRenderPool& p, int index)
+          : juce::Thread("FHN voice worker " + juce::String(index)), pool(p)
+        {
+        }
+
+        void run() override
+        {
+            juce::ScopedNoDenormals noDenormals;
+            juce::uint64 seenGeneration = pool.ticket.load(std::memory_order_acquire) >> 32;
+
+            while (!threadShouldExit())
+            {
+                int spins = 0;
+                juce::uint64 generation;
+
+                while ((generation = pool.ticket.load(std::memory_order_acquire) >> 32) == seenGeneration)
+                {
+                    if (threadShouldExit())
+                        return;
+
+                    if (++spins < spinLimit)
+                    {
+                        spinPause();
+                        continue;
+                    }
+
+                    // park, re-checking after announcing it so a dispatch in between is not missed
+                    pool.numParked.fetch_add(1, std::memory_order_seq_cst);
+                    if ((pool.ticket.load(std::memory_order_seq_cst) >> 32) == seenGeneration && !threadShouldExit())
+                        pool.wakeUp.wait();
+                    pool.numParked.fetch_sub(1, std::memory_order_seq_cst);
+                    spins = 0;
+                }
+
+                seenGeneration = generation;
+                pool.runJobs(generation);
+            }
+        }
+
+    private:
+        static constexpr int spinLimit = 4000;
+        VoiceRenderPool& pool;
+    };
+
+    /// claim and run jobs of the given dispatch until none are left
+    void runJobs(juce::uint64 generation)
+    {
+        auto current = ticket.load(std::memory_order_acquire);
+
+        for (;;)
+        {
+            const int remaining = static_cast<int>(current & 0xffffffff);
+            if ((current >> 32) != generation || remaining == 0)
+                return;
+
+            // success means this dispatch is still running, so the job pointers are its own
+            if (ticket.compare_exchange_weak(current, current - 1, std::memory_order_acq_rel))
+            {
+                jobFunction(jobContext, remaining - 1);
+                completed.fetch_add(1, std::memory_order_release);
+                current = ticket.load(std::memory_order_acquire);
+            }
+        }
+    }
+
+    static void spinPause()
+    {
+       #if JUCE_INTEL
+        _mm_pause();
+       #elif defined(__aarch64__)
+        __asm__ __volatile__("yield");
+       #endif
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    WorkerSemaphore wakeUp;
+
+    // generation in the high 32 bits, number of jobs not yet claimed in the low 32
+    std::atomic<juce::uint64> ticket { 0 };
+    std::atomic<int> completed { 0 };
+    std::atomic<int> numParked { 0 };
+
+    // written by run() before the ticket is published
+    JobFunction jobFunction = nullptr;
+    void* jobContext = nullptr;
+};
+
+#endif /* VoiceRenderPool.h */
@@ -0,0 +1,352 @@
+/*
+  ==============================================================================
+
+    DspBench.h
+    Created: 14 Oct 2023 11:05:52am
+    Author:  Jeremy Bai
+
+    --bench-dsp for FHNRender, nanoseconds per sample of each DSP stage.
+
+    Every stage runs on its own with fixed inputs: the solver in each of its
+    forms, the oscillators, the input processor for each waveform pair, the
+    noise colours, the filter types and finally a whole voice at several
+    block sizes. A stage is warmed up for one run, then timed over several
+    runs of the same number of samples, and the median, fastest and slowest
+    run are reported. The thread is pinned to one core, so runs are not
+    moved between cores with different clocks or caches. With --json the
+    results are written to a file as well, to compare one commit with another.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+namespace DspBench
+{
+    static constexpr double sampleRate = 48000.0;
+    static constexpr int blockSize = 256;
+    static constexpr int samplesPerRun = 1 << 17;
+    static constexpr int numRuns = 7;
+
+    struct Result
+    {
+        juce::String name;
+        double median = 0.0, best = 0.0, worst = 0.0;    // ns per sample
+    };
+
+    /**
+     Time process() until it has covered samplesPerRun samples, numRuns times after a warm up run
+
+     @param samplesPerCall samples one call of process() renders, counting every channel, pair or node it steps
+     */
+    template <typename Process>
+    static Result measure (const juce::String& name, int samplesPerCall, Process&& process)
+    {
+        const int callsPerRun = juce::jmax (1, samplesPerRun / samplesPerCall);
+        const double samples = static_cast<double> (callsPerRun) * samplesPerCall;
+        std::vector<double> times;
+
+        for (int run = 0; run <= numRuns; run++)
+        {
+            const auto start = juce::Time::getHighResolutionTicks();
+
+            for (int call = 0; call < callsPerRun; call++)
+                process();
+
+            const auto end = juce::Time::getHighResolutionTicks();
+
+            // the first run only warms up caches, branch predictors and the clock
+            if (run > 0)
+                times.push_back (juce::Time::highResolutionTicksToSeconds (end - start) * 1.0e9 / samples);
+        }
+
+        std::sort (times.begin(), times.end());
+        Result result { name, times[times.size() / 2], times.front(), times.back() };
+
+        std::cout << name.paddedRight (' ', 36)
+                  << juce::String (result.median, 2).paddedLeft (' ', 9) << " ns"
+                  << juce::String (result.best, 2).paddedLeft (' ', 9) << " ns"
+                  << juce::String (result.worst, 2).paddedLeft (' ', 9) << " ns\n";
+
+        return result;
+    }
+
+    /** A slow sweep around the direct input level, roughly what the input processor produces */
+    static std::vector<float> makeInput (int numSamples)
+    {
+        std::vector<float> input (static_cast<size_t> (numSamples));
+
+        for (int i = 0; i < numSamples; i++)
+            input[static_cast<size_t> (i)] = 0.2f + 0.6f * std::sin (0.05f * static_cast<float> (i));
+
+        return input;
+    }
+
+    //==============================================================================
+    static void benchSolvers (std::vector<Result>& results)
+    {
+        const auto input = makeInput (blockSize);
+        std::vector<float> left (blockSize), right (blockSize);
+
+        {
+            FhnSolver solver (static_cast<float> (sampleRate));
+            results.push_back (measure ("solver processSystem", blockSize, [&]
+            {
+                for (int i = 0; i < blockSize; i++)
+                    left[static_cast<size_t> (i)] = solver.processSystem (input[static_cast<size_t> (i)]);
+            }));
+        }
+
+        const std::pair<const char*, FhnIntegrator> integrators[] = {
+            { "rk4", FhnIntegrator::rk4 }, { "heun", FhnIntegrator::heun },
+            { "semi-implicit", FhnIntegrator::semiImplicit }, { "adaptive", FhnIntegrator::adaptive }
+        };
+
+        for (auto& [name, integrator] : integrators)
+        {
+            FhnSolver solver (static_cast<float> (sampleRate));
+            solver.setIntegrator (integrator);
+            results.push_back (measure (juce::String ("solver block ") + name, blockSize, [&]
+            {
+                solver.processBlock (input.data(), left.data(), blockSize);
+            }));
+        }
+
+        // per solver-sample, so a pair counts twice
+        {
+            FhnSolver first (static_cast<float> (sampleRate)), second (static_cast<float> (sampleRate));
+            results.push_back (measure ("solver coupled pair rk4", 2 * blockSize, [&]
+            {
+                FhnSolver::processCoupledBlock (first, second, 0.3f, input.data(), input.data(), left.data(), right.data(), blockSize);
+            }));
+        }
+
+        {
+            constexpr int numPairs = 8;
+            std::vector<std::unique_ptr<FhnSolver>> solvers;
+            std::vector<float> outputs (2 * numPairs * blockSize);
+
+            for (int i = 0; i < 2 * numPairs; i++)
+                solvers.push_back (std::make_unique<FhnSolver> (static_cast<float> (sampleRate)));
+
+            FhnSolverBank bank;
+            bank.prepare (numPairs, blockSize);
+
+            results.push_back (measure ("solver bank " + juce::String (numPairs) + " pairs rk4", 2 * numPairs * blockSize, [&]
+            {
+                bank.clear();
+
+                for (int pair = 0; pair < numPairs; pair++)
+                    bank.addPair (*solvers[static_cast<size_t> (2 * pair)], *solvers[static_cast<size_t> (2 * pair + 1)], 0.3f,
+                                  input.data(), input.data(),
+                                  outputs.data() + 2 * pair * blockSize, outputs.data() + (2 * pair + 1) * blockSize);
+
+                bank.process (blockSize);
+            }));
+        }
+
+        for (int size : { 8, 32 })
+        {
+            FhnNetwork network;
+            network.prepare();
+            network.setSize (size);
+            network.setTopology (FhnTopology::ring, 0.2f);
+            network.setDt (static_cast<float> (1.0 / sampleRate));
+
+            results.push_back (measure ("network ring " + juce::String (size) + " nodes", size * blockSize, [&]
+            {
+                network.process (input.data(), input.data(), left.data(), right.data(), blockSize);
+            }));
+        }
+    }
+
+    static void benchOscillators (std::vector<Result>& results)
+    {
+        std::vector<float> output (blockSize), frequency (blockSize, 220.0f);
+
+        auto phasor = [&] (const char* name, Phasor& oscillator)
+        {
+            oscillator.setSampleRate (static_cast<float> (sampleRate));
+            oscillator.setFrequency (220.0f);
+
+            results.push_back (measure (juce::String ("phasor ") + name, blockSize, [&]
+            {
+                for (auto& sample : output)
+                    sample = oscillator.processOscillator();
+            }));
+        };
+
+        SinOsc sine;
+        SquareOsc square;
+        SawToothOsc saw;
+        phasor ("sine", sine);
+        phasor ("square", square);
+        phasor ("sawtooth", saw);
+
+        const char* waveforms[] = { "sine", "square", "sawtooth" };
+
+        for (int type = 0; type < 3; type++)
+        {
+            BlockOscillator oscillator;
+            oscillator.setSampleRate (static_cast<float> (sampleRate));
+            oscillator.setWaveform (static_cast<BlockOscillator::Waveform> (type));
+
+            results.push_back (measure (juce::String ("block oscillator ") + waveforms[type], blockSize, [&]
+            {
+                oscillator.render (frequency.data(), 1.0f, nullptr, output.data(), blockSize);
+            }));
+        }
+
+        // the voice's input stage, modulator on, for every main and modulator waveform
+        for (int mainType = 0; mainType < 3; mainType++)
+        {
+            for (int modType = 0; modType < 2; modType++)
+            {
+                InputProcessor input (static_cast<float> (sampleRate));
+                input.resetMainType (mainType);
+                input.resetModType (modType);
+                input.updateParam (0.6f, 0.2f, 0.3f, 0.0f, 0.5f);
+
+                results.push_back (measure (juce::String ("input ") + waveforms[mainType] + " mod " + waveforms[modType], blockSize, [&]
+                {
+                    input.processBlock (0.2f, frequency.data(), 0.0f, output.data(), blockSize);
+                }));
+            }
+        }
+
+        const std::pair<const char*, NoiseColour> colours[] = {
+            { "white", NoiseColour::white }, { "pink", NoiseColour::pink }, { "brown", NoiseColour::brown }
+        };
+
+        for (auto& [name, colour] : colours)
+        {
+            BlockNoise noise;
+            noise.setSampleRate (sampleRate);
+            noise.setColour (colour);
+
+            results.push_back (measure (juce::String ("noise ") + name, blockSize, [&]
+            {
+                noise.fill (output.data(), blockSize);
+            }));
+        }
+    }
+
+    static void benchFilters (std::vector<Result>& results)
+    {
+        const auto input = makeInput (blockSize);
+        std::vector<float> left (blockSize), right (blockSize);
+        const std::pair<const char*, FilterType> types[] = {
+            { "low-pass", FilterType::lowPass }, { "high-pass", FilterType::highPass }, { "band-pass", FilterType::bandPass }
+        };
+
+        // new targets every control interval, like a voice with key tracking, counted per channel-sample
+        for (auto& [name, type] : types)
+        {
+            StereoFilter filter;
+            filter.setSampleRate (sampleRate);
+            filter.setType (type);
+            filter.jumpTo (1000.0f, 2.0f);
+            float cutoff = 1000.0f;
+
+            results.push_back (measure (juce::String ("filter ") + name, 2 * blockSize, [&]
+            {
+                std::copy (input.begin(), input.end(), left.begin());
+                std::copy (input.begin(), input.end(), right.begin());
+
+                for (int start = 0; start < blockSize; start += defaultControlInterval)
+                {
+                    cutoff = cutoff > 4000.0f ? 1000.0f : cutoff * 1.01f;
+                    filter.setTarget (cutoff, 2.0f, defaultControlInterval);
+                    filter.process (left.data() + start, right.data() + start, defaultControlInterval, 0.8f);
+                }
+            }));
+        }
+    }
+
+    /** A whole voice holding a note, stereo, coupled, filtered and with an LFO, integrating every sample */
+    static void benchVoice (std::vector<Result>& results)
+    {
+        MyFHNSynthAudioProcessor processor;
+        setParameters (processor, { { "directInput", 0.2f }, { "oscAmp", 0.6f }, { "mainType", 2.0f },
+                                    { "modFreq", 0.2f }, { "modAmp", 0.3f }, { "lfoFreq", 3.0f }, { "lfoAmp", 0.05f },
+                                    { "timeScale", 1.2f }, { "stereo", 1.0f }, { "detune", 3.0f }, { "coupling", 0.3f },
+                                    { "cutoff", 3000.0f }, { "resonance", 10.0f }, { "strength", 0.5f },
+                                    { "attack", 0.01f }, { "sustain", 0.7f } });
+
+        ParameterSnapshot snapshot (processor.getParameterTree());
+        snapshot.update (sampleRate);
+        FHNSynthSound sound;
+
+        for (int size : { 32, 64, 256, 1024 })
+        {
+            FHNSynthVoice voice (static_cast<float> (sampleRate), size);
+            voice.setCurrentPlaybackSampleRate (sampleRate);
+            voice.setCycleCaching (false);
+            voice.updateParameters (snapshot, true);
+            voice.startNote (48, 0.8f, &sound, 8192);
+
+            juce::AudioBuffer<float> buffer (2, size);
+
+            results.push_back (measure ("voice block " + juce::String (size), size, [&]
+            {
+                buffer.clear();
+                voice.renderNextBlock (buffer, 0, size);
+            }));
+        }
+    }
+
+    //==============================================================================
+    static void writeJson (const juce::File& file, const std::vector<Result>& results, int core)
+    {
+        juce::Array<juce::var> list;
+
+        for (auto& result : results)
+        {
+            juce::DynamicObject::Ptr entry = new juce::DynamicObject();
+            entry->setProperty ("name", result.name);
+            entry->setProperty ("nsPerSample", result.median);
+            entry->setProperty ("best", result.best);
+            entry->setProperty ("worst", result.worst);
+            list.add (juce::var (entry.get()));
+        }
+
+        juce::DynamicObject::Ptr root = new juce::DynamicObject();
+        root->setProperty ("cpu", juce::SystemStats::getCpuModel());
+        root->setProperty ("core", core);
+        root->setProperty ("simdWidth", SimdFloat::width);
+        root->setProperty ("sampleRate", sampleRate);
+        root->setProperty ("runs", numRuns);
+        root->setProperty ("samplesPerRun", samplesPerRun);
+        root->setProperty ("results", list);
+
+        if (! file.replaceWithText (juce::JSON::toString (juce::var (root.get()))))
+            std::cerr << "could not write " << file.getFullPathName() << "\n";
+    }
+
+    /**
+     Run every stage and print the results
+
+     @param core CPU to pin the thread to, or -1 to leave it to the scheduler
+     @param jsonFile if not the default file, receives the results
+     */
+    static void run (int core, const juce::File& jsonFile)
+    {
+        if (core >= 0 && core < 32)
+            juce::Thread::setCurrentThreadAffinityMask (1u << core);
+
+        std::cout << (core >= 0 ? "pinned to core " + juce::String (core) : juce::String ("not pinned"))
+                  << ", " << SimdFloat::width << " lane SIMD, median of " << numRuns << " runs of " << samplesPerRun << " samples\n"
+                  << juce::String ("stage").paddedRight (' ', 36)
+                  << juce::String ("median").paddedLeft (' ', 12) << juce::String ("best").paddedLeft (' ', 12)
+                  << juce::String ("worst").paddedLeft (' ', 12) << "   per sample\n";
+
+        std::vector<Result> results;
+        benchSolvers (results);
+        benchOscillators (results);
+        benchFilters (results);
+        benchVoice (results);
+
+        if (jsonFile != juce::File())
+            writeJson (jsonFile, results, core);
+    }
+}
@@ -0,0 +1,416 @@
+/*
+  ==============================================================================
+
+    GoldenRender.h
+    Created: 13 Oct 2023 4:12:38pm
+    Author:  Jeremy Bai
+
+    --golden=<dir> for FHNRender, a regression suite for the audio path.
+
+    Every scenario renders the same short MIDI phrase through
+    MyFHNSynthAudioProcessor with a fixed set of parameters, sample rate,
+    block size and noise seed, so a render only changes when the code does.
+    The output is compared against the reference WAV stored in the directory
+    by the largest sample error and by the log spectral distance of the
+    averaged spectra, and the mean time per block against the time recorded
+    with the reference. With --update-golden the references and times are
+    written instead, after a change to the sound that is meant to happen.
+    One scenario is also rendered after a stretch of silent blocks, which
+    must not change it, see checkAfterIdle().
+
+    The references are committed in Tools/FHNRender/Golden, and the
+    tolerances leave room for other compilers and machines, so a change can
+    be checked without recording anything first. Render times only mean
+    something on the machine that recorded them, so times.json is kept out
+    of the repository: record it with --record-times before relying on the
+    time budget. Without it the budget is not checked.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+namespace GoldenRender
+{
+    static constexpr double sampleRate = 48000.0;
+    static constexpr int blockSize = 256;
+    static constexpr juce::uint64 noiseSeed = 1234;
+    static constexpr int timingRuns = 3;
+    static constexpr int spectrumOrder = 11;
+    static constexpr float spectrumRangeDb = 100.0f;
+    static constexpr const char* idleScenario = "routes";
+    static constexpr int idleBlocks = 16;
+
+    struct Scenario
+    {
+        const char* name;
+        std::vector<std::pair<juce::String, float>> parameterValues;
+    };
+
+    enum class Mode
+    {
+        check,          // compare with the references and, where recorded, the block times
+        update,         // write the references and the block times
+        recordTimes     // write this machine's block times, the references stay as they are
+    };
+
+    struct Tolerances
+    {
+        double maxError = 1.0e-3;
+        double spectralDistanceDb = 1.0;
+        double budgetMargin = 0.25;     // fraction the mean block time may grow by
+        bool checkTime = true;
+    };
+
+    /** Common settings every scenario starts from, a plain mono patch with a short envelope */
+    static std::vector<std::pair<juce::String, float>> baseParameters()
+    {
+        return { { "directInput", 0.2f }, { "oscAmp", 0.6f }, { "timeScale", 1.2f },
+                 { "attack", 0.01f }, { "decay", 0.1f }, { "sustain", 0.7f }, { "release", 0.05f },
+                 { "amp", 1.0f }, { "polyphony", 8.0f } };
+    }
+
+    static std::vector<Scenario> getScenarios()
+    {
+        std::vector<Scenario> scenarios = {
+            { "sine",               { { "mainType", 0.0f } } },
+            { "square",             { { "mainType", 1.0f } } },
+            { "sawtooth",           { { "mainType", 2.0f } } },
+            { "modulated",          { { "mainType", 1.0f }, { "modFreq", 0.2f }, { "modAmp", 0.3f }, { "lfoFreq", 3.0f }, { "lfoAmp", 0.05f } } },
+            { "low-pass",           { { "mainType", 2.0f }, { "filterType", 0.0f }, { "cutoff", 1500.0f }, { "resonance", 10.0f }, { "strength", 0.8f }, { "keytrack", 0.5f } } },
+            { "high-pass",          { { "mainType", 2.0f }, { "filterType", 1.0f }, { "cutoff", 800.0f }, { "resonance", 10.0f }, { "strength", 0.8f } } },
+            { "band-pass",          { { "mainType", 2.0f }, { "filterType", 2.0f }, { "cutoff", 1200.0f }, { "resonance", 10.0f }, { "strength", 0.8f } } },
+            { "stereo",             { { "mainType", 1.0f }, { "stereo", 1.0f }, { "detune", 3.0f } } },
+            { "stereo-coupled",     { { "mainType", 1.0f }, { "stereo", 1.0f }, { "detune", 3.0f }, { "coupling", 0.3f } } },
+            { "network",            { { "mainType", 0.0f }, { "stereo", 1.0f }, { "coupling", 0.2f }, { "networkSize", 6.0f }, { "topology", 0.0f } } },
+            { "white-noise",        { { "noiseAmp", 0.2f }, { "noiseColour", 0.0f } } },
+            { "pink-noise",         { { "noiseAmp", 0.3f }, { "noiseColour", 1.0f }, { "stereo", 1.0f } } },
+            { "heun",               { { "mainType", 1.0f }, { "integrator", 1.0f } } },
+            { "adaptive-oversampled", { { "mainType", 2.0f }, { "integrator", 3.0f }, { "oversampling", 2.0f } } },
+            // LFO 2 to cutoff and velocity to time scale
+            { "routes",             { { "mainType", 2.0f }, { "filterType", 0.0f }, { "cutoff", 1500.0f }, { "resonance", 10.0f }, { "strength", 0.8f },
+                                      { "lfo2Freq", 2.0f }, { "modSource1", 2.0f }, { "modDest1", 6.0f }, { "modDepth1", 0.5f },
+                                      { "modSource2", 4.0f }, { "modDest2", 0.0f }, { "modDepth2", 0.3f } } },
+        };
+
+        // the scenario's own values come after the base ones, so they win
+        for (auto& scenario : scenarios)
+        {
+            auto values = baseParameters();
+            values.insert (values.end(), scenario.parameterValues.begin(), scenario.parameterValues.end());
+            scenario.parameterValues = std::move (values);
+        }
+
+        return scenarios;
+    }
+
+    /** A held chord, a repeated note and a high note over it, 2.4 seconds with some overlap */
+    static juce::MidiMessageSequence makeSequence()
+    {
+        juce::MidiMessageSequence sequence;
+
+        auto addNote = [&sequence] (int note, float velocity, double start, double end)
+        {
+            sequence.addEvent (juce::MidiMessage::noteOn (1, note, velocity), start);
+            sequence.addEvent (juce::MidiMessage::noteOff (1, note), end);
+        };
+
+        for (int note : { 48, 55, 60, 64 })
+            addNote (note, 0.8f, 0.0, 1.2);
+
+        for (int i = 0; i < 4; i++)
+            addNote (67, 0.5f + 0.1f * static_cast<float> (i), 1.0 + 0.25 * i, 1.2 + 0.25 * i);
+
+        addNote (84, 1.0f, 1.5, 2.4);
+
+        sequence.updateMatchedPairs();
+        return sequence;
+    }
+
+    //==============================================================================
+    /** Power spectrum of one channel averaged over half overlapping Hann windowed frames */
+    static std::vector<float> averageSpectrum (const float* samples, int numSamples)
+    {
+        constexpr int size = 1 << spectrumOrder;
+        juce::dsp::FFT fft (spectrumOrder);
+        juce::dsp::WindowingFunction<float> window (size, juce::dsp::WindowingFunction<float>::hann, false);
+
+        std::vector<float> frame (2 * size), power (size / 2 + 1, 0.0f);
+        int numFrames = 0;
+
+        for (int start = 0; start + size <= numSamples; start += size / 2)
+        {
+            std::fill (frame.begin(), frame.end(), 0.0f);
+            std::copy (samples + start, samples + start + size, frame.begin());
+            window.multiplyWithWindowingTable (frame.data(), size);
+            fft.performFrequencyOnlyForwardTransform (frame.data());
+
+            for (size_t bin = 0; bin < power.size(); bin++)
+                power[bin] += frame[bin] * frame[bin];
+
+            numFrames++;
+        }
+
+        for (auto& p : power)
+            p /= static_cast<float> (juce::jmax (1, numFrames));
+
+        return power;
+    }
+
+    /**
+     Log spectral distance in dB between two renders, the RMS over bins of the
+     difference of their spectra, taken per channel and averaged
+
+     Both spectra are floored spectrumRangeDb below the reference's peak, so
+     bins that are silent in both do not count and a change buried far below
+     the sound does not dominate.
+     */
+    static double spectralDistance (const juce::AudioBuffer<float>& reference, const juce::AudioBuffer<float>& output)
+    {
+        const int numChannels = juce::jmin (reference.getNumChannels(), output.getNumChannels());
+        const int numSamples = juce::jmin (reference.getNumSamples(), output.getNumSamples());
+        double total = 0.0;
+
+        for (int channel = 0; channel < numChannels; channel++)
+        {
+            const auto expected = averageSpectrum (reference.getReadPointer (channel), numSamples);
+            const auto actual = averageSpectrum (output.getReadPointer (channel), numSamples);
+
+            const float peak = *std::max_element (expected.begin(), expected.end());
+            const float floorDb = juce::Decibels::gainToDecibels (peak, -400.0f) / 2.0f - spectrumRangeDb;
+            double sum = 0.0;
+
+            for (size_t bin = 0; bin < expected.size(); bin++)
+            {
+                // power, so half the dB of an amplitude
+                const float a = juce::jmax (floorDb, juce::Decibels::gainToDecibels (expected[bin], -400.0f) / 2.0f);
+                const float b = juce::jmax (floorDb, juce::Decibels::gainToDecibels (actual[bin], -400.0f) / 2.0f);
+                sum += static_cast<double> ((a - b) * (a - b));
+            }
+
+            total += std::sqrt (sum / static_cast<double> (expected.size()));
+        }
+
+        return total / juce::jmax (1, numChannels);
+    }
+
+    static float maxError (const juce::AudioBuffer<float>& reference, const juce::AudioBuffer<float>& output)
+    {
+        float worst = 0.0f;
+
+        for (int channel = 0; channel < reference.getNumChannels(); channel++)
+            for (int i = 0; i < reference.getNumSamples(); i++)
+                worst = juce::jmax (worst, std::abs (reference.getSample (channel, i) - output.getSample (channel, i)));
+
+        return worst;
+    }
+
+    //==============================================================================
+    static bool writeWav (const juce::File& file, const juce::AudioBuffer<float>& audio)
+    {
+        file.deleteFile();
+        auto stream = file.createOutputStream();
+        juce::WavAudioFormat wav;
+
+        if (stream == nullptr)
+            return false;
+
+        // 32 bit WAV files are float, the references keep every bit of the render
+        std::unique_ptr<juce::AudioFormatWriter> writer (wav.createWriterFor (stream.get(), sampleRate,
+                                                                              static_cast<unsigned int> (audio.getNumChannels()), 32, {}, 0));
+        if (writer == nullptr)
+            return false;
+
+        stream.release();
+        return writer->writeFromAudioSampleBuffer (audio, 0, audio.getNumSamples());
+    }
+
+    static bool readWav (const juce::File& file, juce::AudioBuffer<float>& audio)
+    {
+        juce::WavAudioFormat wav;
+        std::unique_ptr<juce::AudioFormatReader> reader (wav.createReaderFor (file.createInputStream().release(), true));
+
+        if (reader == nullptr)
+            return false;
+
+        audio.setSize (static_cast<int> (reader->numChannels), static_cast<int> (reader->lengthInSamples));
+        return reader->read (&audio, 0, audio.getNumSamples(), 0, true, true);
+    }
+
+    /** Render a scenario, keeping the output of the first run and the fastest mean block time */
+    static double renderScenario (const Scenario& scenario, const juce::MidiMessageSequence& sequence,
+                                  juce::AudioBuffer<float>& output, int runs, int leadInBlocks = 0)
+    {
+        RenderSettings settings;
+        settings.sampleRate = sampleRate;
+        settings.blockSize = blockSize;
+        settings.tailSeconds = 0.5;
+        settings.noiseSeed = noiseSeed;
+        settings.leadInBlocks = leadInBlocks;
+        settings.parameterValues = scenario.parameterValues;
+
+        double best = 1.0e9;
+
+        for (int run = 0; run < runs; run++)
+        {
+            juce::AudioBuffer<float> audio;
+            const auto report = render (settings, sequence, &audio);
+
+            if (report.numBlocks == 0)
+                return 0.0;
+
+            if (run == 0)
+                output = std::move (audio);
+
+            best = juce::jmin (best, report.renderSeconds / report.numBlocks);
+        }
+
+        return best;
+    }
+
+    /**
+     Render idleScenario after idleBlocks silent blocks and compare it with the render without them
+
+     The processor renders nothing while idle, yet the parameters it takes in
+     those blocks must still reach the notes that follow, so the two renders
+     have to match. This needs no reference.
+     */
+    static bool checkAfterIdle (const juce::MidiMessageSequence& sequence, const Tolerances& tolerances)
+    {
+        std::cout << (juce::String (idleScenario) + " after idle").paddedRight (' ', 24);
+
+        for (auto& scenario : getScenarios())
+        {
+            if (juce::String (scenario.name) != idleScenario)
+                continue;
+
+            juce::AudioBuffer<float> direct, afterIdle;
+            renderScenario (scenario, sequence, direct, 1);
+            renderScenario (scenario, sequence, afterIdle, 1, idleBlocks);
+
+            if (direct.getNumSamples() == 0 || afterIdle.getNumSamples() != direct.getNumSamples())
+                break;
+
+            const double error = maxError (direct, afterIdle);
+            std::cout << "max error " << juce::String (error, 3, true).paddedRight (' ', 12)
+                      << (error <= tolerances.maxError ? "ok" : "FAILED") << "\n";
+            return error <= tolerances.maxError;
+        }
+
+        std::cout << "render FAILED\n";
+        return false;
+    }
+
+    //==============================================================================
+    /**
+     Check every scenario against the references in directory, or record them
+
+     @return true if every scenario matched its reference within the tolerances
+     */
+    static bool run (const juce::File& directory, Mode mode, const Tolerances& tolerances)
+    {
+        const auto timesFile = directory.getChildFile ("times.json");
+        const auto sequence = makeSequence();
+        const bool update = mode == Mode::update;
+        const bool writeTimes = mode != Mode::check;
+        auto micros = [] (double seconds) { return juce::String (seconds * 1.0e6, 1) + " us"; };
+
+        if (writeTimes && ! directory.createDirectory())
+        {
+            std::cerr << "could not create " << directory.getFullPathName() << "\n";
+            return false;
+        }
+
+        auto times = juce::JSON::parse (timesFile);
+        auto* recorded = times.getDynamicObject();
+        juce::DynamicObject::Ptr updated = new juce::DynamicObject();
+        bool ok = true;
+
+        for (auto& scenario : getScenarios())
+        {
+            const auto referenceFile = directory.getChildFile (juce::String (scenario.name) + ".wav");
+            juce::AudioBuffer<float> output;
+            const double blockTime = renderScenario (scenario, sequence, output, tolerances.checkTime || writeTimes ? timingRuns : 1);
+
+            std::cout << juce::String (scenario.name).paddedRight (' ', 24);
+
+            if (output.getNumSamples() == 0)
+            {
+                std::cout << "render FAILED\n";
+                ok = false;
+                continue;
+            }
+
+            if (update)
+            {
+                const bool written = writeWav (referenceFile, output);
+                updated->setProperty (scenario.name, blockTime * 1.0e6);
+                std::cout << (written ? "written, " + micros (blockTime) + " per block" : juce::String ("could not write reference")) << "\n";
+                ok &= written;
+                continue;
+            }
+
+            if (mode == Mode::recordTimes)
+            {
+                updated->setProperty (scenario.name, blockTime * 1.0e6);
+                std::cout << micros (blockTime) << " per block\n";
+                continue;
+            }
+
+            juce::AudioBuffer<float> reference;
+            if (! readWav (referenceFile, reference))
+            {
+                std::cout << "no reference, run with --update-golden\n";
+                ok = false;
+                continue;
+            }
+
+            if (reference.getNumChannels() != output.getNumChannels() || reference.getNumSamples() != output.getNumSamples())
+            {
+                std::cout << "length or channels differ from the reference  FAILED\n";
+                ok = false;
+                continue;
+            }
+
+            const double error = maxError (reference, output);
+            const double distance = spectralDistance (reference, output);
+            const bool audioOk = error <= tolerances.maxError && distance <= tolerances.spectralDistanceDb;
+
+            std::cout << "max error " << juce::String (error, 3, true).paddedRight (' ', 12)
+                      << "spectral " << (juce::String (distance, 3) + " dB").paddedRight (' ', 12);
+
+            // no time recorded on this machine, so there is no budget to keep to
+            bool timeOk = true;
+            if (tolerances.checkTime)
+            {
+                const auto budgetMicros = recorded != nullptr ? static_cast<double> (recorded->getProperty (scenario.name)) : 0.0;
+                const double budget = budgetMicros * 1.0e-6 * (1.0 + tolerances.budgetMargin);
+                timeOk = budget <= 0.0 || blockTime <= budget;
+
+                std::cout << "block " << micros (blockTime).paddedRight (' ', 10)
+                          << "budget " << (budget > 0.0 ? micros (budget) : juce::String ("none")).paddedRight (' ', 12);
+            }
+
+            std::cout << (audioOk && timeOk ? "ok" : (audioOk ? "too slow" : "FAILED")) << "\n";
+            ok &= audioOk && timeOk;
+        }
+
+        if (mode == Mode::check)
+            ok &= checkAfterIdle (sequence, tolerances);
+
+        if (writeTimes)
+        {
+            if (! timesFile.replaceWithText (juce::JSON::toString (juce::var (updated.get()))))
+            {
+                std::cerr << "could not write " << timesFile.getFullPathName() << "\n";
+                ok = false;
+            }
+        }
+
+        if (mode == Mode::check)
+            std::cout << (ok ? "golden check passed\n" : "golden check FAILED\n");
+        else
+            std::cout << (ok ? (update ? "golden renders written\n" : "golden times written\n") : "golden update FAILED\n");
+        return ok;
+    }
+}
@@ -0,0 +1,778 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+    Created: 23 Sep 2023 3:14:26pm
+    Author:  Jeremy Bai
+
+    Headless offline renderer for myFHNSynth.
+
+    Instantiates MyFHNSynthAudioProcessor without a host, optionally loads a
+    preset, plays a standard MIDI file through processBlock at the requested
+    block size and sample rate, writes the result to a WAV file and reports
+    how long the processor took compared to the audio it produced.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+
+#if JUCE_LINUX
+ #include <dlfcn.h>
+#endif
+
+// plugin settings normally provided by JucePluginDefines.h in the plugin project
+#define JucePlugin_Name                 "myFHNSynth"
+#define JucePlugin_IsSynth              1
+#define JucePlugin_WantsMidiInput       1
+#define JucePlugin_ProducesMidiOutput   0
+#define JucePlugin_IsMidiEffect         0
+#define JucePlugin_Enable_ARA           0
+
+#include "../../../Source/PluginProcessor.cpp"
+#include "../../../Source/PluginEditor.cpp"
+#include "MathCheck.h"
+
+//==============================================================================
+/**
+ Allocation and lock detection for --check-realtime
+
+ The C allocator and pthread_mutex_lock are replaced for the whole program
+ (operator new goes through malloc), and every call made by a thread that is
+ inside processBlock is counted. Only glibc exposes the __libc_* entry points
+ needed to forward the calls, so on other platforms the check is a no-op.
+
+ Every lock counts, FHNSynthesiser renders and handles MIDI without taking
+ juce::Synthesiser's voice lock.
+ */
+namespace RealtimeCheck
+{
+    static thread_local bool inProcessBlock = false;
+    static std::atomic<int> allocations { 0 }, locks { 0 };
+
+    static inline void noteAllocation()
+    {
+        if (inProcessBlock)
+            allocations.fetch_add (1, std::memory_order_relaxed);
+    }
+
+    static inline void noteLock()
+    {
+        if (inProcessBlock)
+            locks.fetch_add (1, std::memory_order_relaxed);
+    }
+
+    struct ScopedProcessBlock
+    {
+        explicit ScopedProcessBlock (bool enabled)  { inProcessBlock = enabled; }
+        ~ScopedProcessBlock()                       { inProcessBlock = false; }
+    };
+
+   #if JUCE_LINUX && defined (__GLIBC__)
+    static constexpr bool supported = true;
+   #else
+    static constexpr bool supported = false;
+   #endif
+}
+
+#if JUCE_LINUX && defined (__GLIBC__)
+extern "C"
+{
+    void* __libc_malloc (size_t);
+    void* __libc_calloc (size_t, size_t);
+    void* __libc_realloc (void*, size_t);
+    void  __libc_free (void*);
+
+    void* malloc (size_t size)                      { RealtimeCheck::noteAllocation(); return __libc_malloc (size); }
+    void* calloc (size_t count, size_t size)        { RealtimeCheck::noteAllocation(); return __libc_calloc (count, size); }
+    void* realloc (void* ptr, size_t size)          { RealtimeCheck::noteAllocation(); return __libc_realloc (ptr, size); }
+    void  free (void* ptr)                          { if (ptr != nullptr) RealtimeCheck::noteAllocation(); __libc_free (ptr); }
+
+    int pthread_mutex_lock (pthread_mutex_t* mutex)
+    {
+        using LockFunction = int (*) (pthread_mutex_t*);
+        static LockFunction realLock = nullptr;
+
+        // resolved on the first lock, long before the first processBlock
+        if (realLock == nullptr)
+            realLock = reinterpret_cast<LockFunction> (dlsym (RTLD_NEXT, "pthread_mutex_lock"));
+
+        RealtimeCheck::noteLock();
+        return realLock (mutex);
+    }
+}
+#endif
+
+//==============================================================================
+struct RenderSettings
+{
+    juce::File midiFile, presetFile, outputFile;
+    juce::File bankFile;                // with program, a preset bank to take the program from
+    juce::String program;               // program number or preset name
+    double sampleRate = 48000.0;
+    int blockSize = 256;
+    double tailSeconds = 2.0;
+    int controlInterval = defaultControlInterval;
+    int subdivision = FHNSynthesiser::defaultSubdivision;
+    bool strictSubdivision = false;
+    bool checkRealtime = false;
+    int renderThreads = 0;
+    bool cycleCaching = true;
+    juce::String customNetwork;
+    juce::uint64 noiseSeed = 0;
+    int leadInBlocks = 0;               // silent blocks before the sequence starts, neither timed nor written
+    std::vector<std::pair<juce::String, float>> parameterValues;   // by parameter ID, in plain units
+};
+
+struct RenderReport
+{
+    double audioSeconds = 0.0;
+    double renderSeconds = 0.0;
+    double blockBudgetSeconds = 0.0;
+    double p50 = 0.0, p99 = 0.0, max = 0.0;
+    int numBlocks = 0;
+    int peakVoices = 0;
+    bool setupFailed = false;   // the preset, program or parameters could not be applied, nothing was rendered
+
+    // --check-realtime
+    int allocations = 0, locks = 0;
+    int failedBlocks = 0, firstFailedBlock = -1;
+};
+
+//==============================================================================
+/** Value of a "--name=value" argument, or fallback if it is not given */
+static juce::String getOption (const juce::StringArray& args, const juce::String& name, const juce::String& fallback = {})
+{
+    for (auto& arg : args)
+        if (arg.startsWith (name + "="))
+            return arg.fromFirstOccurrenceOf ("=", false, false).unquoted();
+
+    return fallback;
+}
+
+static void printUsage()
+{
+    std::cout << "usage: FHNRender [options] [preset files for --make-bank]\n"
+                 "  --midi=<file.mid>     MIDI file to play (default: built-in chord sequence)\n"
+                 "  --preset=<file>       state saved by getStateInformation, or its XML\n"
+                 "  --bank=<file>         preset bank to take --program from (default: the plugin's own bank)\n"
+                 "  --program=<n|name>    program number or preset name to render, applied after --preset\n"
+                 "  --out=<file.wav>      output file (default: render.wav)\n"
+                 "  --rate=<Hz>           sample rate (default: 48000)\n"
+                 "  --block=<samples>     block size (default: 256)\n"
+                 "  --tail=<seconds>      time rendered after the last MIDI event (default: 2)\n"
+                 "  --control=<samples>   control rate modulation interval (default: 32)\n"
+                 "  --subdivision=<n>     shortest run rendered between MIDI events, 1 for sample accurate events (default: 32)\n"
+                 "  --strict-subdivision  also hold the first event of a block to the subdivision\n"
+                 "  --arpeggio=<n>        instead of --midi, n notes a second over a mod wheel sweep of 1000 events a second\n"
+                 "  --mpe=<n>             instead of --midi, 15 MPE notes, each sending n pitch bend, pressure and timbre messages a second\n"
+                 "  --threads=<count>     worker threads for parallel voice rendering (default: 0)\n"
+                 "  --seed=<n>            seed of the noise generators (default: 0), equal seeds give equal renders\n"
+                 "  --no-cycle-cache      always integrate, never play back captured limit cycles\n"
+                 "  --network=<edges>     custom network topology, e.g. 0-1,1-2:0.5 (used when topology is Custom)\n"
+                 "  --check-realtime      fail if processBlock allocates or locks, with random parameter automation\n"
+                 "  --check-math          check the FastMath approximations against their error bounds and exit\n"
+                 "  --bench-math          time the FastMath approximations against the standard library and exit\n"
+                 "  --bench-dsp           time every DSP stage on its own, in ns per sample, and exit\n"
+                 "  --cpu=<n>             with --bench-dsp, core to pin the benchmark to, -1 for none (default: 0)\n"
+                 "  --json=<file>         with --bench-dsp, also write the results to file as JSON\n"
+                 "  --golden=<dir>        render the regression scenarios and compare them with the references in dir (Tools/FHNRender/Golden)\n"
+                 "  --update-golden       with --golden, write the references and block times instead\n"
+                 "  --record-times        with --golden, write this machine's block times only, for the time budget\n"
+                 "  --max-error=<x>       largest sample difference a golden render may have (default: 1e-3)\n"
+                 "  --spectral-error=<dB> largest log spectral distance a golden render may have (default: 1)\n"
+                 "  --budget-margin=<x>   fraction the mean block time may grow by over the recorded one (default: 0.25)\n"
+                 "  --no-time-budget      compare golden renders without checking their render time, as when none is recorded\n"
+                 "  --make-bank=<file>    write the preset files given as plain arguments into a preset bank and exit\n"
+                 "  --bench-state         time restoring the state (of --preset) from the binary and from the XML format\n";
+}
+
+//==============================================================================
+/** Every track of a standard MIDI file merged into one sequence, timestamps in seconds */
+static bool loadMidi (const juce::File& file, juce::MidiMessageSequence& sequence)
+{
+    juce::FileInputStream stream (file);
+    juce::MidiFile midiFile;
+
+    if (! stream.openedOk() || ! midiFile.readFrom (stream))
+    {
+        std::cerr << "could not read MIDI file " << file.getFullPathName() << "\n";
+        return false;
+    }
+
+    midiFile.convertTimestampTicksToSeconds();
+
+    for (int track = 0; track < midiFile.getNumTracks(); track++)
+        sequence.addSequence (*midiFile.getTrack (track), 0.0);
+
+    sequence.updateMatchedPairs();
+    return true;
+}
+
+/** Benchmark sequence used when no MIDI file is given: eight note chords, held and overlapping */
+static juce::MidiMessageSequence makeDefaultSequence()
+{
+    juce::MidiMessageSequence sequence;
+    const int roots[] = { 36, 41, 43, 38 };
+
+    for (int bar = 0; bar < 8; bar++)
+    {
+        const double start = bar * 2.0;
+        const int root = roots[bar % 4];
+
+        for (int n = 0; n < 8; n++)
+        {
+            const int note = root + n * 5;
+            sequence.addEvent (juce::MidiMessage::noteOn (1, note, 0.8f), start + n * 0.01);
+            sequence.addEvent (juce::MidiMessage::noteOff (1, note), start + 2.5);
+        }
+    }
+
+    sequence.updateMatchedPairs();
+    return sequence;
+}
+
+/**
+ Heavy MIDI for the event scheduler: a three octave arpeggio, every note
+ overlapping the next, under a mod wheel sweep sent every millisecond
+ */
+static juce::MidiMessageSequence makeArpeggioSequence (double notesPerSecond)
+{
+    juce::MidiMessageSequence sequence;
+    const int pattern[] = { 0, 4, 7, 12, 16, 19, 24, 28, 31, 36, 31, 28, 24, 19, 16, 12, 7, 4 };
+    constexpr double length = 8.0;
+    const double step = 1.0 / juce::jmax (1.0, notesPerSecond);
+
+    int index = 0;
+    for (double time = 0.0; time < length; time += step, index++)
+    {
+        const int note = 36 + pattern[index % juce::numElementsInArray (pattern)];
+        sequence.addEvent (juce::MidiMessage::noteOn (1, note, 0.7f), time);
+        sequence.addEvent (juce::MidiMessage::noteOff (1, note), time + 2.0 * step);
+    }
+
+    for (int ms = 0; ms < static_cast<int> (length * 1000.0); ms++)
+        sequence.addEvent (juce::MidiMessage::controllerEvent (1, 1, (ms / 8) % 128), ms * 0.001);
+
+    sequence.sort();
+    sequence.updateMatchedPairs();
+    return sequence;
+}
+
+/**
+ Heavy per note expression: a chord held on all 15 member channels of an
+ MPE lower zone, every note with its own vibrato, pressure and timbre
+ */
+static juce::MidiMessageSequence makeMpeSequence (double messagesPerSecond)
+{
+    juce::MidiMessageSequence sequence;
+    constexpr double length = 8.0;
+    constexpr int numNotes = 15;
+    const double step = 1.0 / juce::jmax (1.0, messagesPerSecond);
+
+    for (int i = 0; i < numNotes; i++)
+    {
+        const int channel = 2 + i;
+        const int note = 36 + 3 * i;
+        const double start = 0.1 * i;
+
+        sequence.addEvent (juce::MidiMessage::noteOn (channel, note, 0.7f), start);
+        sequence.addEvent (juce::MidiMessage::noteOff (channel, note), length);
+
+        for (double time = start; time < length; time += step)
+        {
+            const double vibrato = std::sin (juce::MathConstants<double>::twoPi * (4.0 + 0.2 * i) * time);
+            const double swell = 0.5 - 0.5 * std::cos (juce::MathConstants<double>::twoPi * (0.25 + 0.05 * i) * time);
+
+            // 43 / 8192 of the default 48 semitone note bend range, a quarter of a semitone of vibrato
+            sequence.addEvent (juce::MidiMessage::pitchWheel (channel, 8192 + juce::roundToInt (vibrato * 43.0)), time);
+            sequence.addEvent (juce::MidiMessage::channelPressureChange (channel, juce::roundToInt (swell * 127.0)), time);
+            sequence.addEvent (juce::MidiMessage::controllerEvent (channel, 74, juce::roundToInt ((1.0 - swell) * 127.0)), time);
+        }
+    }
+
+    sequence.sort();
+    sequence.updateMatchedPairs();
+    return sequence;
+}
+
+static bool loadPreset (juce::AudioProcessor& processor, const juce::File& file)
+{
+    juce::MemoryBlock data;
+
+    if (! file.loadFileAsData (data))
+    {
+        std::cerr << "could not read preset " << file.getFullPathName() << "\n";
+        return false;
+    }
+
+    // plain XML presets are wrapped the same way getStateInformation does
+    if (auto xml = juce::parseXML (data.toString()))
+    {
+        data.reset();
+        juce::AudioProcessor::copyXmlToBinary (*xml, data);
+    }
+
+    processor.setStateInformation (data.getData(), static_cast<int> (data.getSize()));
+    return true;
+}
+
+/** Switch to a program of a preset bank, by number or by name */
+static bool selectProgram (MyFHNSynthAudioProcessor& processor, const juce::File& bankFile, const juce::String& program)
+{
+    if (bankFile != juce::File() && ! processor.loadPresetBank (bankFile))
+    {
+        std::cerr << "could not open preset bank " << bankFile.getFullPathName() << "\n";
+        return false;
+    }
+
+    int index = program.containsOnly ("0123456789") ? program.getIntValue() : -1;
+
+    for (int i = 0; index < 0 && i < processor.getNumPrograms(); i++)
+        if (processor.getProgramName (i) == program)
+            index = i;
+
+    if (! juce::isPositiveAndBelow (index, processor.getNumPrograms()))
+    {
+        std::cerr << "no program " << program << " in the preset bank\n";
+        return false;
+    }
+
+    processor.setCurrentProgram (index);
+    return true;
+}
+
+/** Convert saved states, binary or XML, into a preset bank with presets named after the files */
+static bool makeBank (const juce::File& bankFile, const juce::Array<juce::File>& presetFiles)
+{
+    juce::StringArray names;
+    juce::Array<juce::MemoryBlock> states;
+
+    for (auto& file : presetFiles)
+    {
+        // a new processor for each, so parameters an old XML state does not mention keep their defaults
+        MyFHNSynthAudioProcessor processor;
+        juce::MemoryBlock state;
+
+        if (! loadPreset (processor, file))
+            return false;
+
+        processor.getStateInformation (state);
+        names.add (file.getFileNameWithoutExtension());
+        states.add (state);
+    }
+
+    if (! PresetBank::write (bankFile, names, states))
+    {
+        std::cerr << "could not write preset bank " << bankFile.getFullPathName() << "\n";
+        return false;
+    }
+
+    std::cout << "wrote " << names.size() << " presets to " << bankFile.getFullPathName() << "\n";
+    return true;
+}
+
+/**
+ Time setStateInformation with the binary format against the XML one
+
+ Alternates between the given state and one with every parameter changed,
+ so both formats really set every parameter on every load.
+ */
+static void benchState (const juce::File& presetFile)
+{
+    MyFHNSynthAudioProcessor processor;
+    juce::Random random (1);
+    juce::MemoryBlock binary[2], xml[2];
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (i == 1)
+            for (auto* parameter : processor.getParameters())
+                parameter->setValueNotifyingHost (random.nextFloat());
+        else if (presetFile != juce::File())
+            loadPreset (processor, presetFile);
+
+        processor.getStateInformation (binary[i]);
+
+        const auto tree = processor.getParameterTree().copyState();
+        std::unique_ptr<juce::XmlElement> element (tree.createXml());
+        juce::AudioProcessor::copyXmlToBinary (*element, xml[i]);
+    }
+
+    constexpr int numLoads = 2000;
+
+    auto time = [&] (juce::MemoryBlock* states)
+    {
+        const auto start = juce::Time::getHighResolutionTicks();
+
+        for (int i = 0; i < numLoads; i++)
+            processor.setStateInformation (states[i % 2].getData(), static_cast<int> (states[i % 2].getSize()));
+
+        return juce::Time::highResolutionTicksToSeconds (juce::Time::getHighResolutionTicks() - start) / numLoads;
+    };
+
+    const double binarySeconds = time (binary);
+    const double xmlSeconds = time (xml);
+
+    std::cout << "binary state     " << binary[0].getSize() << " bytes, " << juce::String (binarySeconds * 1.0e6, 2) << " us per load\n"
+              << "XML state        " << xml[0].getSize() << " bytes, " << juce::String (xmlSeconds * 1.0e6, 2) << " us per load\n"
+              << "speed-up         " << juce::String (xmlSeconds / juce::jmax (1.0e-12, binarySeconds), 1) << "x\n";
+}
+
+/**
+ Set parameters by ID to values in their own units
+
+ The value is read back from the parameter tree, which is what the processor
+ renders with, so a value that only reached the parameter object (setValue()
+ without notifying its listeners) is caught instead of rendering defaults.
+
+ @return false if an ID is unknown or a value did not reach the parameter tree
+ */
+static bool setParameters (MyFHNSynthAudioProcessor& processor, const std::vector<std::pair<juce::String, float>>& values)
+{
+    bool allSet = true;
+
+    for (auto& [id, value] : values)
+    {
+        auto* ranged = processor.getParameterTree().getParameter (id);
+        auto* raw = processor.getParameterTree().getRawParameterValue (id);
+
+        if (ranged == nullptr || raw == nullptr)
+        {
+            std::cerr << "unknown parameter " << id << "\n";
+            allSet = false;
+            continue;
+        }
+
+        ranged->setValueNotifyingHost (ranged->convertTo0to1 (value));
+        const float expected = ranged->convertFrom0to1 (ranged->getValue());
+
+        if (std::abs (raw->load() - expected) > 1.0e-6f * (1.0f + std::abs (expected)))
+        {
+            std::cerr << "parameter " << id << " did not reach the parameter tree\n";
+            allSet = false;
+        }
+    }
+
+    return allSet;
+}
+
+/**
+ Set every parameter to a random value, the way a host automating all of them would
+
+ Hosts and plugin wrappers notify the parameter's listeners as well, which is
+ what updates the values the processor reads through its parameter tree.
+ */
+static void automateParameters (juce::AudioProcessor& processor, juce::Random& random)
+{
+    for (auto* parameter : processor.getParameters())
+        parameter->setValueNotifyingHost (random.nextFloat());
+}
+
+//==============================================================================
+static double percentile (std::vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0.0;
+
+    auto index = static_cast<size_t> (p * static_cast<double> (sorted.size() - 1) + 0.5);
+    return sorted[juce::jmin (index, sorted.size() - 1)];
+}
+
+/**
+ Render the sequence through a new processor
+
+ @param capture if not null, receives the whole output, resized to fit
+ */
+static RenderReport render (const RenderSettings& settings, const juce::MidiMessageSequence& sequence,
+                            juce::AudioBuffer<float>* capture = nullptr)
+{
+    RenderReport report;
+    MyFHNSynthAudioProcessor processor;
+
+    const int numChannels = juce::jmax (1, processor.getTotalNumOutputChannels());
+    processor.setRateAndBufferSizeDetails (settings.sampleRate, settings.blockSize);
+    processor.setControlInterval (settings.controlInterval);
+    processor.setMinimumRenderingSubdivisionSize (settings.subdivision, settings.strictSubdivision);
+    processor.setRenderThreads (settings.renderThreads);
+    processor.setCycleCaching (settings.cycleCaching);
+    processor.setNoiseSeed (settings.noiseSeed);
+    processor.prepareToPlay (settings.sampleRate, settings.blockSize);
+
+    if ((settings.presetFile != juce::File() && ! loadPreset (processor, settings.presetFile))
+        || (settings.program.isNotEmpty() && ! selectProgram (processor, settings.bankFile, settings.program)))
+    {
+        report.setupFailed = true;
+        return report;
+    }
+
+    // a preset brings its own edges, the command line overrides them
+    if (settings.customNetwork.isNotEmpty())
+        processor.setCustomNetwork (settings.customNetwork);
+
+    if (! setParameters (processor, settings.parameterValues))
+    {
+        report.setupFailed = true;
+        return report;
+    }
+
+    const double endTime = (sequence.getNumEvents() > 0 ? sequence.getEndTime() : 0.0) + settings.tailSeconds;
+    const auto totalSamples = static_cast<juce::int64> (endTime * settings.sampleRate);
+    const int numBlocks = static_cast<int> ((totalSamples + settings.blockSize - 1) / settings.blockSize);
+
+    std::unique_ptr<juce::AudioFormatWriter> writer;
+    if (settings.outputFile != juce::File())
+    {
+        settings.outputFile.deleteFile();
+        auto stream = settings.outputFile.createOutputStream();
+        juce::WavAudioFormat wav;
+
+        if (stream != nullptr)
+            writer.reset (wav.createWriterFor (stream.get(), settings.sampleRate, static_cast<unsigned int> (numChannels), 24, {}, 0));
+
+        if (writer != nullptr)
+            stream.release();
+        else
+            std::cerr << "could not write " << settings.outputFile.getFullPathName() << "\n";
+    }
+
+    if (capture != nullptr)
+        capture->setSize (numChannels, numBlocks * settings.blockSize);
+
+    juce::AudioBuffer<float> buffer (numChannels, settings.blockSize);
+    juce::MidiBuffer midi;
+    midi.ensureSize (4096);
+    std::vector<double> blockTimes (static_cast<size_t> (numBlocks), 0.0);
+    int nextEvent = 0;
+
+    juce::Random automation (1);
+
+    // the parameters are already set, so the processor takes them while it has nothing to play
+    for (int block = 0; block < settings.leadInBlocks; block++)
+    {
+        buffer.clear();
+        processor.processBlock (buffer, midi);
+    }
+
+    for (int block = 0; block < numBlocks; block++)
+    {
+        const juce::int64 blockStart = static_cast<juce::int64> (block) * settings.blockSize;
+        const double blockEndTime = static_cast<double> (blockStart + settings.blockSize) / settings.sampleRate;
+
+        midi.clear();
+        while (nextEvent < sequence.getNumEvents()
+               && sequence.getEventTime (nextEvent) < blockEndTime)
+        {
+            const auto& message = sequence.getEventPointer (nextEvent)->message;
+            const auto position = static_cast<juce::int64> (message.getTimeStamp() * settings.sampleRate) - blockStart;
+            midi.addEvent (message, static_cast<int> (juce::jlimit<juce::int64> (0, settings.blockSize - 1, position)));
+            nextEvent++;
+        }
+
+        buffer.clear();
+
+        if (settings.checkRealtime && block % 8 == 0)
+            automateParameters (processor, automation);
+
+        const int allocationsBefore = RealtimeCheck::allocations.load();
+        const int locksBefore = RealtimeCheck::locks.load();
+
+        const auto start = juce::Time::getHighResolutionTicks();
+        {
+            RealtimeCheck::ScopedProcessBlock scope (settings.checkRealtime);
+            processor.processBlock (buffer, midi);
+        }
+        const auto end = juce::Time::getHighResolutionTicks();
+
+        if (RealtimeCheck::allocations.load() != allocationsBefore || RealtimeCheck::locks.load() != locksBefore)
+        {
+            if (report.failedBlocks++ == 0)
+                report.firstFailedBlock = block;
+        }
+
+        blockTimes[static_cast<size_t> (block)] = juce::Time::highResolutionTicksToSeconds (end - start);
+        report.peakVoices = juce::jmax (report.peakVoices, processor.getNumActiveVoices());
+
+        if (writer != nullptr)
+            writer->writeFromAudioSampleBuffer (buffer, 0, settings.blockSize);
+
+        if (capture != nullptr)
+            for (int channel = 0; channel < numChannels; channel++)
+                capture->copyFrom (channel, static_cast<int> (blockStart), buffer, channel, 0, settings.blockSize);
+    }
+
+    processor.releaseResources();
+
+    report.allocations = RealtimeCheck::allocations.load();
+    report.locks = RealtimeCheck::locks.load();
+    report.numBlocks = numBlocks;
+    report.audioSeconds = static_cast<double> (numBlocks) * settings.blockSize / settings.sampleRate;
+    report.blockBudgetSeconds = settings.blockSize / settings.sampleRate;
+
+    for (auto t : blockTimes)
+        report.renderSeconds += t;
+
+    std::sort (blockTimes.begin(), blockTimes.end());
+    report.p50 = percentile (blockTimes, 0.50);
+    report.p99 = percentile (blockTimes, 0.99);
+    report.max = blockTimes.empty() ? 0.0 : blockTimes.back();
+
+    return report;
+}
+
+static void printReport (const RenderSettings& settings, const RenderReport& report)
+{
+    auto micros = [] (double seconds) { return juce::String (seconds * 1.0e6, 1) + " us"; };
+    const double rtf = report.audioSeconds > 0.0 ? report.renderSeconds / report.audioSeconds : 0.0;
+
+    std::cout << "sample rate      " << settings.sampleRate << " Hz, block " << settings.blockSize << "\n"
+              << "audio            " << juce::String (report.audioSeconds, 2) << " s in " << report.numBlocks << " blocks\n"
+              << "render           " << juce::String (report.renderSeconds, 4) << " s\n"
+              << "real-time factor " << juce::String (rtf, 4) << " (" << juce::String (rtf > 0.0 ? 1.0 / rtf : 0.0, 1) << "x real time)\n"
+              << "block budget     " << micros (report.blockBudgetSeconds) << "\n"
+              << "block p50        " << micros (report.p50) << "\n"
+              << "block p99        " << micros (report.p99) << "\n"
+              << "block max        " << micros (report.max) << " (" << juce::String (100.0 * report.max / report.blockBudgetSeconds, 1) << "% of budget)\n"
+              << "peak voices      " << report.peakVoices << "\n";
+
+    if (settings.checkRealtime)
+    {
+        if (! RealtimeCheck::supported)
+            std::cout << "realtime check   not supported on this platform\n";
+        else if (report.failedBlocks == 0)
+            std::cout << "realtime check   passed, no allocations or locks in processBlock\n";
+        else
+            std::cout << "realtime check   FAILED, " << report.allocations << " allocations and " << report.locks
+                      << " locks in " << report.failedBlocks << " blocks, first in block " << report.firstFailedBlock << "\n";
+    }
+}
+
+// use render(), RenderSettings and setParameters()
+#include "GoldenRender.h"
+#include "DspBench.h"
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    juce::StringArray args;
+    for (int i = 1; i < argc; i++)
+        args.add (argv[i]);
+
+    if (args.contains ("--help") || args.contains ("-h"))
+    {
+        printUsage();
+        return 0;
+    }
+
+    if (args.contains ("--check-math"))
+        return MathCheck::run() ? 0 : 1;
+
+    if (args.contains ("--bench-math"))
+    {
+        MathCheck::bench();
+        return 0;
+    }
+
+    const auto cwd = juce::File::getCurrentWorkingDirectory();
+
+    if (args.contains ("--bench-dsp"))
+    {
+        const auto json = getOption (args, "--json");
+        DspBench::run (getOption (args, "--cpu", "0").getIntValue(), json.isNotEmpty() ? cwd.getChildFile (json) : juce::File());
+        return 0;
+    }
+
+    if (auto golden = getOption (args, "--golden"); golden.isNotEmpty())
+    {
+        GoldenRender::Tolerances tolerances;
+        tolerances.maxError = getOption (args, "--max-error", juce::String (tolerances.maxError)).getDoubleValue();
+        tolerances.spectralDistanceDb = getOption (args, "--spectral-error", juce::String (tolerances.spectralDistanceDb)).getDoubleValue();
+        tolerances.budgetMargin = getOption (args, "--budget-margin", juce::String (tolerances.budgetMargin)).getDoubleValue();
+        tolerances.checkTime = ! args.contains ("--no-time-budget");
+
+        const auto mode = args.contains ("--update-golden") ? GoldenRender::Mode::update
+                        : args.contains ("--record-times")  ? GoldenRender::Mode::recordTimes
+                                                            : GoldenRender::Mode::check;
+
+        return GoldenRender::run (cwd.getChildFile (golden), mode, tolerances) ? 0 : 1;
+    }
+
+    if (auto bank = getOption (args, "--make-bank"); bank.isNotEmpty())
+    {
+        juce::Array<juce::File> presetFiles;
+
+        for (auto& arg : args)
+            if (! arg.startsWith ("--"))
+                presetFiles.add (cwd.getChildFile (arg));
+
+        return makeBank (cwd.getChildFile (bank), presetFiles) ? 0 : 1;
+    }
+
+    if (args.contains ("--bench-state"))
+    {
+        const auto preset = getOption (args, "--preset");
+        benchState (preset.isNotEmpty() ? cwd.getChildFile (preset) : juce::File());
+        return 0;
+    }
+
+    RenderSettings settings;
+    settings.sampleRate = getOption (args, "--rate", "48000").getDoubleValue();
+    settings.blockSize = getOption (args, "--block", "256").getIntValue();
+    settings.tailSeconds = getOption (args, "--tail", "2").getDoubleValue();
+    settings.checkRealtime = args.contains ("--check-realtime");
+    settings.renderThreads = getOption (args, "--threads", "0").getIntValue();
+    settings.cycleCaching = ! args.contains ("--no-cycle-cache");
+    settings.customNetwork = getOption (args, "--network");
+    settings.noiseSeed = static_cast<juce::uint64> (getOption (args, "--seed", "0").getLargeIntValue());
+    settings.controlInterval = getOption (args, "--control", juce::String (defaultControlInterval)).getIntValue();
+    settings.subdivision = getOption (args, "--subdivision", juce::String (FHNSynthesiser::defaultSubdivision)).getIntValue();
+    settings.strictSubdivision = args.contains ("--strict-subdivision");
+    settings.outputFile = cwd.getChildFile (getOption (args, "--out", "render.wav"));
+
+    if (auto preset = getOption (args, "--preset"); preset.isNotEmpty())
+        settings.presetFile = cwd.getChildFile (preset);
+
+    if (auto bank = getOption (args, "--bank"); bank.isNotEmpty())
+        settings.bankFile = cwd.getChildFile (bank);
+
+    settings.program = getOption (args, "--program");
+
+    if (settings.sampleRate <= 0.0 || settings.blockSize <= 0)
+    {
+        printUsage();
+        return 1;
+    }
+
+    if (auto midi = getOption (args, "--midi"); midi.isNotEmpty())
+        settings.midiFile = cwd.getChildFile (midi);
+
+    const auto arpeggio = getOption (args, "--arpeggio").getDoubleValue();
+    const auto mpe = getOption (args, "--mpe").getDoubleValue();
+
+    if (mpe > 0.0 && settings.midiFile == juce::File())
+        settings.parameterValues.push_back ({ "mpe", 1.0f });
+
+    juce::MidiMessageSequence sequence;
+
+    if (settings.midiFile != juce::File())
+    {
+        if (! loadMidi (settings.midiFile, sequence))
+            return 1;
+    }
+    else
+    {
+        sequence = arpeggio > 0.0 ? makeArpeggioSequence (arpeggio)
+                 : mpe > 0.0      ? makeMpeSequence (mpe)
+                                  : makeDefaultSequence();
+    }
+
+    const auto report = render (settings, sequence);
+
+    if (report.setupFailed)
+        return 1;
+
+    printReport (settings, report);
+    return report.failedBlocks == 0 ? 0 : 1;
+}
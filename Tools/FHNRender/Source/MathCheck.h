@@ -0,0 +1,195 @@
+/*
+  ==============================================================================
+
+    MathCheck.h
+    Created: 8 Oct 2023 2:47:13pm
+    Author:  Jeremy Bai
+
+    --check-math and --bench-math for FHNRender.
+
+    The check sweeps every FastMath.h approximation, scalar and SimdFloat,
+    over the range the synth feeds it and compares against the double
+    precision standard library. It fails if any error is above the bound the
+    header documents. The benchmark times each approximation against the
+    library call it replaces.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+namespace MathCheck
+{
+    /** Largest error of f against reference over [from, to], scalar and first SIMD lane */
+    template <typename Fast, typename Reference>
+    static double maxError (Fast&& fast, Reference&& reference, double from, double to, double step, bool relative)
+    {
+        double worst = 0.0;
+
+        for (double x = from; x <= to; x += step)
+        {
+            const auto input = static_cast<float> (x);
+            const double exact = reference (static_cast<double> (input));
+
+            float lanes[SimdFloat::width];
+            fast (SimdFloat (input)).store (lanes);
+
+            for (const double value : { static_cast<double> (fast (input)), static_cast<double> (lanes[0]) })
+            {
+                const double error = relative ? std::abs (value / exact - 1.0) : std::abs (value - exact);
+                worst = juce::jmax (worst, error);
+            }
+        }
+
+        return worst;
+    }
+
+    static bool report (const char* name, double error, float bound)
+    {
+        const bool ok = error <= bound;
+        std::cout << juce::String (name).paddedRight (' ', 24)
+                  << "max error " << juce::String (error, 3, true).paddedRight (' ', 12)
+                  << "bound " << juce::String (bound, 3, true).paddedRight (' ', 12)
+                  << (ok ? "ok" : "FAILED") << "\n";
+        return ok;
+    }
+
+    /** Returns true if every approximation is within its documented bound */
+    static bool run()
+    {
+        constexpr double twoPi = juce::MathConstants<double>::twoPi;
+        bool ok = true;
+
+        // solver state, clamped to fhnStateLimit by the integrators
+        ok &= report ("fastCube (ulp)",
+                      maxError ([] (auto x) { return fastCube (x); },
+                                [] (double x) { return x * x * x; }, -fhnStateLimit, fhnStateLimit, 1.1e-4, true) / 0x1p-23,
+                      2.0f);
+
+        // LFO pitch and mod ratios are within a few octaves, the full exponent range is checked anyway
+        ok &= report ("fastExp2 (relative)",
+                      maxError ([] (auto x) { return fastExp2 (x); },
+                                [] (double x) { return std::exp2 (x); }, -126.0, 126.0, 1.3e-4, true),
+                      fastExp2MaxRelativeError);
+
+        // exponential control ramps take the log of the ratio of two frequencies
+        {
+            double worst = 0.0;
+            for (double x = 1.0 / 256.0; x <= 256.0; x *= 1.0000011)
+            {
+                const auto input = static_cast<float> (x);
+                worst = juce::jmax (worst, std::abs (fastLog2 (input) - std::log2 (static_cast<double> (input))));
+            }
+            ok &= report ("fastLog2", worst, fastLog2MaxError);
+        }
+
+        // oscillator phases plus phase modulation offsets, and long running LFO phases
+        ok &= report ("fastSin2Pi",
+                      maxError ([] (auto p) { return fastSin2Pi (p); },
+                                [twoPi] (double p) { return std::sin (twoPi * p); }, -4096.0, 4096.0, 1.37e-4, false),
+                      fastSin2PiMaxError);
+
+        // the block form takes its SIMD path for whole registers and the scalar one for the tail
+        {
+            std::vector<float> phases (1027), output (1027);
+            double worst = 0.0;
+
+            for (int offset = 0; offset < 64; offset++)
+            {
+                for (size_t i = 0; i < phases.size(); i++)
+                    phases[i] = static_cast<float> (offset) * 0.37f + static_cast<float> (i) * 0.0031f - 2.0f;
+
+                fastSin2PiBlock (phases.data(), output.data(), static_cast<int> (phases.size()));
+
+                for (size_t i = 0; i < phases.size(); i++)
+                    worst = juce::jmax (worst, std::abs (output[i] - std::sin (twoPi * phases[i])));
+            }
+            ok &= report ("fastSin2PiBlock", worst, fastSin2PiMaxError);
+        }
+
+        std::cout << (ok ? "math check passed\n" : "math check FAILED\n");
+        return ok;
+    }
+
+    //==============================================================================
+    /** Nanoseconds per value of f over data, best of a few runs */
+    template <typename Function>
+    static double timePerValue (const std::vector<float>& data, Function&& f)
+    {
+        static volatile float sink = 0.0f;
+        double best = 1.0e9;
+
+        for (int run = 0; run < 5; run++)
+        {
+            const auto start = juce::Time::getHighResolutionTicks();
+            sink = sink + f (data);
+            const auto end = juce::Time::getHighResolutionTicks();
+            best = juce::jmin (best, juce::Time::highResolutionTicksToSeconds (end - start));
+        }
+
+        return best * 1.0e9 / static_cast<double> (data.size());
+    }
+
+    static void bench()
+    {
+        constexpr int numValues = 1 << 20;
+        std::vector<float> data (numValues), output (numValues);
+        juce::Random random (1);
+
+        for (auto& x : data)
+            x = random.nextFloat() * 4.0f - 2.0f;
+
+        auto line = [] (const char* name, double libm, double fast)
+        {
+            std::cout << juce::String (name).paddedRight (' ', 16)
+                      << "library " << juce::String (libm, 2).paddedLeft (' ', 7) << " ns   "
+                      << "fast " << juce::String (fast, 2).paddedLeft (' ', 7) << " ns   "
+                      << juce::String (libm / fast, 1) << "x\n";
+        };
+
+        // sums keep the compiler from dropping the loops
+        auto scalar = [&output] (auto f)
+        {
+            return [&output, f] (const std::vector<float>& in)
+            {
+                float sum = 0.0f;
+                for (size_t i = 0; i < in.size(); i++)
+                    sum += output[i] = f (in[i]);
+                return sum;
+            };
+        };
+
+        auto simd = [&output] (auto f)
+        {
+            return [&output, f] (const std::vector<float>& in)
+            {
+                for (size_t i = 0; i + SimdFloat::width <= in.size(); i += SimdFloat::width)
+                    f (SimdFloat::load (in.data() + i)).store (output.data() + i);
+                return output[in.size() / 2];
+            };
+        };
+
+        const double cubeLibm = timePerValue (data, scalar ([] (float x) { return static_cast<float> (std::pow (x, 3)); }));
+        line ("cube", cubeLibm, timePerValue (data, scalar ([] (float x) { return fastCube (x); })));
+        line ("cube simd", cubeLibm, timePerValue (data, simd ([] (SimdFloat x) { return fastCube (x); })));
+
+        const double exp2Libm = timePerValue (data, scalar ([] (float x) { return std::exp2 (x); }));
+        line ("exp2", exp2Libm, timePerValue (data, scalar ([] (float x) { return fastExp2 (x); })));
+        line ("exp2 simd", exp2Libm, timePerValue (data, simd ([] (SimdFloat x) { return fastExp2 (x); })));
+
+        std::vector<float> positive (data);
+        for (auto& x : positive)
+            x = std::exp2 (x);
+        line ("log2", timePerValue (positive, scalar ([] (float x) { return std::log2 (x); })),
+                      timePerValue (positive, scalar ([] (float x) { return fastLog2 (x); })));
+
+        // what SinOsc used to do, in double precision
+        const double sinLibm = timePerValue (data, scalar ([] (float p) { return static_cast<float> (std::sin (p * 2.0 * 3.1415926)); }));
+        line ("sin", sinLibm, timePerValue (data, scalar ([] (float p) { return fastSin2Pi (p); })));
+        line ("sin block", sinLibm, timePerValue (data, [&output] (const std::vector<float>& in)
+        {
+            fastSin2PiBlock (in.data(), output.data(), static_cast<int> (in.size()));
+            return output[in.size() / 2];
+        }));
+    }
+}